@@ -0,0 +1,307 @@
+#include <cstring>
+#include <stdexcept>
+#include "aes.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define AES_SIMD
+# include <immintrin.h>
+#endif
+
+namespace {
+
+struct aes_tables
+{
+    unsigned char sbox[256];
+    unsigned char inv_sbox[256];
+
+    aes_tables()
+    {
+        /* walk the multiplicative group with generator 3, pairing each
+           element with its inverse, then apply the affine transform */
+        unsigned char p = 1;
+        unsigned char q = 1;
+        do {
+            p = p ^ static_cast<unsigned char>(p << 1)
+                ^ (p & 0x80 ? 0x1B : 0);
+            q ^= q << 1;
+            q ^= q << 2;
+            q ^= q << 4;
+            if (q & 0x80)
+                q ^= 0x09;
+            unsigned char x = q ^ rotl(q, 1) ^ rotl(q, 2) ^ rotl(q, 3)
+                              ^ rotl(q, 4);
+            sbox[p] = x ^ 0x63;
+        } while (p != 1);
+        sbox[0] = 0x63;
+        for (int i = 0; i < 256; i++)
+            inv_sbox[sbox[i]] = static_cast<unsigned char>(i);
+    }
+
+    static unsigned char rotl(unsigned char x, int n)
+    {
+        return static_cast<unsigned char>((x << n) | (x >> (8 - n)));
+    }
+};
+
+}
+
+static const aes_tables &tables()
+{
+    static const aes_tables t;
+    return t;
+}
+
+static unsigned char xtime(unsigned char x)
+{
+    return static_cast<unsigned char>((x << 1) ^ (x & 0x80 ? 0x1B : 0));
+}
+
+static void mix_columns(unsigned char *s)
+{
+    for (int c = 0; c < 4; c++) {
+        unsigned char *a = s + 4 * c;
+        unsigned char all = a[0] ^ a[1] ^ a[2] ^ a[3];
+        unsigned char a0 = a[0];
+        a[0] ^= all ^ xtime(a[0] ^ a[1]);
+        a[1] ^= all ^ xtime(a[1] ^ a[2]);
+        a[2] ^= all ^ xtime(a[2] ^ a[3]);
+        a[3] ^= all ^ xtime(a[3] ^ a0);
+    }
+}
+
+static void encrypt_block(const unsigned char *rk, unsigned char *s)
+{
+    const unsigned char *sbox = tables().sbox;
+    for (int i = 0; i < 16; i++)
+        s[i] ^= rk[i];
+    for (int round = 1; round <= 10; round++) {
+        unsigned char t[16];
+        /* sub bytes and shift rows, the state being column major */
+        for (int c = 0; c < 4; c++) {
+            for (int r = 0; r < 4; r++)
+                t[r + 4 * c] = sbox[s[r + 4 * ((c + r) % 4)]];
+        }
+        if (round < 10)
+            mix_columns(t);
+        for (int i = 0; i < 16; i++)
+            s[i] = t[i] ^ rk[16 * round + i];
+    }
+}
+
+static void decrypt_block(const unsigned char *rk, unsigned char *s)
+{
+    const unsigned char *inv_sbox = tables().inv_sbox;
+    for (int i = 0; i < 16; i++)
+        s[i] ^= rk[160 + i];
+    for (int round = 9; round >= 0; round--) {
+        unsigned char t[16];
+        for (int c = 0; c < 4; c++) {
+            for (int r = 0; r < 4; r++)
+                t[r + 4 * ((c + r) % 4)] = inv_sbox[s[r + 4 * c]];
+        }
+        for (int i = 0; i < 16; i++)
+            t[i] ^= rk[16 * round + i];
+        if (round > 0) {
+            /* inverse mix columns as a premultiply followed by the
+               forward transform */
+            for (int c = 0; c < 4; c++) {
+                unsigned char *a = t + 4 * c;
+                unsigned char u = xtime(xtime(a[0] ^ a[2]));
+                unsigned char v = xtime(xtime(a[1] ^ a[3]));
+                a[0] ^= u;
+                a[1] ^= v;
+                a[2] ^= u;
+                a[3] ^= v;
+            }
+            mix_columns(t);
+        }
+        memcpy(s, t, 16);
+    }
+}
+
+static size_t encrypt_scalar(const unsigned char *rk, unsigned char *iv,
+                             const unsigned char *in, unsigned char *out,
+                             size_t size)
+{
+    for (size_t i = 0; i < size; i += 16) {
+        for (int j = 0; j < 16; j++)
+            iv[j] ^= in[i + j];
+        encrypt_block(rk, iv);
+        memcpy(out + i, iv, 16);
+    }
+    return size;
+}
+
+static size_t decrypt_scalar(const unsigned char *rk, unsigned char *iv,
+                             const unsigned char *in, unsigned char *out,
+                             size_t size)
+{
+    for (size_t i = 0; i < size; i += 16) {
+        unsigned char block[16];
+        unsigned char next_iv[16];
+        memcpy(block, in + i, 16);
+        memcpy(next_iv, block, 16);
+        decrypt_block(rk, block);
+        for (int j = 0; j < 16; j++)
+            out[i + j] = block[j] ^ iv[j];
+        memcpy(iv, next_iv, 16);
+    }
+    return size;
+}
+
+#ifdef AES_SIMD
+__attribute__((target("aes,sse2")))
+static size_t encrypt_aesni(const unsigned char *rk, unsigned char *iv,
+                            const unsigned char *in, unsigned char *out,
+                            size_t size)
+{
+    __m128i k[11];
+    for (int i = 0; i < 11; i++)
+        k[i] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(rk) + i);
+
+    /* each block depends on the one before, so there is nothing to
+       interleave */
+    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(iv));
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        __m128i b = _mm_loadu_si128(
+            reinterpret_cast<const __m128i *>(in + i));
+        x = _mm_xor_si128(_mm_xor_si128(x, b), k[0]);
+        for (int r = 1; r < 10; r++)
+            x = _mm_aesenc_si128(x, k[r]);
+        x = _mm_aesenclast_si128(x, k[10]);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), x);
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(iv), x);
+    return i;
+}
+
+__attribute__((target("aes,sse2")))
+static size_t decrypt_aesni(const unsigned char *rk, unsigned char *iv,
+                            const unsigned char *in, unsigned char *out,
+                            size_t size)
+{
+    __m128i k[11];
+    k[0] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(rk) + 10);
+    for (int i = 1; i < 10; i++) {
+        k[i] = _mm_aesimc_si128(_mm_loadu_si128(
+            reinterpret_cast<const __m128i *>(rk) + 10 - i));
+    }
+    k[10] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(rk));
+
+    /* unlike encryption, cbc decryption only needs the previous
+       ciphertext, so four blocks can be in flight at once */
+    __m128i prev = _mm_loadu_si128(reinterpret_cast<const __m128i *>(iv));
+    size_t i = 0;
+    for (; i + 64 <= size; i += 64) {
+        auto p = reinterpret_cast<const __m128i *>(in + i);
+        __m128i b0 = _mm_loadu_si128(p);
+        __m128i b1 = _mm_loadu_si128(p + 1);
+        __m128i b2 = _mm_loadu_si128(p + 2);
+        __m128i b3 = _mm_loadu_si128(p + 3);
+        __m128i x0 = _mm_xor_si128(b0, k[0]);
+        __m128i x1 = _mm_xor_si128(b1, k[0]);
+        __m128i x2 = _mm_xor_si128(b2, k[0]);
+        __m128i x3 = _mm_xor_si128(b3, k[0]);
+        for (int r = 1; r < 10; r++) {
+            x0 = _mm_aesdec_si128(x0, k[r]);
+            x1 = _mm_aesdec_si128(x1, k[r]);
+            x2 = _mm_aesdec_si128(x2, k[r]);
+            x3 = _mm_aesdec_si128(x3, k[r]);
+        }
+        x0 = _mm_xor_si128(_mm_aesdeclast_si128(x0, k[10]), prev);
+        x1 = _mm_xor_si128(_mm_aesdeclast_si128(x1, k[10]), b0);
+        x2 = _mm_xor_si128(_mm_aesdeclast_si128(x2, k[10]), b1);
+        x3 = _mm_xor_si128(_mm_aesdeclast_si128(x3, k[10]), b2);
+        auto q = reinterpret_cast<__m128i *>(out + i);
+        _mm_storeu_si128(q, x0);
+        _mm_storeu_si128(q + 1, x1);
+        _mm_storeu_si128(q + 2, x2);
+        _mm_storeu_si128(q + 3, x3);
+        prev = b3;
+    }
+    for (; i + 16 <= size; i += 16) {
+        __m128i b = _mm_loadu_si128(
+            reinterpret_cast<const __m128i *>(in + i));
+        __m128i x = _mm_xor_si128(b, k[0]);
+        for (int r = 1; r < 10; r++)
+            x = _mm_aesdec_si128(x, k[r]);
+        x = _mm_xor_si128(_mm_aesdeclast_si128(x, k[10]), prev);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), x);
+        prev = b;
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(iv), prev);
+    return i;
+}
+#endif
+
+Aes128::Aes128(const unsigned char *key, kernel_t kernel)
+    : kernel(kernel)
+{
+    if (kernel == kernel_t::AUTO) {
+        static const kernel_t best = kernelSupported(kernel_t::AESNI)
+                                     ? kernel_t::AESNI
+                                     : kernel_t::SCALAR;
+        this->kernel = best;
+    }
+
+    const unsigned char *sbox = tables().sbox;
+    memcpy(round_keys, key, 16);
+    unsigned char rcon = 1;
+    for (int i = 16; i < 176; i += 4) {
+        unsigned char t[4];
+        memcpy(t, round_keys + i - 4, 4);
+        if (i % 16 == 0) {
+            unsigned char t0 = t[0];
+            t[0] = sbox[t[1]] ^ rcon;
+            t[1] = sbox[t[2]];
+            t[2] = sbox[t[3]];
+            t[3] = sbox[t0];
+            rcon = xtime(rcon);
+        }
+        for (int j = 0; j < 4; j++)
+            round_keys[i + j] = round_keys[i - 16 + j] ^ t[j];
+    }
+}
+
+bool Aes128::kernelSupported(kernel_t kernel)
+{
+    switch (kernel) {
+        case kernel_t::AUTO:
+        case kernel_t::SCALAR:
+            return true;
+#ifdef AES_SIMD
+        case kernel_t::AESNI:
+            return __builtin_cpu_supports("aes")
+                   && __builtin_cpu_supports("sse2");
+#endif
+        default:
+            return false;
+    }
+}
+
+void Aes128::encryptCbc(unsigned char *iv, const unsigned char *in,
+                        unsigned char *out, size_t size) const
+{
+    if (size % 16 != 0)
+        throw std::runtime_error("aes: partial block");
+    size_t done = 0;
+#ifdef AES_SIMD
+    if (kernel == kernel_t::AESNI)
+        done = encrypt_aesni(round_keys, iv, in, out, size);
+#endif
+    encrypt_scalar(round_keys, iv, in + done, out + done, size - done);
+}
+
+void Aes128::decryptCbc(unsigned char *iv, const unsigned char *in,
+                        unsigned char *out, size_t size) const
+{
+    if (size % 16 != 0)
+        throw std::runtime_error("aes: partial block");
+    size_t done = 0;
+#ifdef AES_SIMD
+    if (kernel == kernel_t::AESNI)
+        done = decrypt_aesni(round_keys, iv, in, out, size);
+#endif
+    decrypt_scalar(round_keys, iv, in + done, out + done, size - done);
+}
@@ -0,0 +1,32 @@
+#ifndef AES_H
+#define AES_H
+#include <cstddef>
+
+class Aes128
+{
+public:
+    enum kernel_t
+    {
+        AUTO,
+        SCALAR,
+        AESNI,
+    };
+
+    explicit Aes128(const unsigned char *key,
+                    kernel_t kernel = kernel_t::AUTO);
+
+    static bool kernelSupported(kernel_t kernel);
+
+    /* size has to be a multiple of the block size. iv is updated to the
+       last ciphertext block, so that a stream can be processed in parts */
+    void encryptCbc(unsigned char *iv, const unsigned char *in,
+                    unsigned char *out, size_t size) const;
+    void decryptCbc(unsigned char *iv, const unsigned char *in,
+                    unsigned char *out, size_t size) const;
+
+private:
+    unsigned char round_keys[176];
+    kernel_t kernel;
+};
+
+#endif
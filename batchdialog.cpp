@@ -0,0 +1,157 @@
+#include <QFileInfo>
+#include "batchdialog.h"
+#include "outputdialog.h"
+#include "ui_batchdialog.h"
+
+BatchDialog::BatchDialog(QWidget *parent)
+    : QDialog(parent)
+    , ui(new Ui::BatchDialog)
+    , queue(new PatchQueue(this))
+{
+    ui->setupUi(this);
+
+    connect(ui->pushbutton_start, &QPushButton::clicked,
+            queue, &PatchQueue::start);
+    connect(ui->pushbutton_cancel, &QPushButton::clicked,
+            queue, &PatchQueue::cancel);
+    connect(ui->pushbutton_clear, &QPushButton::clicked,
+        [this]()
+        {
+            queue->clear();
+            ui->tablewidget_jobs->setRowCount(0);
+            update_state();
+        });
+    connect(ui->pushbutton_close, &QPushButton::clicked, this,
+        [this]()
+        {
+            close();
+        });
+    connect(ui->tablewidget_jobs, &QTableWidget::cellDoubleClicked, this,
+        [this](int row, int)
+        {
+            const PatchJob &job = queue->job(row);
+            OutputDialog od(this);
+            od.setClosable(true);
+            od.write(job.log);
+            if (!job.error.empty())
+                od.write(QString::fromStdString(job.error));
+            od.exec();
+        });
+
+    connect(queue, &PatchQueue::jobStarted, this,
+        [this](int index)
+        {
+            update_row(index);
+            update_state();
+        });
+    connect(queue, &PatchQueue::jobFinished, this,
+        [this](int index)
+        {
+            update_row(index);
+            update_state();
+        });
+    connect(queue, &PatchQueue::finished, this,
+        [this]()
+        {
+            for (int i = 0; i < queue->jobCount(); i++)
+                update_row(i);
+            update_state();
+        });
+
+    update_state();
+}
+
+BatchDialog::~BatchDialog()
+{
+    delete ui;
+}
+
+void BatchDialog::addJob(const PatcherSettings &settings)
+{
+    int index = queue->addJob(settings);
+    ui->tablewidget_jobs->setRowCount(queue->jobCount());
+    update_row(index);
+    update_state();
+}
+
+void BatchDialog::done(int r)
+{
+    if (!queue->isRunning())
+        QDialog::done(r);
+}
+
+void BatchDialog::update_row(int index)
+{
+    const PatchJob &job = queue->job(index);
+    const PatcherSettings &settings = job.settings;
+
+    std::string input;
+    if (settings.patch_mode == PatcherSettings::patch_mode_t::ROM)
+        input = settings.rom_path;
+    else
+        input = settings.wad_path;
+
+    QString status;
+    switch (job.status) {
+        case PatchJob::status_t::PENDING: status = "Pending"; break;
+        case PatchJob::status_t::RUNNING: status = "Running"; break;
+        case PatchJob::status_t::DONE: status = "Done"; break;
+        case PatchJob::status_t::FAILED: {
+            if (job.result == 2)
+                status = "ROM not recognized";
+            else
+                status = "Failed";
+            break;
+        }
+        case PatchJob::status_t::CANCELLED: status = "Cancelled"; break;
+    }
+
+    QString time;
+    if (job.status == PatchJob::status_t::DONE
+        || job.status == PatchJob::status_t::FAILED
+        || (job.status == PatchJob::status_t::CANCELLED && job.elapsed_ms))
+    {
+        time = QString::number(job.elapsed_ms / 1000., 'f', 2) + " s";
+    }
+
+    QStringList columns =
+    {
+        QFileInfo(QString::fromStdString(input)).fileName(),
+        QFileInfo(QString::fromStdString(settings.output_path)).fileName(),
+        status,
+        time,
+    };
+    for (int i = 0; i < columns.size(); i++) {
+        auto item = ui->tablewidget_jobs->item(index, i);
+        if (!item) {
+            item = new QTableWidgetItem;
+            ui->tablewidget_jobs->setItem(index, i, item);
+        }
+        item->setText(columns[i]);
+    }
+}
+
+void BatchDialog::update_state()
+{
+    bool running = queue->isRunning();
+    ui->pushbutton_start->setEnabled(!running && queue->jobCount() > 0);
+    ui->pushbutton_clear->setEnabled(!running);
+    ui->pushbutton_cancel->setEnabled(running);
+    ui->pushbutton_close->setEnabled(!running);
+
+    if (queue->finishedCount() == 0) {
+        ui->label_throughput
+            ->setText(QString::number(queue->jobCount()) + " jobs, "
+                      + QString::number(queue->maxWorkers()) + " workers");
+    }
+    else {
+        ui->label_throughput
+            ->setText(QString::number(queue->finishedCount()) + "/"
+                      + QString::number(queue->jobCount()) + " jobs, "
+                      + QString::number(queue->jobsPerSecond(), 'f', 2)
+                      + " jobs/s, "
+                      + QString::number(queue->bytesPerSecond()
+                                        / (1024. * 1024.), 'f', 1)
+                      + " MiB/s");
+    }
+}
@@ -0,0 +1,31 @@
+#ifndef BATCHDIALOG_H
+#define BATCHDIALOG_H
+#include <QDialog>
+#include "patchqueue.h"
+
+QT_BEGIN_NAMESPACE
+namespace Ui { class BatchDialog; }
+QT_END_NAMESPACE
+
+class BatchDialog : public QDialog
+{
+    Q_OBJECT
+
+public:
+    explicit BatchDialog(QWidget *parent = nullptr);
+    ~BatchDialog() override;
+
+    void addJob(const PatcherSettings &settings);
+
+public slots:
+    void done(int r) override;
+
+private:
+    Ui::BatchDialog *ui;
+    PatchQueue *queue;
+
+    void update_row(int index);
+    void update_state();
+};
+
+#endif
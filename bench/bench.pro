@@ -0,0 +1,13 @@
+TEMPLATE = subdirs
+
+SUBDIRS += \
+    outputdialog \
+    patcher \
+    romformat \
+    standin \
+    subprocess \
+    ups \
+    wad
+
+patcher.depends = standin
+subprocess.depends = standin
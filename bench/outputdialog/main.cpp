@@ -0,0 +1,55 @@
+#include <cstdio>
+#include <QApplication>
+#include <QElapsedTimer>
+#include "outputdialog.h"
+
+static void report(const char *name, double value, const char *unit)
+{
+    printf("%-28s %12.2f %s\n", name, value, unit);
+}
+
+/* time each append all the way into the document, with the log already
+   holding n_lines lines. uncapped, the log keeps growing past that; capped
+   at n_lines, every append also trims the oldest lines */
+static void bench(QApplication &a, int n_lines, bool capped,
+                  const QString &chunk, int n_appends)
+{
+    OutputDialog dialog;
+    dialog.setMaxLines(capped ? n_lines : 0);
+    dialog.setMaxChars(0);
+    dialog.show();
+
+    QString line = QString(79, 'x') + "\n";
+    dialog.write(line.repeated(n_lines));
+    a.processEvents();
+
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < n_appends; i++) {
+        dialog.write(chunk);
+        a.processEvents();
+    }
+    qint64 total_ns = timer.nsecsElapsed();
+
+    char name[64];
+    snprintf(name, sizeof(name), "  %d lines%s", n_lines,
+             capped ? ", capped" : "");
+    report(name, static_cast<double>(total_ns) / n_appends / 1e3, "us");
+}
+
+int main(int argc, char *argv[])
+{
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    QApplication a(argc, argv);
+
+    /* one 1 KiB chunk per append, as read from a subprocess */
+    QString chunk = (QString(63, 'x') + "\n").repeated(16);
+    for (bool capped : {false, true}) {
+        printf("append cost%s:\n", capped ? " at the line cap" : "");
+        for (int n_lines : {1000, 10000, 100000})
+            bench(a, n_lines, capped, chunk, 1000);
+    }
+
+    return 0;
+}
@@ -0,0 +1,18 @@
+QT       += core gui widgets
+
+CONFIG += c++11
+CONFIG -= app_bundle
+
+TARGET = bench_outputdialog
+
+INCLUDEPATH += ../..
+
+SOURCES += \
+    main.cpp \
+    ../../outputdialog.cpp
+
+HEADERS += \
+    ../../outputdialog.h
+
+FORMS += \
+    ../../outputdialog.ui
@@ -0,0 +1,165 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <stdexcept>
+#include <vector>
+#include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QStandardPaths>
+#include <QTemporaryDir>
+#include "gzinjectshim.h"
+#include "mappedfile.h"
+#include "patcher.h"
+#include "publish.h"
+
+static const int n_runs = 8;
+static const size_t rom_size = 32 * 1024 * 1024;
+static const size_t publish_size = 256 * 1024 * 1024;
+
+static void report(const char *name, double value, const char *unit)
+{
+    printf("%-28s %12.2f %s\n", name, value, unit);
+}
+
+static bool install_standin(const QString &standin, const QString &path)
+{
+    QFile::remove(path);
+    return QFile::copy(standin, path)
+           && QFile::setPermissions(path, QFile::ReadOwner | QFile::WriteOwner
+                                          | QFile::ExeOwner);
+}
+
+static void make_file(const QString &path, size_t size,
+                      const unsigned char *magic)
+{
+    mapped_file file = mapped_file::create(path.toStdString(), size);
+    if (magic)
+        memcpy(file.data(), magic, 4);
+}
+
+static double bench_patch(const PatcherSettings &settings)
+{
+    std::vector<double> times;
+    for (int i = 0; i < n_runs; i++) {
+        Patcher patcher(settings);
+        QElapsedTimer timer;
+        timer.start();
+        patcher.run();
+        int result = patcher.getResult();
+        times.push_back(timer.nsecsElapsed() / 1e6);
+        if (result != 0)
+            throw std::runtime_error("patch failed");
+    }
+    std::sort(times.begin(), times.end());
+    return times[times.size() / 2];
+}
+
+int main(int argc, char *argv[])
+{
+    if (is_gzinject_shim())
+        return gzinject_shim_main(argc, argv);
+
+    QCoreApplication a(argc, argv);
+    QStandardPaths::setTestModeEnabled(true);
+    QString standin = argc > 1 ? argv[1] : STANDIN_PATH;
+
+    try {
+        QTemporaryDir root;
+        QDir app(root.filePath("app"));
+        for (auto dir : {"bin", "lua", "ups", "gzi"}) {
+            if (!app.mkpath(dir))
+                throw std::runtime_error("could not create app directory");
+        }
+#ifdef Q_OS_WIN
+        const char *gru = "bin/gru.exe";
+        const char *gzinject = "bin/gzinject.exe";
+#else
+        const char *gru = "bin/gru";
+        const char *gzinject = "bin/gzinject";
+#endif
+        if (!install_standin(standin, app.filePath(gru))
+            || !install_standin(standin, app.filePath(gzinject)))
+        {
+            throw std::runtime_error("could not install " + standin
+                                     .toStdString());
+        }
+        for (auto script : {"patch-rom.lua", "patch-wad.lua",
+                            "inject_ucode.lua", "rom_table.lua"})
+        {
+            QFile file(app.filePath("lua/") + script);
+            file.open(QIODevice::WriteOnly);
+        }
+        QDir::setCurrent(app.path());
+
+        static const unsigned char z64_magic[] = {0x80, 0x37, 0x12, 0x40};
+        static const unsigned char v64_magic[] = {0x37, 0x80, 0x40, 0x12};
+        QString z64_path = root.filePath("in.z64");
+        QString v64_path = root.filePath("in.v64");
+        QString wad_path = root.filePath("in.wad");
+        make_file(z64_path, rom_size, z64_magic);
+        make_file(v64_path, rom_size, v64_magic);
+        make_file(wad_path, rom_size, nullptr);
+
+        PatcherSettings rom;
+        rom.patch_mode = PatcherSettings::patch_mode_t::ROM;
+        rom.rom_path = z64_path.toStdString();
+        rom.output_path = root.filePath("out.z64").toStdString();
+        rom.use_cache = false;
+        rom.use_worker = false;
+        report("rom", bench_patch(rom), "ms");
+
+        rom.use_worker = true;
+        report("rom worker", bench_patch(rom), "ms");
+
+        PatcherSettings v64 = rom;
+        v64.rom_path = v64_path.toStdString();
+        report("rom v64 worker", bench_patch(v64), "ms");
+
+        PatcherSettings ucode = rom;
+        ucode.opt_ucode = true;
+        ucode.ucode_path = v64_path.toStdString();
+        report("rom ucode worker", bench_patch(ucode), "ms");
+
+        PatcherSettings cached = rom;
+        cached.use_cache = true;
+        report("rom cached", bench_patch(cached), "ms");
+
+        PatcherSettings wad;
+        wad.patch_mode = PatcherSettings::patch_mode_t::WAD;
+        wad.wad_path = wad_path.toStdString();
+        wad.output_path = root.filePath("out.wad").toStdString();
+        wad.use_cache = false;
+        report("wad worker", bench_patch(wad), "ms");
+
+        std::string src_path = root.filePath("publish.bin").toStdString();
+        std::string dest_path = root.filePath("published.bin").toStdString();
+        make_file(QString::fromStdString(src_path), publish_size, nullptr);
+
+        QElapsedTimer timer;
+        timer.start();
+        copy_file(src_path, dest_path);
+        report("copy", publish_size / (timer.nsecsElapsed() / 1e9) / 1e6,
+               "MB/s");
+
+        timer.start();
+        publish_file(src_path, dest_path);
+        report("publish same filesystem", timer.nsecsElapsed() / 1e3, "us");
+
+        QTemporaryDir other;
+        std::string other_path = other.filePath("published.bin")
+                                 .toStdString();
+        timer.start();
+        publish_file(dest_path, other_path);
+        report("publish temp dir", timer.nsecsElapsed() / 1e6, "ms");
+    }
+    catch (const std::exception &e) {
+        fprintf(stderr, "%s\n", e.what());
+        return EXIT_FAILURE;
+    }
+
+    return 0;
+}
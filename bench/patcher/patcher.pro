@@ -0,0 +1,50 @@
+QT       += core gui widgets
+
+CONFIG += console c++11
+CONFIG -= app_bundle
+
+TARGET = bench_patcher
+
+INCLUDEPATH += ../..
+
+win32: DEFINES += \
+    STANDIN_PATH=\\\"$$OUT_PWD/../standin/release/standin.exe\\\"
+else: DEFINES += STANDIN_PATH=\\\"$$OUT_PWD/../standin/standin\\\"
+
+SOURCES += \
+    main.cpp \
+    ../../aes.cpp \
+    ../../crc32.cpp \
+    ../../gruworker.cpp \
+    ../../gzi.cpp \
+    ../../gzinjectshim.cpp \
+    ../../manifest.cpp \
+    ../../mappedfile.cpp \
+    ../../patcher.cpp \
+    ../../publish.cpp \
+    ../../resultcache.cpp \
+    ../../romformat.cpp \
+    ../../subprocess.cpp \
+    ../../trace.cpp \
+    ../../ups.cpp \
+    ../../wad.cpp \
+    ../../wadcache.cpp
+
+HEADERS += \
+    ../../aes.h \
+    ../../crc32.h \
+    ../../gruworker.h \
+    ../../gzi.h \
+    ../../gzinjectshim.h \
+    ../../manifest.h \
+    ../../mappedfile.h \
+    ../../patcher.h \
+    ../../publish.h \
+    ../../resultcache.h \
+    ../../romformat.h \
+    ../../subprocess.h \
+    ../../sysutil.h \
+    ../../trace.h \
+    ../../ups.h \
+    ../../wad.h \
+    ../../wadcache.h
@@ -0,0 +1,183 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <random>
+#include <vector>
+#include <QTemporaryDir>
+#include "crc32.h"
+#include "mappedfile.h"
+#include "romformat.h"
+
+static const size_t rom_size = 64 * 1024 * 1024;
+static const int n_runs = 16;
+
+static const char *kernel_name(RomFormat::kernel_t kernel)
+{
+    switch (kernel) {
+        case RomFormat::kernel_t::SCALAR: return "scalar";
+        case RomFormat::kernel_t::SSE2: return "sse2";
+        case RomFormat::kernel_t::AVX2: return "avx2";
+        default: return "auto";
+    }
+}
+
+static double bench(unsigned char *data, size_t size,
+                    RomFormat::format_t format, RomFormat::kernel_t kernel)
+{
+    double best = 0.;
+    for (int i = 0; i < n_runs; i++) {
+        auto start = std::chrono::steady_clock::now();
+        RomFormat::normalize(data, size, format, kernel);
+        auto end = std::chrono::steady_clock::now();
+        double s = std::chrono::duration<double>(end - start).count();
+        double gbps = size / s / 1e9;
+        if (gbps > best)
+            best = gbps;
+    }
+    return best;
+}
+
+/* fill in the last four bytes of the boot code so that its crc32 is that
+   of a 6102, by running the crc backwards from the target */
+static void forge_boot_code(unsigned char *boot, size_t size)
+{
+    uint32_t table[256];
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++)
+            c = c & 1 ? (c >> 1) ^ 0xEDB88320 : c >> 1;
+        table[i] = c;
+    }
+
+    uint32_t target = 0x90BB6CB5 ^ 0xFFFFFFFF;
+    unsigned char index[4];
+    for (int k = 3; k >= 0; k--) {
+        for (uint32_t i = 0; i < 256; i++) {
+            if ((table[i] >> 24) == (target >> 24)) {
+                index[k] = static_cast<unsigned char>(i);
+                target = (target ^ table[i]) << 8;
+                break;
+            }
+        }
+    }
+    uint32_t c = crc32(0, boot, size - 4) ^ 0xFFFFFFFF;
+    for (int k = 0; k < 4; k++) {
+        boot[size - 4 + k] = static_cast<unsigned char>(c ^ index[k]);
+        c = (c >> 8) ^ table[index[k]];
+    }
+}
+
+static void bench_checksum(std::vector<unsigned char> rom)
+{
+    forge_boot_code(rom.data() + 0x40, 0x1000 - 0x40);
+
+    RomFormat::kernel_t kernels[] =
+    {
+        RomFormat::kernel_t::SCALAR,
+        RomFormat::kernel_t::AVX2,
+    };
+    uint32_t expected[2] = {};
+    for (auto kernel : kernels) {
+        if (!RomFormat::kernelSupported(kernel))
+            continue;
+
+        uint32_t crc[2];
+        double best = 0.;
+        for (int i = 0; i < n_runs; i++) {
+            auto start = std::chrono::steady_clock::now();
+            if (!RomFormat::checksum(rom.data(), rom.size(), &crc[0],
+                                     &crc[1], kernel))
+            {
+                fprintf(stderr, "checksum: cic not detected\n");
+                exit(EXIT_FAILURE);
+            }
+            auto end = std::chrono::steady_clock::now();
+            double s = std::chrono::duration<double>(end - start).count();
+            double gbps = 0x100000 / s / 1e9;
+            if (gbps > best)
+                best = gbps;
+        }
+        if (kernel == RomFormat::kernel_t::SCALAR) {
+            expected[0] = crc[0];
+            expected[1] = crc[1];
+        }
+        else if (crc[0] != expected[0] || crc[1] != expected[1]) {
+            fprintf(stderr, "checksum: %s kernel mismatch\n",
+                    kernel_name(kernel));
+            exit(EXIT_FAILURE);
+        }
+        printf("crc %-6s %6.2f GB/s\n", kernel_name(kernel), best);
+    }
+}
+
+int main()
+{
+    std::vector<unsigned char> source(rom_size);
+    std::mt19937 rng(0x80371240);
+    for (auto &c : source)
+        c = static_cast<unsigned char>(rng());
+
+    RomFormat::kernel_t kernels[] =
+    {
+        RomFormat::kernel_t::SCALAR,
+        RomFormat::kernel_t::SSE2,
+        RomFormat::kernel_t::AVX2,
+    };
+    RomFormat::format_t formats[] =
+    {
+        RomFormat::format_t::V64,
+        RomFormat::format_t::N64,
+    };
+
+    for (auto format : formats) {
+        std::vector<unsigned char> expected = source;
+        RomFormat::normalize(expected.data(), expected.size(), format,
+                             RomFormat::kernel_t::SCALAR);
+
+        for (auto kernel : kernels) {
+            if (!RomFormat::kernelSupported(kernel))
+                continue;
+
+            std::vector<unsigned char> data = source;
+            RomFormat::normalize(data.data() + 1, data.size() - 3, format,
+                                 kernel);
+            std::vector<unsigned char> check = source;
+            RomFormat::normalize(check.data() + 1, check.size() - 3, format,
+                                 RomFormat::kernel_t::SCALAR);
+            if (data != check) {
+                fprintf(stderr, "%s: %s kernel mismatch\n",
+                        format == RomFormat::format_t::V64 ? "v64" : "n64",
+                        kernel_name(kernel));
+                return EXIT_FAILURE;
+            }
+
+            printf("%s %-6s %6.2f GB/s\n",
+                   format == RomFormat::format_t::V64 ? "v64" : "n64",
+                   kernel_name(kernel),
+                   bench(data.data(), data.size(), format, kernel));
+        }
+    }
+
+    bench_checksum(source);
+
+    try {
+        QTemporaryDir tmpdir;
+        std::string path = tmpdir.filePath("rom.v64").toStdString();
+        {
+            mapped_file file = mapped_file::create(path, rom_size);
+            memcpy(file.data(), source.data(), rom_size);
+        }
+        mapped_file file(path, mapped_file::mode_t::READ_WRITE);
+        printf("v64 mapped %6.2f GB/s\n",
+               bench(file.data(), file.size(), RomFormat::format_t::V64,
+                     RomFormat::kernel_t::AUTO));
+    }
+    catch (const std::exception &e) {
+        fprintf(stderr, "%s\n", e.what());
+        return EXIT_FAILURE;
+    }
+
+    return 0;
+}
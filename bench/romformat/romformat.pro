@@ -0,0 +1,21 @@
+QT       += core
+QT       -= gui
+
+CONFIG += console c++11
+CONFIG -= app_bundle
+
+TARGET = bench_romformat
+
+INCLUDEPATH += ../..
+
+SOURCES += \
+    main.cpp \
+    ../../crc32.cpp \
+    ../../mappedfile.cpp \
+    ../../romformat.cpp
+
+HEADERS += \
+    ../../crc32.h \
+    ../../mappedfile.h \
+    ../../romformat.h \
+    ../../sysutil.h
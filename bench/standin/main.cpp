@@ -0,0 +1,162 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+/* stand-in for bin/gru and bin/gzinject, configured through the
+   environment:
+
+     STANDIN_STDIN        read stdin to the end first if non-zero
+     STANDIN_STDOUT       bytes to write to stdout
+     STANDIN_STDERR       bytes to write to stderr
+     STANDIN_SLEEP_MS     milliseconds to sleep before exiting
+     STANDIN_OUTPUT_SIZE  size of the file written for -o (default 32 MiB)
+     STANDIN_NAME         name printed on stdout (default "gz")
+     STANDIN_STATUS       exit status
+
+   "-a genkey -k <path>" writes a 16 byte key. when started with a
+   gru-worker.lua driver, requests are read from stdin and answered with
+   the driver's marker protocol. */
+
+static size_t env_size(const char *name, size_t default_value)
+{
+    const char *value = getenv(name);
+    if (!value || !*value)
+        return default_value;
+    return static_cast<size_t>(strtoull(value, nullptr, 0));
+}
+
+static void write_bytes(FILE *f, size_t size)
+{
+    static char line[4096];
+    if (!line[0]) {
+        memset(line, 'x', sizeof(line) - 1);
+        line[sizeof(line) - 1] = '\n';
+    }
+    while (size != 0) {
+        size_t n = size < sizeof(line) ? size : sizeof(line);
+        fwrite(line, 1, n, f);
+        size -= n;
+    }
+}
+
+static bool write_file(const std::string &path, size_t size)
+{
+    FILE *f = fopen(path.c_str(), "wb");
+    if (!f)
+        return false;
+    std::vector<char> buf(1 << 20, '\0');
+    while (size != 0) {
+        size_t n = size < buf.size() ? size : buf.size();
+        if (fwrite(buf.data(), 1, n, f) != n) {
+            fclose(f);
+            return false;
+        }
+        size -= n;
+    }
+    return fclose(f) == 0;
+}
+
+static int run(const std::vector<std::string> &args)
+{
+    std::string out_path;
+    std::string key_path;
+    bool genkey = false;
+    for (size_t i = 0; i < args.size(); i++) {
+        if (args[i] == "-o" && i + 1 < args.size())
+            out_path = args[++i];
+        else if (args[i] == "-k" && i + 1 < args.size())
+            key_path = args[++i];
+        else if (args[i] == "-a" && i + 1 < args.size())
+            genkey = args[++i] == "genkey";
+    }
+
+    write_bytes(stdout, env_size("STANDIN_STDOUT", 0));
+    write_bytes(stderr, env_size("STANDIN_STDERR", 0));
+    if (genkey && !key_path.empty()) {
+        static const char key[16] = {};
+        FILE *f = fopen(key_path.c_str(), "wb");
+        if (!f || fwrite(key, 1, sizeof(key), f) != sizeof(key)) {
+            perror(key_path.c_str());
+            return EXIT_FAILURE;
+        }
+        fclose(f);
+    }
+    if (!out_path.empty()) {
+        if (!write_file(out_path, env_size("STANDIN_OUTPUT_SIZE",
+                                           32 * 1024 * 1024)))
+        {
+            perror(out_path.c_str());
+            return EXIT_FAILURE;
+        }
+        const char *name = getenv("STANDIN_NAME");
+        fputs(name ? name : "gz", stdout);
+    }
+
+    size_t sleep_ms = env_size("STANDIN_SLEEP_MS", 0);
+    if (sleep_ms != 0)
+        std::this_thread::sleep_for(std::chrono::milliseconds(sleep_ms));
+
+    return static_cast<int>(env_size("STANDIN_STATUS", 0));
+}
+
+static bool read_line(std::string *line)
+{
+    line->clear();
+    int c;
+    while ((c = getchar()) != EOF && c != '\n')
+        line->push_back(static_cast<char>(c));
+    return c != EOF || !line->empty();
+}
+
+static int serve(const std::string &marker)
+{
+    std::string line;
+    while (read_line(&line)) {
+        size_t argc = strtoul(line.c_str(), nullptr, 10);
+        std::vector<std::string> args;
+        for (size_t i = 0; i < argc; i++) {
+            if (!read_line(&line))
+                return EXIT_FAILURE;
+            std::string arg(strtoul(line.c_str(), nullptr, 10), '\0');
+            if (!arg.empty() && fread(&arg[0], 1, arg.size(), stdin)
+                                != arg.size())
+            {
+                return EXIT_FAILURE;
+            }
+            getchar();
+            args.push_back(arg);
+        }
+        int status = run(args);
+        fprintf(stdout, "%s%d\n", marker.c_str(), status);
+        fflush(stdout);
+        fprintf(stderr, "%s\n", marker.c_str());
+        fflush(stderr);
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    std::vector<std::string> args(argv + 1, argv + argc);
+    static const char driver[] = "gru-worker.lua";
+    if (args.size() == 2 && args[0].size() >= sizeof(driver) - 1
+        && args[0].compare(args[0].size() - (sizeof(driver) - 1),
+                           std::string::npos, driver) == 0)
+    {
+        return serve(args[1]);
+    }
+
+    if (env_size("STANDIN_STDIN", 0) != 0) {
+        std::vector<char> buf(1 << 16);
+        while (fread(buf.data(), 1, buf.size(), stdin) != 0)
+            ;
+    }
+
+    int status = run(args);
+    fflush(stdout);
+    return status;
+}
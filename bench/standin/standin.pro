@@ -0,0 +1,9 @@
+QT       -= core gui
+
+CONFIG += console c++11
+CONFIG -= app_bundle qt
+
+TARGET = standin
+
+SOURCES += \
+    main.cpp
@@ -0,0 +1,101 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <string>
+#include <vector>
+#include "gruworker.h"
+#include "subprocess.h"
+
+static const int n_runs = 64;
+
+static double seconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now()
+                                         - start).count();
+}
+
+static void report(const char *name, double value, const char *unit)
+{
+    printf("%-28s %12.2f %s\n", name, value, unit);
+}
+
+int main(int argc, char *argv[])
+{
+    std::string standin = argc > 1 ? argv[1] : STANDIN_PATH;
+    auto discard = [](const char *, size_t) {};
+
+    try {
+        std::vector<double> times;
+        for (int i = 0; i < n_runs; i++) {
+            auto start = std::chrono::steady_clock::now();
+            int status = invoke_subprogram({standin}, {}, "", discard,
+                                           discard);
+            times.push_back(seconds_since(start));
+            if (status != 0) {
+                fprintf(stderr, "standin exited with %d\n", status);
+                return EXIT_FAILURE;
+            }
+        }
+        std::sort(times.begin(), times.end());
+        report("spawn latency min", times.front() * 1e6, "us");
+        report("spawn latency median", times[times.size() / 2] * 1e6, "us");
+
+        const size_t stream_size = 256 * 1024 * 1024;
+        size_t received = 0;
+        auto count = [&received](const char *, size_t size)
+        {
+            received += size;
+        };
+        auto start = std::chrono::steady_clock::now();
+        invoke_subprogram({standin},
+                          {"STANDIN_STDOUT=" + std::to_string(stream_size)},
+                          "", count, discard);
+        double s = seconds_since(start);
+        if (received != stream_size) {
+            fprintf(stderr, "received %zu of %zu bytes\n", received,
+                    stream_size);
+            return EXIT_FAILURE;
+        }
+        report("stdout throughput", stream_size / s / 1e6, "MB/s");
+
+        received = 0;
+        start = std::chrono::steady_clock::now();
+        invoke_subprogram({standin},
+                          {"STANDIN_STDERR=" + std::to_string(stream_size)},
+                          "", discard, count);
+        report("stderr throughput",
+               stream_size / seconds_since(start) / 1e6, "MB/s");
+
+        std::string input(stream_size, 'x');
+        start = std::chrono::steady_clock::now();
+        invoke_subprogram({standin}, {"STANDIN_STDIN=1"}, input, discard,
+                          discard);
+        report("stdin throughput", stream_size / seconds_since(start) / 1e6,
+               "MB/s");
+
+        times.clear();
+        for (int i = 0; i < n_runs; i++) {
+            int status;
+            start = std::chrono::steady_clock::now();
+            if (!GruWorker::execute({standin, "lua/patch-rom.lua"}, {},
+                                    discard, discard, &status))
+            {
+                fputs("gru worker failed\n", stderr);
+                return EXIT_FAILURE;
+            }
+            times.push_back(seconds_since(start));
+        }
+        std::sort(times.begin(), times.end());
+        report("worker job latency min", times.front() * 1e6, "us");
+        report("worker job latency median", times[times.size() / 2] * 1e6,
+               "us");
+    }
+    catch (const std::exception &e) {
+        fprintf(stderr, "%s\n", e.what());
+        return EXIT_FAILURE;
+    }
+
+    return 0;
+}
@@ -0,0 +1,25 @@
+QT       += core
+QT       -= gui
+
+CONFIG += console c++11
+CONFIG -= app_bundle
+
+TARGET = bench_subprocess
+
+INCLUDEPATH += ../..
+
+win32: DEFINES += \
+    STANDIN_PATH=\\\"$$OUT_PWD/../standin/release/standin.exe\\\"
+else: DEFINES += STANDIN_PATH=\\\"$$OUT_PWD/../standin/standin\\\"
+
+SOURCES += \
+    main.cpp \
+    ../../gruworker.cpp \
+    ../../subprocess.cpp \
+    ../../trace.cpp
+
+HEADERS += \
+    ../../gruworker.h \
+    ../../subprocess.h \
+    ../../sysutil.h \
+    ../../trace.h
@@ -0,0 +1,136 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <random>
+#include <vector>
+#include "crc32.h"
+#include "ups.h"
+
+static const size_t source_size = 32 * 1024 * 1024;
+static const size_t target_size = 64 * 1024 * 1024;
+static const int n_runs = 16;
+
+static const char *kernel_name(UpsPatch::kernel_t kernel)
+{
+    switch (kernel) {
+        case UpsPatch::kernel_t::SCALAR: return "scalar";
+        case UpsPatch::kernel_t::SSE2: return "sse2";
+        case UpsPatch::kernel_t::AVX2: return "avx2";
+        default: return "auto";
+    }
+}
+
+static void put_varint(std::vector<unsigned char> &out, size_t value)
+{
+    while (true) {
+        unsigned char x = value & 0x7F;
+        value >>= 7;
+        if (value == 0) {
+            out.push_back(0x80 | x);
+            break;
+        }
+        out.push_back(x);
+        value--;
+    }
+}
+
+static void put_le32(std::vector<unsigned char> &out, uint32_t value)
+{
+    for (int i = 0; i < 4; i++)
+        out.push_back(static_cast<unsigned char>(value >> (i * 8)));
+}
+
+static std::vector<unsigned char> make_patch(
+    const std::vector<unsigned char> &source,
+    const std::vector<unsigned char> &target)
+{
+    std::vector<unsigned char> patch = {'U', 'P', 'S', '1'};
+    put_varint(patch, source.size());
+    put_varint(patch, target.size());
+
+    auto at = [&source](size_t i)
+    {
+        return i < source.size() ? source[i] : 0;
+    };
+    size_t last = 0;
+    for (size_t i = 0; i < target.size(); ) {
+        if (at(i) == target[i]) {
+            i++;
+            continue;
+        }
+        put_varint(patch, i - last);
+        for (; i < target.size() && at(i) != target[i]; i++)
+            patch.push_back(at(i) ^ target[i]);
+        patch.push_back(0);
+        last = ++i;
+    }
+
+    put_le32(patch, crc32(0, source.data(), source.size()));
+    put_le32(patch, crc32(0, target.data(), target.size()));
+    put_le32(patch, crc32(0, patch.data(), patch.size()));
+    return patch;
+}
+
+int main()
+{
+    /* a rom extended to twice its size, with the new half and a quarter of
+       the old one rewritten in runs of up to 64 KiB */
+    std::mt19937 rng(0x55505331);
+    std::vector<unsigned char> source(source_size);
+    for (auto &c : source)
+        c = static_cast<unsigned char>(rng());
+    std::vector<unsigned char> target(source);
+    target.resize(target_size);
+    for (size_t pos = 0; pos < target_size; ) {
+        size_t n = std::min<size_t>(rng() % 65536 + 1, target_size - pos);
+        if (pos >= source_size || rng() % 4 == 0) {
+            for (size_t i = 0; i < n; i++)
+                target[pos + i] = static_cast<unsigned char>(rng());
+        }
+        pos += n;
+    }
+    std::vector<unsigned char> patch = make_patch(source, target);
+    printf("patch size %zu\n", patch.size());
+
+    UpsPatch::kernel_t kernels[] =
+    {
+        UpsPatch::kernel_t::SCALAR,
+        UpsPatch::kernel_t::SSE2,
+        UpsPatch::kernel_t::AVX2,
+    };
+
+    try {
+        UpsPatch ups(patch.data(), patch.size());
+        std::vector<unsigned char> data(target_size);
+        for (auto kernel : kernels) {
+            if (!UpsPatch::kernelSupported(kernel))
+                continue;
+
+            double best = 0.;
+            for (int i = 0; i < n_runs; i++) {
+                auto start = std::chrono::steady_clock::now();
+                ups.apply(source.data(), source.size(), data.data(),
+                          data.size(), kernel);
+                auto end = std::chrono::steady_clock::now();
+                double s = std::chrono::duration<double>(end - start)
+                               .count();
+                double gbps = target_size / s / 1e9;
+                if (gbps > best)
+                    best = gbps;
+            }
+            if (data != target) {
+                fprintf(stderr, "%s kernel mismatch\n", kernel_name(kernel));
+                return EXIT_FAILURE;
+            }
+            printf("%-6s %6.2f GB/s\n", kernel_name(kernel), best);
+        }
+    }
+    catch (const std::exception &e) {
+        fprintf(stderr, "%s\n", e.what());
+        return EXIT_FAILURE;
+    }
+
+    return 0;
+}
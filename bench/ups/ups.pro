@@ -0,0 +1,17 @@
+QT       -= core gui
+
+CONFIG += console c++11
+CONFIG -= app_bundle qt
+
+TARGET = bench_ups
+
+INCLUDEPATH += ../..
+
+SOURCES += \
+    main.cpp \
+    ../../crc32.cpp \
+    ../../ups.cpp
+
+HEADERS += \
+    ../../crc32.h \
+    ../../ups.h
@@ -0,0 +1,171 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <random>
+#include <thread>
+#include <vector>
+#include <QDir>
+#include <QTemporaryDir>
+#include "aes.h"
+#include "mappedfile.h"
+#include "wad.h"
+
+static const size_t aes_size = 64 * 1024 * 1024;
+static const int n_runs = 4;
+
+static const unsigned char common_key[16] = {};
+
+static const char *kernel_name(Aes128::kernel_t kernel)
+{
+    switch (kernel) {
+        case Aes128::kernel_t::SCALAR: return "scalar";
+        case Aes128::kernel_t::AESNI: return "aesni";
+        default: return "auto";
+    }
+}
+
+static void write_file(const std::string &path,
+                       const std::vector<unsigned char> &data)
+{
+    mapped_file file = mapped_file::create(path, data.size());
+    if (!data.empty())
+        memcpy(file.data(), data.data(), data.size());
+}
+
+/* an extracted wad with contents of the given sizes. the ticket and tmd
+   only need to be well formed enough for the engine to accept them */
+static void make_wad_dir(const QString &dir,
+                         const std::vector<size_t> &sizes, std::mt19937 &rng)
+{
+    auto random_data = [&rng](size_t size)
+    {
+        std::vector<unsigned char> data(size);
+        for (auto &c : data)
+            c = static_cast<unsigned char>(rng());
+        return data;
+    };
+
+    std::vector<unsigned char> ticket(0x2A4);
+    ticket[0x1F1] = 0;
+    std::vector<unsigned char> tmd(0x1E4 + 0x24 * sizes.size());
+    tmd[0x1DE] = static_cast<unsigned char>(sizes.size() >> 8);
+    tmd[0x1DF] = static_cast<unsigned char>(sizes.size());
+    write_file(dir.toStdString() + "/cert.cert", random_data(0xA00));
+    write_file(dir.toStdString() + "/ticket.tik", ticket);
+    for (size_t i = 0; i < sizes.size(); i++) {
+        tmd[0x1E4 + 0x24 * i + 5] = static_cast<unsigned char>(i);
+        write_file(dir.toStdString() + "/content" + std::to_string(i)
+                   + ".app", random_data(sizes[i]));
+    }
+    write_file(dir.toStdString() + "/metadata.tmd", tmd);
+}
+
+static double best_of(const std::function<void()> &fn)
+{
+    double best = 0.;
+    for (int i = 0; i < n_runs; i++) {
+        auto start = std::chrono::steady_clock::now();
+        fn();
+        auto end = std::chrono::steady_clock::now();
+        double s = std::chrono::duration<double>(end - start).count();
+        if (best == 0. || s < best)
+            best = s;
+    }
+    return best;
+}
+
+static void bench_layout(const char *name, const std::vector<size_t> &sizes,
+                         const QTemporaryDir &tmpdir, std::mt19937 &rng)
+{
+    QString dir = tmpdir.filePath(name);
+    QDir().mkpath(dir);
+    make_wad_dir(dir, sizes, rng);
+    std::string wad_path = tmpdir.filePath(QString(name) + ".wad")
+                               .toStdString();
+    Wad wad = Wad::fromDirectory(dir.toStdString(), common_key);
+
+    size_t total = 0;
+    for (size_t size : sizes)
+        total += size;
+    unsigned max_threads = std::max(std::thread::hardware_concurrency(),
+                                    1u);
+    for (unsigned n = 1; ; n = std::min(n * 2, max_threads)) {
+        double save_s = best_of([&]() { wad.save(wad_path, n); });
+        double load_s = best_of([&]()
+                                {
+                                    Wad(wad_path, common_key, n);
+                                });
+        printf("%-6s %2u threads  save %7.1f MB/s  load %7.1f MB/s\n",
+               name, n, total / save_s / 1e6, total / load_s / 1e6);
+        if (n == max_threads)
+            break;
+    }
+}
+
+int main()
+{
+    std::mt19937 rng(0x57414400);
+
+    std::vector<unsigned char> source(aes_size);
+    for (auto &c : source)
+        c = static_cast<unsigned char>(rng());
+    std::vector<unsigned char> expected;
+    Aes128::kernel_t kernels[] =
+    {
+        Aes128::kernel_t::SCALAR,
+        Aes128::kernel_t::AESNI,
+    };
+    for (auto kernel : kernels) {
+        if (!Aes128::kernelSupported(kernel))
+            continue;
+        Aes128 aes(common_key, kernel);
+        /* the scalar kernel is slow, so it only gets a slice */
+        size_t size = kernel == Aes128::kernel_t::SCALAR ? aes_size / 16
+                                                         : aes_size;
+        std::vector<unsigned char> data(size);
+        std::vector<unsigned char> check(size);
+        unsigned char iv[16] = {};
+        double enc_s = best_of([&]()
+                               {
+                                   memset(iv, 0, sizeof(iv));
+                                   aes.encryptCbc(iv, source.data(),
+                                                  data.data(), size);
+                               });
+        double dec_s = best_of([&]()
+                               {
+                                   memset(iv, 0, sizeof(iv));
+                                   aes.decryptCbc(iv, data.data(),
+                                                  check.data(), size);
+                               });
+        if (expected.empty())
+            expected = data;
+        if (!std::equal(check.begin(), check.end(), source.begin())
+            || !std::equal(expected.begin(), expected.end(), data.begin()))
+        {
+            fprintf(stderr, "%s kernel mismatch\n", kernel_name(kernel));
+            return EXIT_FAILURE;
+        }
+        printf("aes %-6s enc %6.2f GB/s  dec %6.2f GB/s\n",
+               kernel_name(kernel), size / enc_s / 1e9, size / dec_s / 1e9);
+    }
+
+    try {
+        QTemporaryDir tmpdir;
+        /* a virtual console wad is dominated by the archive holding the
+           rom, which no amount of threads can split */
+        bench_layout("vc", {0x10000, 0x200000, 0x40000, 0x40000, 0x40000,
+                            0x3000000, 0x800000},
+                     tmpdir, rng);
+        bench_layout("even", std::vector<size_t>(16, 0x800000), tmpdir, rng);
+    }
+    catch (const std::exception &e) {
+        fprintf(stderr, "%s\n", e.what());
+        return EXIT_FAILURE;
+    }
+
+    return 0;
+}
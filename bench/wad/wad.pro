@@ -0,0 +1,21 @@
+QT       += core
+QT       -= gui
+
+CONFIG += console c++11
+CONFIG -= app_bundle
+
+TARGET = bench_wad
+
+INCLUDEPATH += ../..
+
+SOURCES += \
+    main.cpp \
+    ../../aes.cpp \
+    ../../mappedfile.cpp \
+    ../../wad.cpp
+
+HEADERS += \
+    ../../aes.h \
+    ../../mappedfile.h \
+    ../../sysutil.h \
+    ../../wad.h
@@ -0,0 +1,169 @@
+#include <cstring>
+#include "crc32.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define CRC32_CLMUL
+# include <immintrin.h>
+#endif
+
+namespace {
+
+class crc32_tables
+{
+public:
+    uint32_t table[8][256];
+
+    crc32_tables()
+    {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int j = 0; j < 8; j++)
+                c = (c & 1) ? (c >> 1) ^ 0xEDB88320 : c >> 1;
+            table[0][i] = c;
+        }
+        for (uint32_t i = 0; i < 256; i++) {
+            for (int j = 1; j < 8; j++) {
+                uint32_t c = table[j - 1][i];
+                table[j][i] = (c >> 8) ^ table[0][c & 0xFF];
+            }
+        }
+    }
+};
+
+}
+
+static const crc32_tables &tables()
+{
+    static const crc32_tables t;
+    return t;
+}
+
+static uint32_t crc32_scalar(uint32_t crc, const unsigned char *p, size_t size)
+{
+    const uint32_t (*t)[256] = tables().table;
+
+    while (size >= 8) {
+        uint32_t lo;
+        uint32_t hi;
+        memcpy(&lo, p, 4);
+        memcpy(&hi, p + 4, 4);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        lo = __builtin_bswap32(lo);
+        hi = __builtin_bswap32(hi);
+#endif
+        lo ^= crc;
+        crc = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF]
+              ^ t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24]
+              ^ t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF]
+              ^ t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+        p += 8;
+        size -= 8;
+    }
+    while (size-- != 0)
+        crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xFF];
+
+    return crc;
+}
+
+#ifdef CRC32_CLMUL
+/* fold four 128-bit lanes with carry-less multiplication, then reduce
+   (Gopal et al., "Fast CRC Computation Using PCLMULQDQ Instruction") */
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t crc32_clmul(uint32_t crc, const unsigned char *p, size_t size)
+{
+    alignas(16) static const uint64_t k1k2[] = {0x0154442BD4, 0x01C6E41596};
+    alignas(16) static const uint64_t k3k4[] = {0x01751997D0, 0x00CCAA009E};
+    alignas(16) static const uint64_t k5k0[] = {0x0163CD6124, 0x0000000000};
+    alignas(16) static const uint64_t poly[] = {0x01DB710641, 0x01F7011641};
+
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+
+    x1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 0x00));
+    x2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 0x10));
+    x3 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 0x20));
+    x4 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(static_cast<int>(crc)));
+    x0 = _mm_load_si128(reinterpret_cast<const __m128i *>(k1k2));
+    p += 64;
+    size -= 64;
+
+    while (size >= 64) {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128(
+                 reinterpret_cast<const __m128i *>(p + 0x00)));
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128(
+                 reinterpret_cast<const __m128i *>(p + 0x10)));
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128(
+                 reinterpret_cast<const __m128i *>(p + 0x20)));
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128(
+                 reinterpret_cast<const __m128i *>(p + 0x30)));
+        p += 64;
+        size -= 64;
+    }
+
+    x0 = _mm_load_si128(reinterpret_cast<const __m128i *>(k3k4));
+    __m128i lanes[] = {x2, x3, x4};
+    for (auto &x : lanes) {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x), x5);
+    }
+
+    while (size >= 16) {
+        x2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+        p += 16;
+        size -= 16;
+    }
+
+    x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+    x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+
+    x0 = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(k5k0));
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, x3);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    x0 = _mm_load_si128(reinterpret_cast<const __m128i *>(poly));
+    x2 = _mm_and_si128(x1, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+    x2 = _mm_and_si128(x2, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    crc = static_cast<uint32_t>(_mm_extract_epi32(x1, 1));
+    return crc32_scalar(crc, p, size);
+}
+
+static bool have_clmul()
+{
+    static const bool have = __builtin_cpu_supports("pclmul")
+                             && __builtin_cpu_supports("sse4.1");
+    return have;
+}
+#endif
+
+uint32_t crc32(uint32_t crc, const void *data, size_t size)
+{
+    auto p = static_cast<const unsigned char *>(data);
+
+    crc = ~crc;
+#ifdef CRC32_CLMUL
+    if (size >= 64 && have_clmul())
+        crc = crc32_clmul(crc, p, size);
+    else
+#endif
+        crc = crc32_scalar(crc, p, size);
+    return ~crc;
+}
@@ -0,0 +1,8 @@
+#ifndef CRC32_H
+#define CRC32_H
+#include <cstddef>
+#include <cstdint>
+
+uint32_t crc32(uint32_t crc, const void *data, size_t size);
+
+#endif
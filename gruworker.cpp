@@ -0,0 +1,430 @@
+#include <algorithm>
+#include <cstdio>
+#include <mutex>
+#include <random>
+#include <QFile>
+#include <QTemporaryDir>
+#include "gruworker.h"
+#include "trace.h"
+
+/* every job starts from the state the driver was in before the first one:
+   globals, the standard library tables, package.loaded and the default io
+   streams are put back after each job. what is kept are the compiled
+   chunks of the scripts and of whatever they load, which are compiled
+   again only when the file's contents change. os.exit yields the job's
+   coroutine, which is then dropped, so a pcall in the script can't catch
+   it. where the yield can't get through (a pcall on lua 5.1, or a
+   coroutine of the script's own), the exit is noticed afterwards and the
+   job is aborted instead */
+static const char driver_lua[] = R"(
+local marker = arg[1]
+local exit_tag = {}
+local exit_code = nil
+local stdin, stdout, stderr = io.stdin, io.stdout, io.stderr
+
+os.exit = function(code)
+  if code == nil or code == true then
+    code = 0
+  elseif code == false then
+    code = 1
+  end
+  exit_code = tonumber(code) or 1
+  coroutine.yield(exit_tag)
+  error("os.exit", 0)
+end
+
+local unpack = table.unpack or unpack
+
+local load_source = loadstring or load
+local file_loadfile, file_dofile = loadfile, dofile
+local chunks = {}
+
+local function cached_loadfile(path)
+  local f = io.open(path, "rb")
+  if f == nil then
+    return file_loadfile(path)
+  end
+  local source = f:read("*a")
+  f:close()
+  local entry = chunks[path]
+  if entry == nil or entry.source ~= source then
+    -- like loadfile, skip a #! line but keep the line numbers
+    local chunk, err = load_source(source:gsub("^#[^\n]*", "", 1),
+                                   "@" .. path)
+    if chunk == nil then
+      return nil, err
+    end
+    entry = {source = source, chunk = chunk}
+    chunks[path] = entry
+  end
+  if setfenv then
+    setfenv(entry.chunk, _G)
+  end
+  return entry.chunk
+end
+
+loadfile = function(path, ...)
+  if path == nil or select("#", ...) > 0 then
+    return file_loadfile(path, ...)
+  end
+  return cached_loadfile(path)
+end
+
+dofile = function(path)
+  if path == nil then
+    return file_dofile()
+  end
+  local chunk, err = cached_loadfile(path)
+  if chunk == nil then
+    error(err, 2)
+  end
+  return chunk()
+end
+
+-- in front of the standard lua searcher, which would compile the module
+-- again on every require
+local searchers = package.searchers or package.loaders
+table.insert(searchers, 2, function(name)
+  local file = name:gsub("%.", "/"):gsub("%%", "%%%%")
+  for template in package.path:gmatch("[^;]+") do
+    local path = template:gsub("%?", file)
+    local f = io.open(path, "rb")
+    if f ~= nil then
+      f:close()
+      local chunk, err = cached_loadfile(path)
+      if chunk == nil then
+        error(err, 0)
+      end
+      return chunk, path
+    end
+  end
+  return nil
+end)
+
+local function load_job(path)
+  local chunk, err = cached_loadfile(path)
+  if chunk == nil then
+    error(err, 0)
+  end
+  return chunk
+end
+
+local function snapshot(t)
+  local s = {}
+  for k, v in pairs(t) do
+    s[k] = v
+  end
+  return s
+end
+
+local function restore(t, s)
+  for k in pairs(t) do
+    if s[k] == nil then
+      t[k] = nil
+    end
+  end
+  for k, v in pairs(s) do
+    t[k] = v
+  end
+end
+
+local globals = snapshot(_G)
+local loaded = snapshot(package.loaded)
+local libs = {}
+for _, lib in pairs(globals) do
+  if type(lib) == "table" and lib ~= _G and lib ~= package.loaded then
+    libs[lib] = snapshot(lib)
+  end
+end
+
+local function reset()
+  restore(_G, globals)
+  restore(package.loaded, loaded)
+  for lib, s in pairs(libs) do
+    restore(lib, s)
+  end
+  io.input(stdin)
+  io.output(stdout)
+end
+
+while true do
+  local line = stdin:read("*l")
+  if line == nil then
+    break
+  end
+  local argc = tonumber(line)
+  local job_arg = {}
+  for i = 0, argc - 1 do
+    local len = tonumber(stdin:read("*l"))
+    job_arg[i] = len > 0 and stdin:read(len) or ""
+    stdin:read("*l")
+  end
+
+  arg = job_arg
+  exit_code = nil
+  local job = coroutine.create(function()
+    return load_job(job_arg[0])(unpack(job_arg, 1, argc - 1))
+  end)
+  local ok, err = coroutine.resume(job)
+  local status = 0
+  if ok and err == exit_tag then
+    status = exit_code
+  elseif exit_code ~= nil then
+    stderr:write("os.exit was caught by the script\n")
+    status = "abort"
+  elseif not ok then
+    stderr:write(tostring(err), "\n")
+    status = 1
+  elseif coroutine.status(job) ~= "dead" then
+    stderr:write("the script yielded outside of a coroutine\n")
+    status = 1
+  end
+  job = nil
+  reset()
+  collectgarbage()
+
+  stdout:write(marker, status, "\n")
+  stdout:flush()
+  stderr:write(marker, "\n")
+  stderr:flush()
+  if status == "abort" then
+    break
+  end
+end
+)";
+
+namespace {
+
+class response_stream
+{
+public:
+    response_stream(const std::string &marker,
+                    std::function<void(const char *, size_t)> fn)
+        : m_marker(marker)
+        , m_fn(fn)
+        , m_done(false)
+    {
+    }
+
+    void feed(const char *data, size_t size)
+    {
+        if (m_done)
+            return;
+        m_pending.append(data, size);
+
+        size_t pos = m_pending.find(m_marker);
+        if (pos == std::string::npos) {
+            size_t keep = std::min(m_pending.size(), m_marker.size() - 1);
+            size_t n = m_pending.size() - keep;
+            if (n != 0) {
+                m_fn(m_pending.data(), n);
+                m_pending.erase(0, n);
+            }
+            return;
+        }
+
+        if (pos != 0) {
+            m_fn(m_pending.data(), pos);
+            m_pending.erase(0, pos);
+        }
+        size_t nl = m_pending.find('\n', m_marker.size());
+        if (nl != std::string::npos) {
+            m_trailer = m_pending.substr(m_marker.size(),
+                                         nl - m_marker.size());
+            m_pending.clear();
+            m_done = true;
+        }
+    }
+
+    bool done() const
+    {
+        return m_done;
+    }
+
+    const std::string &trailer() const
+    {
+        return m_trailer;
+    }
+
+private:
+    std::string m_marker;
+    std::function<void(const char *, size_t)> m_fn;
+    std::string m_pending;
+    std::string m_trailer;
+    bool m_done;
+};
+
+class worker_pool
+{
+public:
+    std::mutex mutex;
+    QTemporaryDir dir;
+    std::string driver_path;
+    std::vector<std::unique_ptr<GruWorker>> idle;
+};
+
+}
+
+static worker_pool &pool()
+{
+    static worker_pool p;
+    return p;
+}
+
+static std::string make_marker()
+{
+    std::random_device rd;
+    std::string marker = "\x1egz-gui-worker:";
+    for (int i = 0; i < 4; i++) {
+        char buf[9];
+        snprintf(buf, sizeof(buf), "%08x", static_cast<unsigned>(rd()));
+        marker += buf;
+    }
+    return marker + ":";
+}
+
+GruWorker::GruWorker(const std::string &gru, const std::string &driver_path,
+                     const std::vector<std::string> &env)
+    : gru(gru)
+    , env(env)
+    , marker(make_marker())
+    , alive(true)
+    , n_jobs(0)
+{
+    /* in a group of its own so that a cancelled job takes anything the
+       script started down with it */
+    process.reset(new subprocess({gru, driver_path, marker}, env, true));
+}
+
+GruWorker::~GruWorker()
+{
+    process->close_stdin();
+    if (alive) {
+        try {
+            auto discard = [](const char *, size_t) {};
+            while (process->read(discard, discard))
+                ;
+            process->wait();
+        }
+        catch (...) {
+        }
+    }
+}
+
+bool GruWorker::run(const std::vector<std::string> &args,
+                    std::function<void(const char *, size_t)> stdout_fn,
+                    std::function<void(const char *, size_t)> stderr_fn,
+                    int *status, const subprocess_limits *limits)
+{
+    if (!alive || args.size() < 2)
+        return false;
+    trace_scope trace("gru worker job", "subprocess",
+                      trace_enabled() ? trace_arg("cmd", join_args(args))
+                                      : std::string());
+
+    std::string request = std::to_string(args.size() - 1) + "\n";
+    for (size_t i = 1; i < args.size(); i++)
+        request += std::to_string(args[i].size()) + "\n" + args[i] + "\n";
+    n_jobs++;
+
+    response_stream out(marker, stdout_fn);
+    response_stream err(marker, stderr_fn);
+    try {
+        if (!process->write(request)) {
+            alive = false;
+            return false;
+        }
+        while (!out.done() || !err.done()) {
+            int timeout_ms = limits ? limits->check() : -1;
+            if (!process->read(
+                    [&out](const char *data, size_t size)
+                    {
+                        out.feed(data, size);
+                    },
+                    [&err](const char *data, size_t size)
+                    {
+                        err.feed(data, size);
+                    },
+                    timeout_ms))
+            {
+                alive = false;
+                return false;
+            }
+        }
+    }
+    catch (...) {
+        alive = false;
+        throw;
+    }
+
+    /* the script swallowed its own exit, so the job ran on past it and the
+       worker's state can't be trusted */
+    if (out.trailer() == "abort") {
+        alive = false;
+        return false;
+    }
+    *status = std::stoi(out.trailer());
+    return true;
+}
+
+bool GruWorker::isAlive() const
+{
+    return alive;
+}
+
+int GruWorker::jobCount() const
+{
+    return n_jobs;
+}
+
+bool GruWorker::execute(const std::vector<std::string> &args,
+                        const std::vector<std::string> &env,
+                        std::function<void(const char *, size_t)> stdout_fn,
+                        std::function<void(const char *, size_t)> stderr_fn,
+                        int *status, const subprocess_limits *limits)
+{
+    auto &p = pool();
+    std::unique_ptr<GruWorker> worker;
+
+    try {
+        {
+            std::lock_guard<std::mutex> lock(p.mutex);
+            for (auto it = p.idle.begin(); it != p.idle.end(); ++it) {
+                if ((*it)->gru == args.front() && (*it)->env == env) {
+                    worker = std::move(*it);
+                    p.idle.erase(it);
+                    break;
+                }
+            }
+            if (!worker && p.driver_path.empty()) {
+                if (!p.dir.isValid())
+                    return false;
+                QFile driver(p.dir.filePath("gru-worker.lua"));
+                if (!driver.open(QIODevice::WriteOnly)
+                    || driver.write(driver_lua, sizeof(driver_lua) - 1)
+                       != sizeof(driver_lua) - 1)
+                {
+                    return false;
+                }
+                p.driver_path = driver.fileName().toStdString();
+            }
+        }
+        if (!worker)
+            worker.reset(new GruWorker(args.front(), p.driver_path, env));
+
+        if (!worker->run(args, stdout_fn, stderr_fn, status, limits))
+            return false;
+    }
+    catch (const subprocess_aborted &) {
+        throw;
+    }
+    catch (const std::exception &) {
+        return false;
+    }
+
+    if (worker->jobCount() < maxJobs) {
+        std::lock_guard<std::mutex> lock(p.mutex);
+        p.idle.push_back(std::move(worker));
+    }
+    return true;
+}
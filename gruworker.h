@@ -0,0 +1,42 @@
+#ifndef GRUWORKER_H
+#define GRUWORKER_H
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "subprocess.h"
+
+class GruWorker
+{
+public:
+    GruWorker(const std::string &gru, const std::string &driver_path,
+              const std::vector<std::string> &env);
+    ~GruWorker();
+
+    bool run(const std::vector<std::string> &args,
+             std::function<void(const char *, size_t)> stdout_fn,
+             std::function<void(const char *, size_t)> stderr_fn,
+             int *status, const subprocess_limits *limits = nullptr);
+
+    bool isAlive() const;
+    int jobCount() const;
+
+    static bool execute(const std::vector<std::string> &args,
+                        const std::vector<std::string> &env,
+                        std::function<void(const char *, size_t)> stdout_fn,
+                        std::function<void(const char *, size_t)> stderr_fn,
+                        int *status,
+                        const subprocess_limits *limits = nullptr);
+
+    static const int maxJobs = 64;
+
+private:
+    std::string gru;
+    std::vector<std::string> env;
+    std::string marker;
+    std::unique_ptr<subprocess> process;
+    bool alive;
+    int n_jobs;
+};
+
+#endif
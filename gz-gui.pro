@@ -16,19 +16,76 @@ DEFINES += QT_DEPRECATED_WARNINGS
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
 SOURCES += \
+    aes.cpp \
+    batchdialog.cpp \
+    crc32.cpp \
+    gruworker.cpp \
+    gzi.cpp \
+    gzinjectshim.cpp \
+    headless.cpp \
     main.cpp \
     mainwindow.cpp \
+    manifest.cpp \
+    mappedfile.cpp \
     outputdialog.cpp \
-    patcher.cpp
+    patcher.cpp \
+    patchqueue.cpp \
+    publish.cpp \
+    resultcache.cpp \
+    romformat.cpp \
+    romid.cpp \
+    subprocess.cpp \
+    trace.cpp \
+    ups.cpp \
+    variantsdialog.cpp \
+    wad.cpp \
+    wadcache.cpp
 
 HEADERS += \
+    aes.h \
+    batchdialog.h \
+    crc32.h \
+    gruworker.h \
+    gzi.h \
+    gzinjectshim.h \
+    headless.h \
     mainwindow.h \
+    manifest.h \
+    mappedfile.h \
     outputdialog.h \
-    patcher.h
+    patcher.h \
+    patchqueue.h \
+    publish.h \
+    resultcache.h \
+    romformat.h \
+    romid.h \
+    subprocess.h \
+    sysutil.h \
+    trace.h \
+    ups.h \
+    variantsdialog.h \
+    wad.h \
+    wadcache.h
 
 FORMS += \
+    batchdialog.ui \
     mainwindow.ui \
-    outputdialog.ui
+    outputdialog.ui \
+    variantsdialog.ui
+
+# ROM identification table, generated from the bundled lua/rom_table.lua
+# when it is available at build time.
+isEmpty(GZ_LUA_DIR): GZ_LUA_DIR = $$PWD/lua
+exists($$GZ_LUA_DIR/rom_table.lua) {
+    ROM_TABLE_LUA = $$GZ_LUA_DIR/rom_table.lua
+    rom_table.input = ROM_TABLE_LUA
+    rom_table.output = rom_table.h
+    rom_table.commands = python3 $$PWD/tools/gen_rom_table.py \
+                         ${QMAKE_FILE_IN} ${QMAKE_FILE_OUT}
+    rom_table.CONFIG += no_link target_predeps
+    QMAKE_EXTRA_COMPILERS += rom_table
+    DEFINES += HAVE_ROM_TABLE
+}
 
 # Default rules for deployment.
 qnx: target.path = /tmp/$${TARGET}/bin
@@ -0,0 +1,252 @@
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include "gzi.h"
+#include "mappedfile.h"
+
+static bool parse_hex(const char *&p, const char *end, int digits,
+                      uint32_t *value)
+{
+    while (p < end && (*p == ' ' || *p == '\t'))
+        p++;
+    uint32_t v = 0;
+    int n = 0;
+    for (; p < end && n < digits; p++, n++) {
+        char c = *p;
+        if (c >= '0' && c <= '9')
+            v = (v << 4) | static_cast<uint32_t>(c - '0');
+        else if (c >= 'a' && c <= 'f')
+            v = (v << 4) | static_cast<uint32_t>(c - 'a' + 10);
+        else if (c >= 'A' && c <= 'F')
+            v = (v << 4) | static_cast<uint32_t>(c - 'A' + 10);
+        else
+            break;
+    }
+    *value = v;
+    return n == digits;
+}
+
+GziScript::GziScript(const std::string &text, const std::string &name)
+{
+    const char *p = text.data();
+    const char *text_end = p + text.size();
+    for (int line = 1; p < text_end; line++) {
+        const char *end = std::find(p, text_end, '\n');
+        const char *next = end < text_end ? end + 1 : end;
+        end = std::find(p, end, '#');
+        while (end > p && isspace(static_cast<unsigned char>(end[-1])))
+            end--;
+        while (p < end && isspace(static_cast<unsigned char>(*p)))
+            p++;
+        if (p == end) {
+            p = next;
+            continue;
+        }
+
+        uint32_t command;
+        instruction ins;
+        if (!parse_hex(p, end, 4, &command)
+            || !parse_hex(p, end, 8, &ins.offset)
+            || !parse_hex(p, end, 8, &ins.data)
+            || p != end)
+        {
+            throw std::runtime_error(name + ":" + std::to_string(line)
+                                     + ": syntax error");
+        }
+        switch (command) {
+            case command_t::SELECT:
+            case command_t::LZ77_DECOMPRESS:
+            case command_t::LZ77_COMPRESS:
+            case command_t::WRITE8:
+            case command_t::WRITE16:
+            case command_t::WRITE32:
+                break;
+            default:
+                throw std::runtime_error(name + ":" + std::to_string(line)
+                                         + ": unsupported command");
+        }
+        ins.command = static_cast<uint16_t>(command);
+        instructions.push_back(ins);
+        p = next;
+    }
+}
+
+GziScript GziScript::load(const std::string &path)
+{
+    mapped_file file(path, mapped_file::mode_t::READ);
+    return GziScript(std::string(reinterpret_cast<const char *>(file.data()),
+                                 file.size()),
+                     path);
+}
+
+const std::vector<GziScript::instruction> &GziScript::code() const
+{
+    return instructions;
+}
+
+void GziScript::run(const content_fn &content) const
+{
+    std::vector<unsigned char> *buf = nullptr;
+    for (const instruction &ins : instructions) {
+        if (ins.command == command_t::SELECT) {
+            buf = &content(ins.data);
+            continue;
+        }
+        if (!buf)
+            throw std::runtime_error("gzi: no content selected");
+
+        switch (ins.command) {
+            case command_t::LZ77_DECOMPRESS: {
+                *buf = lz77_decompress(buf->data(), buf->size());
+                break;
+            }
+            case command_t::LZ77_COMPRESS: {
+                *buf = lz77_compress(buf->data(), buf->size());
+                break;
+            }
+            default: {
+                size_t n = ins.command == command_t::WRITE8 ? 1
+                           : ins.command == command_t::WRITE16 ? 2 : 4;
+                if (ins.offset > buf->size() || n > buf->size() - ins.offset)
+                    throw std::runtime_error("gzi: write out of bounds");
+                for (size_t i = 0; i < n; i++) {
+                    (*buf)[ins.offset + i] = static_cast<unsigned char>(
+                        ins.data >> ((n - 1 - i) * 8));
+                }
+                break;
+            }
+        }
+    }
+}
+
+/* nintendo's lz77 variant: a 0x10 byte and the 24-bit little endian output
+   size, then groups of eight tokens led by a flag byte, msb first. a set
+   flag is a 12-bit distance and 4-bit length pair, otherwise a literal */
+static const size_t lz77_window = 0x1000;
+static const size_t lz77_min_match = 3;
+static const size_t lz77_max_match = 0x12;
+
+std::vector<unsigned char> lz77_decompress(const unsigned char *data,
+                                           size_t size)
+{
+    if (size < 4 || data[0] != 0x10)
+        throw std::runtime_error("lz77: unsupported format");
+    size_t out_size = data[1] | (data[2] << 8)
+                      | (static_cast<size_t>(data[3]) << 16);
+
+    std::vector<unsigned char> out(out_size);
+    size_t pos = 4;
+    size_t n = 0;
+    while (n < out_size) {
+        if (pos >= size)
+            throw std::runtime_error("lz77: truncated data");
+        unsigned char flags = data[pos++];
+        for (int bit = 0; bit < 8 && n < out_size; bit++, flags <<= 1) {
+            if (!(flags & 0x80)) {
+                if (pos >= size)
+                    throw std::runtime_error("lz77: truncated data");
+                out[n++] = data[pos++];
+                continue;
+            }
+            if (pos + 2 > size)
+                throw std::runtime_error("lz77: truncated data");
+            size_t len = (data[pos] >> 4) + lz77_min_match;
+            size_t dist = (((data[pos] & 0xF) << 8) | data[pos + 1]) + 1;
+            pos += 2;
+            if (dist > n || len > out_size - n)
+                throw std::runtime_error("lz77: corrupt data");
+            /* the source may overlap the output, so copy bytewise */
+            for (size_t i = 0; i < len; i++, n++)
+                out[n] = out[n - dist];
+        }
+    }
+    return out;
+}
+
+std::vector<unsigned char> lz77_compress(const unsigned char *data,
+                                         size_t size)
+{
+    if (size >= 1 << 24)
+        throw std::runtime_error("lz77: content too large");
+
+    std::vector<unsigned char> out = {
+        0x10,
+        static_cast<unsigned char>(size),
+        static_cast<unsigned char>(size >> 8),
+        static_cast<unsigned char>(size >> 16),
+    };
+    out.reserve(size + size / 8 + 8);
+
+    /* hash chains over three byte prefixes, walked back through the
+       window for the longest match */
+    static const int hash_bits = 15;
+    static const int max_chain = 256;
+    std::vector<int32_t> head(1 << hash_bits, -1);
+    std::vector<int32_t> prev(size);
+    auto hash = [data](size_t i)
+    {
+        uint32_t v = data[i] | (data[i + 1] << 8) | (data[i + 2] << 16);
+        return (v * 2654435761u) >> (32 - hash_bits);
+    };
+    auto insert = [&](size_t i)
+    {
+        if (i + lz77_min_match <= size) {
+            uint32_t h = hash(i);
+            prev[i] = head[h];
+            head[h] = static_cast<int32_t>(i);
+        }
+    };
+
+    size_t pos = 0;
+    size_t flags_pos = 0;
+    int bit = 8;
+    while (pos < size) {
+        if (bit == 8) {
+            flags_pos = out.size();
+            out.push_back(0);
+            bit = 0;
+        }
+
+        size_t best_len = 0;
+        size_t best_dist = 0;
+        if (pos + lz77_min_match <= size) {
+            size_t max_len = std::min(lz77_max_match, size - pos);
+            int chain = max_chain;
+            for (int32_t m = head[hash(pos)];
+                 m >= 0 && pos - m <= lz77_window && chain-- > 0;
+                 m = prev[m])
+            {
+                size_t len = 0;
+                while (len < max_len && data[m + len] == data[pos + len])
+                    len++;
+                if (len > best_len) {
+                    best_len = len;
+                    best_dist = pos - m;
+                    if (len == max_len)
+                        break;
+                }
+            }
+        }
+
+        if (best_len >= lz77_min_match) {
+            out[flags_pos] |= 0x80 >> bit;
+            size_t l = best_len - lz77_min_match;
+            size_t d = best_dist - 1;
+            out.push_back(static_cast<unsigned char>((l << 4) | (d >> 8)));
+            out.push_back(static_cast<unsigned char>(d));
+            for (size_t i = 0; i < best_len; i++)
+                insert(pos + i);
+            pos += best_len;
+        }
+        else {
+            out.push_back(data[pos]);
+            insert(pos);
+            pos++;
+        }
+        bit++;
+    }
+
+    while (out.size() % 4 != 0)
+        out.push_back(0);
+    return out;
+}
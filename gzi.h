@@ -0,0 +1,58 @@
+#ifndef GZI_H
+#define GZI_H
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+/* a gzinject patch script, compiled to an instruction vector. each line
+   holds a command, an offset and a data word in hex:
+
+     0000 00000000 nnnnnnnn  select content n
+     0100 00000000 00000000  lz77 decompress the selected content
+     0101 00000000 00000000  lz77 compress the selected content
+     0300 oooooooo 000000dd  write a byte at offset o
+     0301 oooooooo 0000dddd  write a big endian halfword at offset o
+     0302 oooooooo dddddddd  write a big endian word at offset o
+
+   anything after a # is a comment */
+class GziScript
+{
+public:
+    enum command_t
+    {
+        SELECT = 0x0000,
+        LZ77_DECOMPRESS = 0x0100,
+        LZ77_COMPRESS = 0x0101,
+        WRITE8 = 0x0300,
+        WRITE16 = 0x0301,
+        WRITE32 = 0x0302,
+    };
+
+    struct instruction
+    {
+        uint16_t command;
+        uint32_t offset;
+        uint32_t data;
+    };
+
+    using content_fn = std::function<std::vector<unsigned char> &(uint32_t)>;
+
+    explicit GziScript(const std::string &text,
+                       const std::string &name = "gzi");
+
+    static GziScript load(const std::string &path);
+
+    const std::vector<instruction> &code() const;
+    void run(const content_fn &content) const;
+
+private:
+    std::vector<instruction> instructions;
+};
+
+std::vector<unsigned char> lz77_decompress(const unsigned char *data,
+                                           size_t size);
+std::vector<unsigned char> lz77_compress(const unsigned char *data,
+                                         size_t size);
+
+#endif
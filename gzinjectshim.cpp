@@ -0,0 +1,413 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QList>
+#include <QLockFile>
+#include <QSaveFile>
+#include "gzi.h"
+#include "gzinjectshim.h"
+#include "mappedfile.h"
+#include "subprocess.h"
+#include "wad.h"
+#include "wadcache.h"
+
+bool is_gzinject_shim()
+{
+    return getenv("GZ_GUI_GZINJECT") != nullptr;
+}
+
+static bool get_option(const std::vector<std::string> &args, size_t &i,
+                       const char *short_name, const char *long_name,
+                       std::string *value)
+{
+    const std::string &arg = args[i];
+    std::string long_prefix = std::string(long_name) + "=";
+    if (arg == short_name || arg == long_name) {
+        if (i + 1 >= args.size())
+            return false;
+        *value = args[++i];
+        return true;
+    }
+    if (arg.compare(0, 2, short_name) == 0 && arg.size() > 2) {
+        *value = arg.substr(2);
+        return true;
+    }
+    if (arg.compare(0, long_prefix.size(), long_prefix) == 0) {
+        *value = arg.substr(long_prefix.size());
+        return true;
+    }
+    return false;
+}
+
+static int run_gzinject(const std::vector<std::string> &args)
+{
+    auto write_stdout = [](const char *data, size_t size)
+    {
+        fwrite(data, 1, size, stdout);
+    };
+    auto write_stderr = [](const char *data, size_t size)
+    {
+        fwrite(data, 1, size, stderr);
+    };
+    try {
+        return invoke_subprogram(args, {}, "", write_stdout, write_stderr);
+    }
+    catch (const std::exception &e) {
+        fprintf(stderr, "%s\n", e.what());
+        return EXIT_FAILURE;
+    }
+}
+
+using content_map = std::map<uint32_t, std::vector<unsigned char>>;
+
+/* run the patch scripts on the extracted contents in memory. nothing is
+   written until every script has run, so on failure gzinject can still be
+   given the original arguments */
+static content_map run_gzi(const std::vector<std::string> &patches,
+                           const std::string &dir)
+{
+    std::vector<GziScript> scripts;
+    for (const std::string &path : patches)
+        scripts.push_back(GziScript::load(path));
+
+    content_map contents;
+    auto content = [&contents, &dir](uint32_t index)
+        -> std::vector<unsigned char> &
+    {
+        auto it = contents.find(index);
+        if (it == contents.end()) {
+            std::string path = dir + "/content" + std::to_string(index)
+                               + ".app";
+            mapped_file file(path, mapped_file::mode_t::READ);
+            it = contents.emplace(index, std::vector<unsigned char>(
+                                      file.data(),
+                                      file.data() + file.size())).first;
+        }
+        return it->second;
+    };
+    for (const GziScript &script : scripts)
+        script.run(content);
+
+    return contents;
+}
+
+static bool write_contents(const content_map &contents,
+                           const std::string &dir)
+{
+    for (const auto &entry : contents) {
+        QSaveFile file(QString::fromLocal8Bit(dir.c_str()) + "/content"
+                       + QString::number(entry.first) + ".app");
+        const std::vector<unsigned char> &data = entry.second;
+        if (!file.open(QIODevice::WriteOnly)
+            || file.write(reinterpret_cast<const char *>(data.data()),
+                          static_cast<qint64>(data.size()))
+               != static_cast<qint64>(data.size())
+            || !file.commit())
+        {
+            fprintf(stderr, "could not write %s\n",
+                    file.fileName().toLocal8Bit().constData());
+            return false;
+        }
+    }
+    return true;
+}
+
+static void read_common_key(const std::string &path, unsigned char *key)
+{
+    mapped_file file(path, mapped_file::mode_t::READ);
+    if (file.size() != 16)
+        throw std::runtime_error("bad common key " + path);
+    memcpy(key, file.data(), 16);
+}
+
+static void extract_native(const std::string &wad_path,
+                           const std::string &dir,
+                           const std::string &key_path)
+{
+    unsigned char key[16];
+    read_common_key(key_path, key);
+    Wad(wad_path, key).extract(dir);
+    printf("extracted %s\n", wad_path.c_str());
+}
+
+static Wad patch_native(const std::string &dir, const std::string &key_path,
+                       const std::vector<std::string> &patches,
+                       const std::string &channel_id)
+{
+    unsigned char key[16];
+    read_common_key(key_path, key);
+    std::vector<GziScript> scripts;
+    for (const std::string &path : patches)
+        scripts.push_back(GziScript::load(path));
+
+    Wad wad = Wad::fromDirectory(dir, key);
+    auto content = [&wad](uint32_t index) -> std::vector<unsigned char> &
+    {
+        return wad.content(index);
+    };
+    for (const GziScript &script : scripts)
+        script.run(content);
+    if (!channel_id.empty())
+        wad.setChannelId(channel_id);
+    return wad;
+}
+
+/* build the wad straight from the extracted files, with the patch scripts
+   run on the contents in memory. the directory is left untouched until
+   the wad is written, so gzinject can take over after any failure */
+static void pack_native(const std::string &wad_path, const std::string &dir,
+                        const std::string &key_path,
+                        const std::vector<std::string> &patches,
+                        const std::string &channel_id,
+                        const std::string &region, bool cleanup)
+{
+    Wad wad = patch_native(dir, key_path, patches, channel_id);
+    if (!region.empty())
+        wad.setRegion(std::stoul(region));
+    wad.save(wad_path);
+    printf("packed %s\n", wad_path.c_str());
+
+    if (cleanup)
+        QDir(QString::fromLocal8Bit(dir.c_str())).removeRecursively();
+}
+
+/* the record is a list of nul-terminated names and values, written to the
+   marker once the pack is staged. an empty marker is one still waiting for
+   its pack */
+static const char stage_marker[] = ".gz-gui-stage";
+
+bool staged_pack::mark(const QString &tmpdir)
+{
+    QFile marker(tmpdir + "/" + stage_marker);
+    return marker.open(QIODevice::WriteOnly);
+}
+
+bool staged_pack::load(const QString &tmpdir, staged_pack *pack)
+{
+    QFile marker(tmpdir + "/" + stage_marker);
+    if (!marker.open(QIODevice::ReadOnly))
+        return false;
+    QList<QByteArray> fields = marker.readAll().split('\0');
+    if (fields.size() % 2 != 1)
+        return false;
+
+    *pack = staged_pack();
+    for (int i = 0; i + 1 < fields.size(); i += 2) {
+        const QByteArray &name = fields[i];
+        std::string value = fields[i + 1].toStdString();
+        if (name == "dir")
+            pack->dir = value;
+        else if (name == "key")
+            pack->key_path = value;
+        else if (name == "patch")
+            pack->patches.push_back(value);
+        else if (name == "id")
+            pack->channel_id = value;
+        else if (name == "region")
+            pack->region = value;
+    }
+    return !pack->dir.empty() && !pack->key_path.empty();
+}
+
+Wad staged_pack::patch() const
+{
+    return patch_native(dir, key_path, patches, channel_id);
+}
+
+/* move the extracted directory out of the way of patch-wad.lua, which may
+   remove it, and record the pack for the patcher that marked the temporary
+   directory around it. only the first pack in a marked directory is
+   staged */
+static bool stage_pack(const std::string &dir, const std::string &key_path,
+                       const std::vector<std::string> &patches,
+                       const std::string &channel_id,
+                       const std::string &region, bool cleanup)
+{
+    QFileInfo info(QString::fromLocal8Bit(dir.c_str()));
+    QString tmpdir = QFileInfo(info.absolutePath()).canonicalFilePath();
+    if (tmpdir.isEmpty() || info.fileName() == ".."
+        || info.fileName() == ".")
+    {
+        return false;
+    }
+    QFileInfo marker_info(tmpdir + "/" + stage_marker);
+    if (!marker_info.isFile() || marker_info.size() != 0)
+        return false;
+
+    QString stage_dir = tmpdir + "/wadstage";
+    QByteArray record;
+    auto field = [&record](const char *name, const QString &value)
+    {
+        record.append(name);
+        record.append('\0');
+        record.append(value.toUtf8());
+        record.append('\0');
+    };
+    auto local_path = [](const std::string &path)
+    {
+        return QFileInfo(QString::fromLocal8Bit(path.c_str()))
+               .absoluteFilePath();
+    };
+    field("dir", stage_dir);
+    field("key", local_path(key_path));
+    for (const std::string &patch : patches)
+        field("patch", local_path(patch));
+    field("id", QString::fromLocal8Bit(channel_id.c_str()));
+    field("region", QString::fromLocal8Bit(region.c_str()));
+
+    QSaveFile marker(marker_info.filePath());
+    if (!marker.open(QIODevice::WriteOnly)
+        || marker.write(record) != record.size()
+        || !marker.commit())
+    {
+        return false;
+    }
+    if (!QDir().rename(info.absoluteFilePath(), stage_dir)) {
+        QFile(marker_info.filePath()).open(QIODevice::WriteOnly);
+        return false;
+    }
+    if (!cleanup)
+        QDir().mkpath(info.absoluteFilePath());
+    return true;
+}
+
+int gzinject_shim_main(int argc, char *argv[])
+{
+    std::vector<std::string> args = {getenv("GZ_GUI_GZINJECT")};
+    for (int i = 1; i < argc; i++)
+        args.push_back(argv[i]);
+
+    std::string action;
+    std::string wad_path;
+    std::string dir = "wadextract";
+    std::string key_path = "common-key.bin";
+    std::string channel_id;
+    std::string region;
+    bool cleanup = false;
+    /* whether every option is one that the native code handles */
+    bool native_args = true;
+    std::vector<std::string> patches;
+    std::vector<std::string> unpatched_args = {args.front()};
+    for (size_t i = 1; i < args.size(); i++) {
+        size_t first = i;
+        std::string patch;
+        if (get_option(args, i, "-p", "--patch-file", &patch)) {
+            patches.push_back(patch);
+            continue;
+        }
+        if (!get_option(args, i, "-a", "--action", &action)
+            && !get_option(args, i, "-w", "--wad", &wad_path)
+            && !get_option(args, i, "-d", "--directory", &dir)
+            && !get_option(args, i, "-k", "--key", &key_path)
+            && !get_option(args, i, "-i", "--channelid", &channel_id)
+            && !get_option(args, i, "-r", "--region", &region))
+        {
+            if (args[i] == "--cleanup")
+                cleanup = true;
+            else if (args[i] != "--verbose")
+                native_args = false;
+        }
+        unpatched_args.insert(unpatched_args.end(), args.begin() + first,
+                              args.begin() + i + 1);
+    }
+
+    bool native = getenv("GZ_GUI_NATIVE") != nullptr;
+    if (native && native_args && action == "pack" && !wad_path.empty()) {
+        if (stage_pack(dir, key_path, patches, channel_id, region, cleanup)) {
+            printf("staged the pack of %s\n", wad_path.c_str());
+            return 0;
+        }
+        try {
+            pack_native(wad_path, dir, key_path, patches, channel_id,
+                        region, cleanup);
+            return 0;
+        }
+        catch (const std::exception &e) {
+            printf("native pack failed, using gzinject: %s\n", e.what());
+            return run_gzinject(args);
+        }
+    }
+
+    if (native && action == "pack" && !patches.empty()) {
+        content_map contents;
+        try {
+            contents = run_gzi(patches, dir);
+        }
+        catch (const std::exception &e) {
+            printf("native gzi failed, using gzinject: %s\n", e.what());
+            return run_gzinject(args);
+        }
+        if (!write_contents(contents, dir))
+            return EXIT_FAILURE;
+        for (const std::string &patch : patches)
+            printf("applied %s\n", patch.c_str());
+        return run_gzinject(unpatched_args);
+    }
+
+    if (action != "extract" || wad_path.empty())
+        return run_gzinject(args);
+
+    auto extract = [&]()
+    {
+        if (native && native_args) {
+            try {
+                extract_native(wad_path, dir, key_path);
+                return 0;
+            }
+            catch (const std::exception &e) {
+                printf("native extract failed, using gzinject: %s\n",
+                       e.what());
+            }
+        }
+        return run_gzinject(args);
+    };
+
+    const char *cache_path = getenv("GZ_GUI_WAD_CACHE");
+    if (!cache_path
+        || !WadCache::inTmpdir(QString::fromLocal8Bit(dir.c_str())))
+    {
+        return extract();
+    }
+
+    WadCache cache(QString::fromLocal8Bit(cache_path));
+    QByteArray key;
+    try {
+        key = WadCache::key(QString::fromLocal8Bit(wad_path.c_str()),
+                            QString::fromLocal8Bit(key_path.c_str()));
+    }
+    catch (const std::exception &) {
+        return extract();
+    }
+
+    QString extract_dir = QString::fromLocal8Bit(dir.c_str());
+    if (cache.fetch(key, extract_dir)) {
+        printf("using cached extraction of %s\n", wad_path.c_str());
+        return 0;
+    }
+
+    /* let concurrent jobs on the same base wad wait for one extraction
+       instead of all doing their own */
+    QString lock_dir = QString::fromLocal8Bit(cache_path);
+    QDir().mkpath(lock_dir);
+    QLockFile extract_lock(lock_dir + "/" + QString::fromLatin1(key.toHex())
+                           + ".extracting");
+    extract_lock.setStaleLockTime(0);
+    if (extract_lock.lock() && cache.fetch(key, extract_dir)) {
+        printf("using cached extraction of %s\n", wad_path.c_str());
+        return 0;
+    }
+
+    int status = extract();
+    if (status == 0)
+        cache.insert(key, extract_dir);
+    return status;
+}
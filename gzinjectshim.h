@@ -0,0 +1,32 @@
+#ifndef GZINJECTSHIM_H
+#define GZINJECTSHIM_H
+#include <string>
+#include <vector>
+#include <QString>
+
+class Wad;
+
+bool is_gzinject_shim();
+int gzinject_shim_main(int argc, char *argv[]);
+
+/* a pack that the shim left to the patcher, for wads that share everything
+   but their region with others. the patcher marks its temporary directory,
+   and the shim then moves the extracted directory aside and records the
+   pack there instead of doing it */
+class staged_pack
+{
+public:
+    std::string dir;
+    std::string key_path;
+    std::vector<std::string> patches;
+    std::string channel_id;
+    std::string region;
+
+    static bool mark(const QString &tmpdir);
+    static bool load(const QString &tmpdir, staged_pack *pack);
+
+    /* the wad with the patches applied and the channel id set */
+    Wad patch() const;
+};
+
+#endif
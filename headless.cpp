@@ -0,0 +1,297 @@
+#include <atomic>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <vector>
+#include <QCommandLineParser>
+#include <QDir>
+#include <QTimer>
+#include "headless.h"
+#include "patchqueue.h"
+#include "trace.h"
+
+bool is_headless(int argc, char *argv[])
+{
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--headless") == 0)
+            return true;
+    }
+    return false;
+}
+
+/* the subprograms run in process groups of their own, so a ctrl-c on the
+   terminal doesn't reach them. instead it cancels the patch, which kills
+   the groups. a second one takes the default action */
+static std::atomic<bool> interrupted(false);
+static Patcher *volatile interrupt_patcher = nullptr;
+
+static void on_interrupt(int sig)
+{
+    std::signal(sig, SIG_DFL);
+    interrupted = true;
+    if (interrupt_patcher)
+        interrupt_patcher->cancel();
+}
+
+static void catch_interrupts()
+{
+    std::signal(SIGINT, on_interrupt);
+    std::signal(SIGTERM, on_interrupt);
+}
+
+static bool parse_remap(const QString &str,
+                        PatcherSettings::wad_remap_t &remap)
+{
+    if (str == "default")
+        remap = PatcherSettings::wad_remap_t::DEFAULT;
+    else if (str == "raphnet")
+        remap = PatcherSettings::wad_remap_t::RAPHNET;
+    else if (str == "none")
+        remap = PatcherSettings::wad_remap_t::NONE;
+    else
+        return false;
+    return true;
+}
+
+static bool parse_region(const QString &str,
+                         PatcherSettings::wad_region_t &region)
+{
+    if (str == "jap")
+        region = PatcherSettings::wad_region_t::JAP;
+    else if (str == "usa")
+        region = PatcherSettings::wad_region_t::USA;
+    else if (str == "eur")
+        region = PatcherSettings::wad_region_t::EUR;
+    else if (str == "free")
+        region = PatcherSettings::wad_region_t::FREE;
+    else
+        return false;
+    return true;
+}
+
+template <typename T>
+static bool parse_list(const QString &str,
+                       bool (*parse)(const QString &, T &),
+                       std::vector<T> &list)
+{
+    for (auto &item : str.split(',', Qt::SkipEmptyParts)) {
+        T value;
+        if (!parse(item.trimmed(), value))
+            return false;
+        list.push_back(value);
+    }
+    return !list.empty();
+}
+
+static int run_variants(QCoreApplication &a, const PatcherSettings &settings,
+                        const QCommandLineParser &parser,
+                        const QCommandLineOption &opt_region,
+                        const QCommandLineOption &opt_remap, bool quiet)
+{
+    using region_t = PatcherSettings::wad_region_t;
+    using remap_t = PatcherSettings::wad_remap_t;
+    std::vector<region_t> regions;
+    std::vector<remap_t> remaps;
+
+    if (!parser.isSet(opt_region))
+        regions = {region_t::JAP, region_t::USA, region_t::EUR, region_t::FREE};
+    else if (!parse_list(parser.value(opt_region), parse_region, regions)) {
+        fputs("invalid --region\n", stderr);
+        return EXIT_FAILURE;
+    }
+    if (!parser.isSet(opt_remap))
+        remaps = {remap_t::DEFAULT, remap_t::RAPHNET, remap_t::NONE};
+    else if (!parse_list(parser.value(opt_remap), parse_remap, remaps)) {
+        fputs("invalid --remap\n", stderr);
+        return EXIT_FAILURE;
+    }
+
+    QString dir = QString::fromStdString(settings.output_path);
+    if (!QDir().mkpath(dir)) {
+        fprintf(stderr, "could not create %s\n", settings.output_path.c_str());
+        return EXIT_FAILURE;
+    }
+
+    PatchQueue queue;
+    for (auto &variant : PatchQueue::wadVariants(settings, dir, regions,
+                                                 remaps))
+    {
+        queue.addJob(variant);
+    }
+    if (!quiet) {
+        QObject::connect(&queue, &PatchQueue::jobOutput,
+            [](int, const QString &output)
+            {
+                fputs(output.toLocal8Bit().constData(), stderr);
+            });
+    }
+    QObject::connect(&queue, &PatchQueue::jobFinished,
+        [&queue](int index)
+        {
+            const PatchJob &job = queue.job(index);
+            fprintf(stderr, "%s: %s\n", job.settings.output_path.c_str(),
+                    job.status == PatchJob::status_t::DONE ? "done"
+                                                           : "failed");
+            if (!job.error.empty())
+                fprintf(stderr, "%s\n", job.error.c_str());
+        });
+    QObject::connect(&queue, &PatchQueue::finished, &a,
+                     &QCoreApplication::quit, Qt::QueuedConnection);
+    QTimer interrupt_timer;
+    QObject::connect(&interrupt_timer, &QTimer::timeout,
+        [&queue, &interrupt_timer]()
+        {
+            if (interrupted) {
+                interrupt_timer.stop();
+                queue.cancel();
+            }
+        });
+    interrupt_timer.start(100);
+    catch_interrupts();
+
+    QMetaObject::invokeMethod(&queue, "start", Qt::QueuedConnection);
+    a.exec();
+
+    for (int i = 0; i < queue.jobCount(); i++) {
+        if (queue.job(i).status != PatchJob::status_t::DONE)
+            return EXIT_FAILURE;
+    }
+    return 0;
+}
+
+int headless_main(QCoreApplication &a)
+{
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Patch a ROM or WAD without the user"
+                                     " interface.");
+    parser.addHelpOption();
+
+    QCommandLineOption opt_headless("headless", "Run without the user"
+                                    " interface.");
+    QCommandLineOption opt_rom("rom", "ROM to patch.", "path");
+    QCommandLineOption opt_ucode("ucode", "Inject line microcode from this"
+                                 " ROM.", "path");
+    QCommandLineOption opt_wad("wad", "WAD to patch.", "path");
+    QCommandLineOption opt_extrom("extrom", "Use this ROM in the WAD.",
+                                  "path");
+    QCommandLineOption opt_remap("remap", "Controller remapping (default,"
+                                 " raphnet, none).", "remap", "default");
+    QCommandLineOption opt_region("region", "WAD region (jap, usa, eur,"
+                                  " free).", "region", "free");
+    QCommandLineOption opt_channel_id("channel-id", "WAD channel ID.", "id");
+    QCommandLineOption opt_channel_title("channel-title", "WAD channel"
+                                         " title.", "title");
+    QCommandLineOption opt_output({"o", "output"}, "Output file.", "path");
+    QCommandLineOption opt_no_cache("no-cache", "Don't use or update the"
+                                    " result cache.");
+    QCommandLineOption opt_variants("variants", "Build every combination of"
+                                    " the comma-separated --region and"
+                                    " --remap lists (all by default) into"
+                                    " the --output directory.");
+    QCommandLineOption opt_trace("trace", "Write a Chrome trace of the run"
+                                 " to this file.", "path");
+    QCommandLineOption opt_no_worker("no-worker", "Start a new gru process"
+                                     " for every script.");
+    QCommandLineOption opt_no_native("no-native", "Always patch with gru"
+                                     " and gzinject, even where the"
+                                     " built-in patcher applies.");
+    QCommandLineOption opt_timeout("timeout", "Abort any gru or gzinject run"
+                                   " that takes longer than this.",
+                                   "seconds");
+    QCommandLineOption opt_quiet({"q", "quiet"}, "Don't print the output"
+                                 " log.");
+    parser.addOptions({opt_headless, opt_rom, opt_ucode, opt_wad, opt_extrom,
+                       opt_remap, opt_region, opt_channel_id,
+                       opt_channel_title, opt_output, opt_variants,
+                       opt_no_cache, opt_no_worker, opt_no_native,
+                       opt_trace, opt_timeout, opt_quiet});
+    parser.process(a);
+
+    if (parser.isSet(opt_trace))
+        trace_start(parser.value(opt_trace).toStdString());
+
+    PatcherSettings settings;
+    if (parser.isSet(opt_rom) == parser.isSet(opt_wad)) {
+        fputs("exactly one of --rom and --wad is required\n", stderr);
+        return EXIT_FAILURE;
+    }
+    if (!parser.isSet(opt_output)) {
+        fputs("--output is required\n", stderr);
+        return EXIT_FAILURE;
+    }
+    settings.output_path = parser.value(opt_output).toStdString();
+    settings.use_cache = !parser.isSet(opt_no_cache);
+    settings.use_worker = !parser.isSet(opt_no_worker);
+    settings.use_native = !parser.isSet(opt_no_native);
+    if (parser.isSet(opt_timeout)) {
+        bool ok;
+        settings.stage_timeout = parser.value(opt_timeout).toInt(&ok);
+        if (!ok || settings.stage_timeout <= 0) {
+            fputs("invalid --timeout\n", stderr);
+            return EXIT_FAILURE;
+        }
+    }
+    if (parser.isSet(opt_variants) && !parser.isSet(opt_wad)) {
+        fputs("--variants requires --wad\n", stderr);
+        return EXIT_FAILURE;
+    }
+
+    if (parser.isSet(opt_rom)) {
+        settings.patch_mode = PatcherSettings::patch_mode_t::ROM;
+        settings.rom_path = parser.value(opt_rom).toStdString();
+        if (parser.isSet(opt_ucode)) {
+            settings.opt_ucode = true;
+            settings.ucode_path = parser.value(opt_ucode).toStdString();
+        }
+    }
+    else {
+        settings.patch_mode = PatcherSettings::patch_mode_t::WAD;
+        settings.wad_path = parser.value(opt_wad).toStdString();
+        if (parser.isSet(opt_extrom)) {
+            settings.opt_extrom = true;
+            settings.extrom_path = parser.value(opt_extrom).toStdString();
+        }
+        settings.channel_id = parser.value(opt_channel_id).toStdString();
+        settings.channel_title = parser.value(opt_channel_title)
+                                 .toStdString();
+        if (parser.isSet(opt_variants)) {
+            return run_variants(a, settings, parser, opt_region, opt_remap,
+                                parser.isSet(opt_quiet));
+        }
+        if (!parse_remap(parser.value(opt_remap), settings.wad_remap)) {
+            fputs("invalid --remap\n", stderr);
+            return EXIT_FAILURE;
+        }
+        if (!parse_region(parser.value(opt_region), settings.wad_region)) {
+            fputs("invalid --region\n", stderr);
+            return EXIT_FAILURE;
+        }
+    }
+
+    Patcher patcher(settings);
+    if (!parser.isSet(opt_quiet)) {
+        QObject::connect(&patcher, &Patcher::output,
+            [](const QString &output)
+            {
+                fputs(output.toLocal8Bit().constData(), stderr);
+            });
+    }
+
+    /* run the patch on this thread, no event loop needed */
+    interrupt_patcher = &patcher;
+    catch_interrupts();
+    patcher.run();
+    interrupt_patcher = nullptr;
+    try {
+        int result = patcher.getResult();
+        if (result == 2)
+            fputs("Your ROM wasn't recognized.\n", stderr);
+        return result;
+    }
+    catch (const std::exception &e) {
+        fprintf(stderr, "%s\n", e.what());
+        return EXIT_FAILURE;
+    }
+}
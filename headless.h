@@ -0,0 +1,8 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+#include <QCoreApplication>
+
+bool is_headless(int argc, char *argv[]);
+int headless_main(QCoreApplication &a);
+
+#endif
@@ -1,9 +1,15 @@
 #include <sys/stat.h>
+#include <cstdio>
+#include <cstdlib>
 #include <QApplication>
 #include <QDir>
 #include <QMessageBox>
 #include <QtGlobal>
+#include "gzinjectshim.h"
+#include "headless.h"
 #include "mainwindow.h"
+#include "manifest.h"
+#include "trace.h"
 
 bool check_files()
 {
@@ -39,8 +45,49 @@ bool check_files()
     return true;
 }
 
+static QStringList manifest_problems(const ManifestResult &result)
+{
+    QStringList problems;
+    for (auto &path : result.missing)
+        problems.append(path + " is missing");
+    for (auto &path : result.corrupt)
+        problems.append(path + " is corrupted");
+    return problems;
+}
+
 int main(int argc, char *argv[])
 {
+    if (is_gzinject_shim())
+        return gzinject_shim_main(argc, argv);
+
+    if (const char *trace_path = getenv("GZ_GUI_TRACE"))
+        trace_start(trace_path);
+
+    if (is_headless(argc, argv)) {
+        QCoreApplication a(argc, argv);
+
+#ifdef Q_OS_DARWIN
+        QDir::setCurrent(a.applicationDirPath() + "/../Resources");
+#endif
+
+        if (!check_files()) {
+            fputs("Files are missing!\n", stderr);
+            return EXIT_FAILURE;
+        }
+
+        /* nobody is waiting on a window here, so rather check up front
+           than produce a bad ROM. once the assets have matched, this only
+           looks at their sizes and times, see asset_stamp() */
+        QStringList problems = manifest_problems(ManifestCheck::result());
+        if (!problems.isEmpty()) {
+            for (auto &problem : problems)
+                fprintf(stderr, "%s\n", problem.toLocal8Bit().constData());
+            return EXIT_FAILURE;
+        }
+
+        return headless_main(a);
+    }
+
     QApplication a(argc, argv);
 
 #ifdef Q_OS_DARWIN
@@ -56,5 +103,26 @@ int main(int argc, char *argv[])
 
     MainWindow w;
     w.show();
+
+    /* hash the bundled files in the background once the window is up */
+    ManifestCheck manifest_check;
+    QObject::connect(&manifest_check, &ManifestCheck::finished, &w,
+        [&w]()
+        {
+            QStringList problems = manifest_problems(ManifestCheck::result());
+            if (problems.isEmpty())
+                return;
+            if (problems.size() > 10) {
+                int n_more = problems.size() - 10;
+                problems.erase(problems.begin() + 10, problems.end());
+                problems.append("and " + QString::number(n_more) + " more");
+            }
+            QMessageBox::warning(&w, "",
+                                 "Some files are damaged, patching may"
+                                 " produce a broken ROM. Try extracting the"
+                                 " package again.\n\n" + problems.join("\n"));
+        });
+    manifest_check.start(QThread::LowPriority);
+
     return a.exec();
 }
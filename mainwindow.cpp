@@ -1,20 +1,153 @@
+#include <cstdlib>
+#include <exception>
+#include <string>
+#include <vector>
+#include <QDateTime>
 #include <QFileDialog>
+#include <QFileInfo>
 #include <QInputDialog>
 #include <QMessageBox>
+#include <QTemporaryDir>
+#include <QTimer>
+#include <QtGlobal>
+#include "batchdialog.h"
 #include "mainwindow.h"
+#include "mappedfile.h"
 #include "outputdialog.h"
 #include "patcher.h"
+#include "publish.h"
+#include "romid.h"
 #include "ui_mainwindow.h"
+#include "variantsdialog.h"
 
 static PatcherSettings settings;
+static RomInfo rom_info;
+static RomInfo ucode_info;
+
+static QString rom_label(const QString &name, const RomInfo &info)
+{
+    switch (info.status) {
+        case RomInfo::status_t::SUPPORTED:
+            return name + " (" + QString::fromStdString(info.name) + ")";
+        case RomInfo::status_t::UNSUPPORTED:
+            return name + " (not recognized)";
+        default:
+            return name;
+    }
+}
+
+/* a patch started in the background as soon as the inputs are valid, so
+   that its result is ready to be saved by the time go is clicked */
+class speculation
+{
+public:
+    PatcherSettings settings;
+    QString inputs;
+    QTemporaryDir dir;
+    Patcher *patcher = nullptr;
+    QString log;
+};
+
+/* the output log keeps the defaults of OutputDialog unless overridden, and
+   can spill what it trims to a file for long verbose runs */
+static void setup_output(OutputDialog &pd)
+{
+    bool ok;
+    int max_lines = qEnvironmentVariableIntValue("GZ_GUI_LOG_LINES", &ok);
+    if (ok)
+        pd.setMaxLines(max_lines);
+    int max_chars = qEnvironmentVariableIntValue("GZ_GUI_LOG_CHARS", &ok);
+    if (ok)
+        pd.setMaxChars(max_chars);
+    if (const char *spill_path = getenv("GZ_GUI_LOG_SPILL")) {
+        if (!pd.setSpillFile(QString::fromLocal8Bit(spill_path)))
+            pd.write(QString("could not open %1\n").arg(spill_path));
+    }
+}
+
+static QString output_filter(PatcherSettings::patch_mode_t patch_mode)
+{
+    if (patch_mode == PatcherSettings::patch_mode_t::ROM)
+        return "Nintendo 64 ROM (Big Endian) (*.z64)";
+    else
+        return "Nintendo Wii WAD (*.wad)";
+}
+
+static std::vector<std::string> input_paths(const PatcherSettings &settings)
+{
+    std::vector<std::string> paths;
+    switch (settings.patch_mode) {
+        case PatcherSettings::patch_mode_t::ROM: {
+            paths.push_back(settings.rom_path);
+            if (settings.opt_ucode)
+                paths.push_back(settings.ucode_path);
+            break;
+        }
+        case PatcherSettings::patch_mode_t::WAD: {
+            paths.push_back(settings.wad_path);
+            if (settings.opt_extrom)
+                paths.push_back(settings.extrom_path);
+            break;
+        }
+    }
+    return paths;
+}
+
+/* identifies the input files as they are on disk, so that a speculative
+   result isn't used if one of them has changed since */
+static QString input_stamp(const PatcherSettings &settings)
+{
+    QString stamp;
+    for (auto &path : input_paths(settings)) {
+        QFileInfo info(QString::fromStdString(path));
+        stamp += info.filePath() + ":" + QString::number(info.size()) + ":"
+                 + QString::number(info.lastModified().toMSecsSinceEpoch())
+                 + "\n";
+    }
+    return stamp;
+}
+
+static bool same_job(const PatcherSettings &a, const PatcherSettings &b)
+{
+    if (a.patch_mode != b.patch_mode)
+        return false;
+    switch (a.patch_mode) {
+        case PatcherSettings::patch_mode_t::ROM: {
+            return a.rom_path == b.rom_path
+                   && a.opt_ucode == b.opt_ucode
+                   && (!a.opt_ucode || a.ucode_path == b.ucode_path);
+        }
+        case PatcherSettings::patch_mode_t::WAD: {
+            return a.wad_path == b.wad_path
+                   && a.opt_extrom == b.opt_extrom
+                   && (!a.opt_extrom || a.extrom_path == b.extrom_path)
+                   && a.wad_remap == b.wad_remap
+                   && a.channel_id == b.channel_id
+                   && a.channel_title == b.channel_title
+                   && a.wad_region == b.wad_region;
+        }
+    }
+    return false;
+}
 
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent)
     , ui(new Ui::MainWindow)
+    , batch(new BatchDialog(this))
+    , speculation_timer(new QTimer(this))
 {
     ui->setupUi(this);
     resize(minimumWidth(), minimumHeight());
 
+    /* wait for the inputs to settle before starting on them */
+    speculation_timer->setSingleShot(true);
+    speculation_timer->setInterval(250);
+    connect(speculation_timer, &QTimer::timeout, this,
+        [this]()
+        {
+            start_speculation();
+        });
+
     connect(ui->tabwidget, &QTabWidget::currentChanged,
         [this](int index)
         {
@@ -30,9 +163,10 @@ MainWindow::MainWindow(QWidget *parent)
                                 "Nintendo 64 ROM (*.z64 *.v64 *.n64)");
             if (!path.isEmpty()) {
                 settings.rom_path = path.toStdString();
+                rom_info = identify_rom(settings.rom_path);
                 path.remove(0, path.lastIndexOf('\\') + 1);
                 path.remove(0, path.lastIndexOf('/') + 1);
-                ui->label_rom->setText(path);
+                ui->label_rom->setText(rom_label(path, rom_info));
             }
             update_go_state();
         });
@@ -50,9 +184,10 @@ MainWindow::MainWindow(QWidget *parent)
                                 "Nintendo 64 ROM (*.z64 *.v64 *.n64)");
             if (!path.isEmpty()) {
                 settings.ucode_path = path.toStdString();
+                ucode_info = identify_rom(settings.ucode_path);
                 path.remove(0, path.lastIndexOf('\\') + 1);
                 path.remove(0, path.lastIndexOf('/') + 1);
-                ui->label_ucode->setText(path);
+                ui->label_ucode->setText(rom_label(path, ucode_info));
                 settings.opt_ucode = true;
                 ui->checkbox_ucode->setCheckState(Qt::Checked);
             }
@@ -95,10 +230,11 @@ MainWindow::MainWindow(QWidget *parent)
             update_go_state();
         });
     connect(ui->combobox_remap, QOverload<int>::of(&QComboBox::activated), this,
-        [](int index)
+        [this](int index)
         {
             settings.wad_remap = static_cast<PatcherSettings::
                                              wad_remap_t>(index);
+            update_go_state();
         });
     connect(ui->combobox_id, QOverload<int>::of(&QComboBox::activated), this,
         [this](int index)
@@ -125,6 +261,7 @@ MainWindow::MainWindow(QWidget *parent)
                     break;
                 }
             }
+            update_go_state();
         });
     connect(ui->combobox_title, QOverload<int>::of(&QComboBox::activated), this,
         [this](int index)
@@ -151,22 +288,68 @@ MainWindow::MainWindow(QWidget *parent)
                     break;
                 }
             }
+            update_go_state();
         });
     connect(ui->combobox_region, QOverload<int>::of(&QComboBox::activated),
             this,
-        [](int index)
+        [this](int index)
         {
             settings.wad_region = static_cast<PatcherSettings::
                                               wad_region_t>(index);
+            update_go_state();
+        });
+    connect(ui->button_batch, &QPushButton::clicked,
+        [this]()
+        {
+            QString path = QFileDialog::
+                getSaveFileName(this, "Save as...", "",
+                                output_filter(settings.patch_mode));
+            if (path.isEmpty())
+                return;
+
+            PatcherSettings job_settings = settings;
+            job_settings.output_path = path.toStdString();
+            batch->addJob(job_settings);
+            batch->show();
+            batch->raise();
+        });
+    connect(ui->button_variants, &QPushButton::clicked,
+        [this]()
+        {
+            VariantsDialog vd(this);
+            if (vd.exec() != QDialog::Accepted)
+                return;
+            QString dir = QFileDialog::
+                getExistingDirectory(this, "Save variants to...");
+            if (dir.isEmpty())
+                return;
+
+            auto variants = PatchQueue::wadVariants(settings, dir,
+                                                    vd.regions(),
+                                                    vd.remaps());
+            for (auto &variant : variants)
+                batch->addJob(variant);
+            batch->show();
+            batch->raise();
         });
     connect(ui->button_go, &QPushButton::clicked,
         [this]()
         {
+            if (take_speculation())
+                return;
+            discard_speculation();
+
             OutputDialog pd(this);
+            setup_output(pd);
             Patcher patcher(settings, this);
 
             connect(&patcher, &Patcher::output,
                     &pd, &OutputDialog::write);
+            connect(&pd, &OutputDialog::cancelled,
+                [&patcher]()
+                {
+                    patcher.cancel();
+                });
             connect(&patcher, &Patcher::needSaveFileName, this,
                 [&pd](QString *result, const QString &caption,
                     const QString &dir, const QString &filter,
@@ -201,6 +384,8 @@ MainWindow::MainWindow(QWidget *parent)
                     }
                     catch (const std::exception &e) {
                         pd.write(e.what());
+                        if (patcher.isCancelled())
+                            return;
                         QMessageBox::
                             warning(&pd, "Error",
                                     "Something went wrong! Refer to the"
@@ -215,6 +400,11 @@ MainWindow::MainWindow(QWidget *parent)
 
 MainWindow::~MainWindow()
 {
+    discard_speculation();
+    for (auto patcher : findChildren<Patcher *>()) {
+        patcher->cancel();
+        patcher->wait();
+    }
     delete ui;
 }
 
@@ -223,9 +413,16 @@ void MainWindow::update_go_state()
     bool enable_go = false;
     switch (settings.patch_mode) {
         case PatcherSettings::patch_mode_t::ROM: {
+            /* the generated table is authoritative for the roms it was
+               built from. without a table (or for an unreadable file) the
+               rom is UNKNOWN, which doesn't block, and the patch scripts
+               have the final say */
             enable_go = !settings.rom_path.empty()
+                        && rom_info.status != RomInfo::status_t::UNSUPPORTED
                         && (!settings.opt_ucode
-                            || !settings.ucode_path.empty());
+                            || (!settings.ucode_path.empty()
+                                && ucode_info.status
+                                   != RomInfo::status_t::UNSUPPORTED));
             break;
         }
         case PatcherSettings::patch_mode_t::WAD: {
@@ -236,4 +433,129 @@ void MainWindow::update_go_state()
         }
     }
     ui->button_go->setEnabled(enable_go);
+    ui->button_batch->setEnabled(enable_go);
+    ui->button_variants->setEnabled(enable_go
+                                    && settings.patch_mode
+                                       == PatcherSettings::patch_mode_t::WAD);
+    speculate(enable_go);
+}
+
+void MainWindow::speculate(bool enable)
+{
+    if (current_speculation
+        && same_job(current_speculation->settings, settings))
+    {
+        return;
+    }
+    discard_speculation();
+    if (!enable) {
+        speculation_timer->stop();
+        return;
+    }
+    for (auto &path : input_paths(settings))
+        mapped_file::prefetch(path);
+    speculation_timer->start();
+}
+
+void MainWindow::start_speculation()
+{
+    auto s = std::make_shared<speculation>();
+    if (!s->dir.isValid())
+        return;
+    s->settings = settings;
+    s->settings.output_path = s->dir.filePath("staged").toStdString();
+    s->inputs = input_stamp(settings);
+    s->patcher = new Patcher(s->settings, this);
+
+    connect(s->patcher, &Patcher::output, this,
+        [s](const QString &output)
+        {
+            s->log.append(output);
+        });
+    connect(s->patcher, &Patcher::finished, this,
+        [this, s]()
+        {
+            if (current_speculation != s)
+                s->patcher->deleteLater();
+        });
+
+    current_speculation = s;
+    s->patcher->start(QThread::LowPriority);
+}
+
+void MainWindow::discard_speculation()
+{
+    if (!current_speculation)
+        return;
+    /* if it's still running, the finished handler deletes it */
+    Patcher *patcher = current_speculation->patcher;
+    patcher->cancel();
+    if (patcher->isFinished())
+        patcher->deleteLater();
+    current_speculation.reset();
+}
+
+bool MainWindow::take_speculation()
+{
+    auto s = current_speculation;
+    if (!s || !same_job(s->settings, settings)
+        || s->inputs != input_stamp(settings))
+    {
+        return false;
+    }
+
+    if (!s->patcher->isFinished()) {
+        /* not done yet, show it in the foreground until it is */
+        OutputDialog pd(this);
+        setup_output(pd);
+        pd.write(s->log);
+        connect(s->patcher, &Patcher::output,
+                &pd, &OutputDialog::write);
+        connect(&pd, &OutputDialog::cancelled,
+            [s]()
+            {
+                s->patcher->cancel();
+            });
+        connect(s->patcher, &Patcher::finished, &pd,
+            [&pd]()
+            {
+                pd.setClosable(true);
+                pd.close();
+            });
+        s->patcher->setPriority(QThread::NormalPriority);
+        if (!s->patcher->isFinished())
+            pd.exec();
+    }
+
+    int result = -1;
+    try {
+        result = s->patcher->getResult();
+    }
+    catch (const std::exception &) {
+    }
+    if (s->patcher->isCancelled()) {
+        discard_speculation();
+        return true;
+    }
+    if (result != 0) {
+        /* let a regular run report the problem */
+        discard_speculation();
+        return false;
+    }
+
+    QString path = QFileDialog::
+        getSaveFileName(this, "Save as...",
+                        QString::fromStdString(s->patcher->outputName()),
+                        output_filter(s->settings.patch_mode));
+    if (path.isEmpty())
+        return true;
+    try {
+        publish_file(s->settings.output_path, path.toStdString());
+    }
+    catch (const std::exception &e) {
+        QMessageBox::warning(this, "Error", e.what());
+        return true;
+    }
+    discard_speculation();
+    return true;
 }
@@ -1,11 +1,16 @@
 #ifndef MAINWINDOW_H
 #define MAINWINDOW_H
+#include <memory>
 #include <QMainWindow>
 
 QT_BEGIN_NAMESPACE
 namespace Ui { class MainWindow; }
 QT_END_NAMESPACE
 
+class BatchDialog;
+class QTimer;
+class speculation;
+
 class MainWindow : public QMainWindow
 {
     Q_OBJECT
@@ -16,8 +21,15 @@ public:
 
 private:
     Ui::MainWindow *ui;
+    BatchDialog *batch;
+    QTimer *speculation_timer;
+    std::shared_ptr<speculation> current_speculation;
 
     void update_go_state();
+    void speculate(bool enable);
+    void start_speculation();
+    void discard_speculation();
+    bool take_speculation();
 };
 
 #endif
@@ -0,0 +1,232 @@
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <vector>
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include "manifest.h"
+#include "trace.h"
+
+namespace {
+
+class asset
+{
+public:
+    enum status_t
+    {
+        OK,
+        MISSING,
+        CORRUPT,
+    };
+
+    QString path;
+    QByteArray sha1;
+    status_t status;
+};
+
+class shared_check
+{
+public:
+    std::mutex mutex;
+    std::condition_variable cond;
+    bool started = false;
+    bool done = false;
+    ManifestResult result;
+};
+
+}
+
+static shared_check &shared()
+{
+    static shared_check s;
+    return s;
+}
+
+static bool parse_manifest(const QByteArray &data, std::vector<asset> *assets)
+{
+    for (QByteArray line : data.split('\n')) {
+        if (line.endsWith('\r'))
+            line.chop(1);
+        if (line.isEmpty())
+            continue;
+        /* "<sha1>  <path>", or "<sha1> *<path>" in sha1sum's binary mode */
+        if (line.size() < 43 || line[40] != ' '
+            || (line[41] != ' ' && line[41] != '*'))
+        {
+            return false;
+        }
+        QByteArray sha1 = QByteArray::fromHex(line.left(40));
+        if (sha1.size() != 20)
+            return false;
+        assets->push_back({QString::fromUtf8(line.mid(42)), sha1,
+                           asset::status_t::OK});
+    }
+    return !assets->empty();
+}
+
+static void hash_assets(std::vector<asset> &assets)
+{
+    std::atomic<size_t> next(0);
+    auto worker = [&assets, &next]()
+    {
+        size_t i;
+        while ((i = next++) < assets.size()) {
+            asset &a = assets[i];
+            QFile file(a.path);
+            if (!file.open(QIODevice::ReadOnly)) {
+                a.status = asset::status_t::MISSING;
+                continue;
+            }
+            QCryptographicHash hash(QCryptographicHash::Sha1);
+            if (!hash.addData(&file) || hash.result() != a.sha1)
+                a.status = asset::status_t::CORRUPT;
+        }
+    };
+
+    size_t n_threads = std::max(std::thread::hardware_concurrency(), 1u);
+    n_threads = std::min(n_threads, assets.size());
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < n_threads; i++) {
+        try {
+            threads.emplace_back(worker);
+        }
+        catch (const std::system_error &) {
+            break;
+        }
+    }
+    worker();
+    for (auto &thread : threads)
+        thread.join();
+}
+
+/* hashing reads every asset, which is too slow to do on every headless
+   run. once all of them have matched, the check is skipped for as long as
+   neither the manifest nor any asset has changed size or modification
+   time since */
+static QByteArray asset_stamp(const QByteArray &data,
+                              const std::vector<asset> &assets)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(QDir::currentPath().toUtf8() + "\n");
+    hash.addData(data);
+    for (auto &a : assets) {
+        QFileInfo info(a.path);
+        if (!info.isFile())
+            return QByteArray();
+        hash.addData((a.path + ":" + QString::number(info.size()) + ":"
+                      + QString::number(info.lastModified()
+                                        .toMSecsSinceEpoch())
+                      + "\n").toUtf8());
+    }
+    return hash.result().toHex();
+}
+
+static QString stamp_path()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation)
+           + "/manifest.verified";
+}
+
+static ManifestResult check_manifest()
+{
+    trace_scope trace("manifest check", "startup");
+    ManifestResult result;
+
+    QFile file(ManifestCheck::manifestPath());
+    if (!file.open(QIODevice::ReadOnly))
+        return result;
+    result.found = true;
+
+    QByteArray data = file.readAll();
+    std::vector<asset> assets;
+    if (!parse_manifest(data, &assets)) {
+        result.corrupt.append(ManifestCheck::manifestPath());
+        return result;
+    }
+
+    QByteArray stamp = asset_stamp(data, assets);
+    QFile stamp_file(stamp_path());
+    if (!stamp.isEmpty() && stamp_file.open(QIODevice::ReadOnly)
+        && stamp_file.readAll() == stamp)
+    {
+        result.digest = QCryptographicHash::hash(data,
+                                                 QCryptographicHash::Sha1);
+        return result;
+    }
+
+    hash_assets(assets);
+    for (auto &a : assets) {
+        if (a.status == asset::status_t::MISSING)
+            result.missing.append(a.path);
+        else if (a.status == asset::status_t::CORRUPT)
+            result.corrupt.append(a.path);
+    }
+    if (result.missing.isEmpty() && result.corrupt.isEmpty()) {
+        result.digest = QCryptographicHash::hash(data,
+                                                 QCryptographicHash::Sha1);
+        if (!stamp.isEmpty()
+            && QDir().mkpath(QFileInfo(stamp_path()).absolutePath()))
+        {
+            QSaveFile save_file(stamp_path());
+            if (save_file.open(QIODevice::WriteOnly)
+                && save_file.write(stamp) == stamp.size())
+            {
+                save_file.commit();
+            }
+        }
+    }
+    return result;
+}
+
+ManifestCheck::ManifestCheck(QObject *parent)
+    : QThread(parent)
+{
+}
+
+ManifestCheck::~ManifestCheck()
+{
+    wait();
+}
+
+QString ManifestCheck::manifestPath()
+{
+    return "manifest.sha1";
+}
+
+ManifestResult ManifestCheck::result()
+{
+    auto &s = shared();
+    std::unique_lock<std::mutex> lock(s.mutex);
+    if (s.started) {
+        s.cond.wait(lock, [&s]() { return s.done; });
+        return s.result;
+    }
+    s.started = true;
+    lock.unlock();
+
+    ManifestResult result = check_manifest();
+
+    lock.lock();
+    s.result = result;
+    s.done = true;
+    s.cond.notify_all();
+    return result;
+}
+
+QByteArray ManifestCheck::verifiedDigest()
+{
+    return result().digest;
+}
+
+void ManifestCheck::run()
+{
+    result();
+}
@@ -0,0 +1,36 @@
+#ifndef MANIFEST_H
+#define MANIFEST_H
+#include <QByteArray>
+#include <QString>
+#include <QStringList>
+#include <QThread>
+
+class ManifestResult
+{
+public:
+    bool found = false;
+    QStringList missing;
+    QStringList corrupt;
+    /* hash of the manifest, only set when every asset matched it */
+    QByteArray digest;
+};
+
+/* checks the bundled assets against the hashes in manifest.sha1 (see
+   tools/gen_manifest.py). the check runs at most once per process, callers
+   that ask for it while it's in progress wait for the result */
+class ManifestCheck : public QThread
+{
+    Q_OBJECT
+
+public:
+    explicit ManifestCheck(QObject *parent = nullptr);
+    ~ManifestCheck() override;
+
+    static QString manifestPath();
+    static ManifestResult result();
+    static QByteArray verifiedDigest();
+
+    void run() override;
+};
+
+#endif
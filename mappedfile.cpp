@@ -0,0 +1,206 @@
+#include <algorithm>
+#include <climits>
+#include "mappedfile.h"
+
+#ifndef Q_OS_WIN
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+#endif
+
+mapped_file::mapped_file() noexcept
+    : m_data(nullptr)
+    , m_size(0)
+    , m_mode(mode_t::READ)
+{
+}
+
+mapped_file::mapped_file(const std::string &path, mode_t mode)
+    : mapped_file()
+{
+    m_path = path;
+#ifdef Q_OS_WIN
+    DWORD dwAccess = GENERIC_READ;
+    if (mode == mode_t::READ_WRITE)
+        dwAccess |= GENERIC_WRITE;
+    m_file.reset(CreateFileW(wide_path(path).c_str(), dwAccess,
+                             FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                             FILE_ATTRIBUTE_NORMAL, nullptr));
+    if (!m_file)
+        throw winapi_exception(GetLastError(), "CreateFileW");
+#else
+    int flags = mode == mode_t::READ_WRITE ? O_RDWR : O_RDONLY;
+    m_file.reset(open(path.c_str(), flags | O_CLOEXEC));
+    if (!m_file)
+        throw posix_exception(errno, "open");
+#endif
+    map(mode);
+}
+
+mapped_file::mapped_file(mapped_file &&other) noexcept
+    : mapped_file()
+{
+    *this = std::move(other);
+}
+
+mapped_file::~mapped_file()
+{
+    reset();
+}
+
+mapped_file mapped_file::create(const std::string &path, size_t size)
+{
+    mapped_file file;
+    file.m_path = path;
+
+#ifdef Q_OS_WIN
+    file.m_file.reset(CreateFileW(wide_path(path).c_str(),
+                                  GENERIC_READ | GENERIC_WRITE,
+                                  FILE_SHARE_READ, nullptr, CREATE_ALWAYS,
+                                  FILE_ATTRIBUTE_NORMAL, nullptr));
+    if (!file.m_file)
+        throw winapi_exception(GetLastError(), "CreateFileW");
+    LARGE_INTEGER liSize;
+    liSize.QuadPart = static_cast<LONGLONG>(size);
+    TRY_WINAPI(SetFilePointerEx, file.m_file.get(), liSize, nullptr,
+               FILE_BEGIN)
+    TRY_WINAPI(SetEndOfFile, file.m_file.get())
+#else
+    file.m_file.reset(open(path.c_str(),
+                           O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0666));
+    if (!file.m_file)
+        throw posix_exception(errno, "open");
+    TRY_POSIX(ftruncate, file.m_file.get(), static_cast<off_t>(size))
+#endif
+
+    file.map(mode_t::READ_WRITE);
+    return file;
+}
+
+#ifdef Q_OS_LINUX
+mapped_file mapped_file::create_memory(const std::string &name, size_t size)
+{
+    mapped_file file;
+
+    file.m_file.reset(memfd_create(name.c_str(), MFD_CLOEXEC));
+    if (!file.m_file)
+        throw posix_exception(errno, "memfd_create");
+    TRY_POSIX(ftruncate, file.m_file.get(), static_cast<off_t>(size))
+    file.m_path = "/proc/" + std::to_string(getpid()) + "/fd/"
+                  + std::to_string(file.m_file.get());
+
+    file.map(mode_t::READ_WRITE);
+    return file;
+}
+#endif
+
+/* ask the system to start reading a file into the page cache, without
+   waiting for it */
+void mapped_file::prefetch(const std::string &path) noexcept
+{
+#ifndef Q_OS_WIN
+    unique_fileno file(open(path.c_str(), O_RDONLY | O_CLOEXEC));
+    if (!file)
+        return;
+# ifdef Q_OS_DARWIN
+    struct stat statbuf;
+    if (fstat(file.get(), &statbuf) != 0)
+        return;
+    struct radvisory ra;
+    ra.ra_offset = 0;
+    ra.ra_count = static_cast<int>(std::min<off_t>(statbuf.st_size,
+                                                   INT_MAX));
+    fcntl(file.get(), F_RDADVISE, &ra);
+# else
+    posix_fadvise(file.get(), 0, 0, POSIX_FADV_WILLNEED);
+# endif
+#else
+    Q_UNUSED(path)
+#endif
+}
+
+mapped_file &mapped_file::operator=(mapped_file &&other) noexcept
+{
+    std::swap(m_data, other.m_data);
+    std::swap(m_size, other.m_size);
+    std::swap(m_mode, other.m_mode);
+    std::swap(m_path, other.m_path);
+    std::swap(m_file, other.m_file);
+#ifdef Q_OS_WIN
+    std::swap(m_mapping, other.m_mapping);
+#endif
+    return *this;
+}
+
+void mapped_file::sync()
+{
+    if (!m_data || m_mode != mode_t::READ_WRITE)
+        return;
+#ifdef Q_OS_WIN
+    TRY_WINAPI(FlushViewOfFile, m_data, 0)
+#else
+    TRY_POSIX(msync, m_data, m_size, MS_SYNC)
+#endif
+}
+
+void mapped_file::reset() noexcept
+{
+    if (m_data) {
+#ifdef Q_OS_WIN
+        UnmapViewOfFile(m_data);
+#else
+        munmap(m_data, m_size);
+#endif
+    }
+    m_data = nullptr;
+    m_size = 0;
+    m_path.clear();
+#ifdef Q_OS_WIN
+    m_mapping.reset();
+#endif
+    m_file.reset();
+}
+
+void mapped_file::map(mode_t mode)
+{
+    m_mode = mode;
+
+#ifdef Q_OS_WIN
+    LARGE_INTEGER liSize;
+    TRY_WINAPI(GetFileSizeEx, m_file.get(), &liSize)
+    m_size = static_cast<size_t>(liSize.QuadPart);
+    if (m_size == 0)
+        return;
+
+    /* CreateFileMapping fails with NULL, not INVALID_HANDLE_VALUE */
+    HANDLE h = CreateFileMappingA(m_file.get(), nullptr,
+                                  mode == mode_t::READ_WRITE
+                                  ? PAGE_READWRITE : PAGE_READONLY,
+                                  0, 0, nullptr);
+    if (!h)
+        throw winapi_exception(GetLastError(), "CreateFileMappingA");
+    m_mapping.reset(h);
+    void *p = MapViewOfFile(m_mapping.get(),
+                            mode == mode_t::READ_WRITE ? FILE_MAP_WRITE
+                                                       : FILE_MAP_READ,
+                            0, 0, 0);
+    if (!p)
+        throw winapi_exception(GetLastError(), "MapViewOfFile");
+    m_data = static_cast<unsigned char *>(p);
+#else
+    struct stat statbuf;
+    TRY_POSIX(fstat, m_file.get(), &statbuf)
+    m_size = static_cast<size_t>(statbuf.st_size);
+    if (m_size == 0)
+        return;
+
+    int prot = PROT_READ;
+    if (mode == mode_t::READ_WRITE)
+        prot |= PROT_WRITE;
+    void *p = mmap(nullptr, m_size, prot, MAP_SHARED, m_file.get(), 0);
+    if (p == MAP_FAILED)
+        throw posix_exception(errno, "mmap");
+    m_data = static_cast<unsigned char *>(p);
+    madvise(p, m_size, MADV_SEQUENTIAL);
+#endif
+}
@@ -0,0 +1,63 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+#include <cstddef>
+#include <string>
+#include "sysutil.h"
+
+class mapped_file
+{
+public:
+    enum mode_t
+    {
+        READ,
+        READ_WRITE,
+    };
+
+    mapped_file() noexcept;
+    mapped_file(const std::string &path, mode_t mode);
+    mapped_file(const mapped_file &) = delete;
+    mapped_file(mapped_file &&other) noexcept;
+
+    ~mapped_file();
+
+    static mapped_file create(const std::string &path, size_t size);
+#ifdef Q_OS_LINUX
+    static mapped_file create_memory(const std::string &name, size_t size);
+#endif
+    static void prefetch(const std::string &path) noexcept;
+
+    mapped_file &operator=(const mapped_file &) = delete;
+    mapped_file &operator=(mapped_file &&other) noexcept;
+
+    unsigned char *data() const noexcept
+    {
+        return m_data;
+    }
+    size_t size() const noexcept
+    {
+        return m_size;
+    }
+    const std::string &path() const noexcept
+    {
+        return m_path;
+    }
+
+    void sync();
+    void reset() noexcept;
+
+private:
+    unsigned char *m_data;
+    size_t m_size;
+    mode_t m_mode;
+    std::string m_path;
+#ifdef Q_OS_WIN
+    unique_handle m_file;
+    unique_handle m_mapping;
+#else
+    unique_fileno m_file;
+#endif
+
+    void map(mode_t mode);
+};
+
+#endif
@@ -1,5 +1,9 @@
 #include <QCloseEvent>
 #include <QScrollBar>
+#include <QTextBlock>
+#include <QTextCursor>
+#include <QTextDocumentFragment>
+#include <QTimer>
 #include "outputdialog.h"
 #include "ui_outputdialog.h"
 
@@ -7,8 +11,12 @@ OutputDialog::OutputDialog(QWidget *parent)
     : QDialog(parent)
     , ui(new Ui::OutputDialog)
     , m_closable(false)
+    , m_max_lines(100000)
+    , m_max_chars(16 * 1024 * 1024)
+    , flush_pending(false)
 {
     ui->setupUi(this);
+    ui->plaintextedit_output->setUndoRedoEnabled(false);
 
     setWindowFlags(Qt::Dialog | Qt::CustomizeWindowHint | Qt::WindowTitleHint
                    | Qt::WindowMinMaxButtonsHint);
@@ -18,6 +26,13 @@ OutputDialog::OutputDialog(QWidget *parent)
         {
             close();
         });
+    connect(ui->pushbutton_cancel, &QPushButton::clicked, this,
+        [this]()
+        {
+            ui->pushbutton_cancel->setEnabled(false);
+            write("cancelling...\n");
+            emit cancelled();
+        });
 }
 
 OutputDialog::~OutputDialog()
@@ -34,17 +49,64 @@ void OutputDialog::setClosable(bool closable)
 {
     m_closable = closable;
     ui->pushbutton_close->setEnabled(m_closable);
+    ui->pushbutton_cancel->setVisible(!m_closable);
+}
+
+int OutputDialog::maxLines()
+{
+    return m_max_lines;
+}
+
+void OutputDialog::setMaxLines(int max_lines)
+{
+    m_max_lines = max_lines;
+    trim();
+}
+
+int OutputDialog::maxChars()
+{
+    return m_max_chars;
+}
+
+void OutputDialog::setMaxChars(int max_chars)
+{
+    m_max_chars = max_chars;
+    trim();
+}
+
+bool OutputDialog::setSpillFile(const QString &path)
+{
+    spill_file.close();
+    if (path.isEmpty())
+        return true;
+    spill_file.setFileName(path);
+    return spill_file.open(QIODevice::WriteOnly | QIODevice::Truncate);
 }
 
 void OutputDialog::write(const QString &output)
 {
+    pending.append(output);
+    if (!flush_pending) {
+        flush_pending = true;
+        QTimer::singleShot(0, this, &OutputDialog::flush);
+    }
+}
+
+void OutputDialog::flush()
+{
+    flush_pending = false;
+    if (pending.isEmpty())
+        return;
+
     auto scroll_value = ui->plaintextedit_output->verticalScrollBar()->value();
     auto scroll_max = ui->plaintextedit_output->verticalScrollBar()->maximum();
     bool max_scrolled = scroll_value == scroll_max;
 
-    QString plaintext = ui->plaintextedit_output->toPlainText();
-    plaintext.append(output);
-    ui->plaintextedit_output->setPlainText(plaintext);
+    QTextCursor cursor(ui->plaintextedit_output->document());
+    cursor.movePosition(QTextCursor::End);
+    cursor.insertText(pending);
+    pending.clear();
+    trim();
 
     if (max_scrolled) {
         scroll_max = ui->plaintextedit_output->verticalScrollBar()->maximum();
@@ -52,6 +114,35 @@ void OutputDialog::write(const QString &output)
     }
 }
 
+void OutputDialog::trim()
+{
+    auto doc = ui->plaintextedit_output->document();
+    int remove_end = 0;
+
+    if (m_max_lines > 0 && doc->blockCount() > m_max_lines) {
+        remove_end = doc->findBlockByNumber(doc->blockCount() - m_max_lines)
+                     .position();
+    }
+
+    int n_chars = doc->characterCount() - 1;
+    if (m_max_chars > 0 && n_chars > m_max_chars) {
+        int excess = n_chars - m_max_chars;
+        QTextBlock next = doc->findBlock(excess).next();
+        if (next.isValid())
+            excess = next.position();
+        remove_end = qMax(remove_end, excess);
+    }
+
+    if (remove_end == 0)
+        return;
+
+    QTextCursor cursor(doc);
+    cursor.setPosition(remove_end, QTextCursor::KeepAnchor);
+    if (spill_file.isOpen())
+        spill_file.write(cursor.selection().toPlainText().toUtf8());
+    cursor.removeSelectedText();
+}
+
 void OutputDialog::done(int r)
 {
     if (m_closable)
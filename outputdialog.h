@@ -1,6 +1,7 @@
 #ifndef OUTPUTDIALOG_H
 #define OUTPUTDIALOG_H
 #include <QDialog>
+#include <QFile>
 
 QT_BEGIN_NAMESPACE
 namespace Ui { class OutputDialog; }
@@ -18,13 +19,32 @@ public:
     bool closable();
     void setClosable(bool closable);
 
+    int maxLines();
+    void setMaxLines(int max_lines);
+    int maxChars();
+    void setMaxChars(int max_chars);
+    bool setSpillFile(const QString &path);
+
 public slots:
     void write(const QString &output);
     void done(int r) override;
 
+signals:
+    void cancelled();
+
+private slots:
+    void flush();
+
 private:
     Ui::OutputDialog *ui;
     bool m_closable;
+    int m_max_lines;
+    int m_max_chars;
+    QString pending;
+    bool flush_pending;
+    QFile spill_file;
+
+    void trim();
 };
 
 #endif
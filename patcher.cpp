@@ -1,610 +1,774 @@
-#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
 #include <exception>
 #include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFileInfo>
+#include <QLockFile>
+#include <QMetaMethod>
+#include <QSaveFile>
+#include <QStandardPaths>
 #include <QtGlobal>
-#include <QTemporaryDir>
+#include "crc32.h"
+#include "gruworker.h"
+#include "gzinjectshim.h"
+#include "mappedfile.h"
 #include "patcher.h"
+#include "publish.h"
+#include "resultcache.h"
+#include "romformat.h"
+#include "subprocess.h"
+#include "trace.h"
+#include "ups.h"
+#include "wad.h"
+#include "wadcache.h"
 
 #ifdef Q_OS_WIN
-# include <windows.h>
+static const char gru[] = "bin\\gru.exe";
+static const char gzinject[] = "bin\\gzinject.exe";
 #else
-# include <fcntl.h>
-# include <poll.h>
-# include <sys/wait.h>
+static const char gru[] = "bin/gru";
+static const char gzinject[] = "bin/gzinject";
 #endif
 
-static std::string quote(const std::string &str)
+WadStage::WadStage()
 {
-    std::string esc_str;
-    esc_str.push_back('"');
-    for (auto c : str) {
-        if (c == '"')
-            esc_str.push_back('\\');
-        esc_str.push_back(c);
-    }
-    esc_str.push_back('"');
-    return esc_str;
 }
 
-#ifdef Q_OS_WIN
-class unique_handle
+WadStage::~WadStage()
 {
-public:
-    unique_handle() noexcept
-        : m_handle(INVALID_HANDLE_VALUE)
-    {
-    }
-    explicit unique_handle(HANDLE handle) noexcept
-        : m_handle(handle)
-    {
-    }
-    unique_handle(const unique_handle &) = delete;
-    unique_handle(unique_handle &&other) noexcept
-    {
-        std::swap(m_handle, other.m_handle);
-    }
+}
 
-    ~unique_handle()
-    {
-        if (m_handle != INVALID_HANDLE_VALUE)
-            CloseHandle(m_handle);
-    }
+bool WadStage::claim()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (claimed)
+        return false;
+    claimed = true;
+    return true;
+}
 
-    unique_handle &operator=(const unique_handle &) = delete;
-    unique_handle &operator=(unique_handle &&other) noexcept
+void WadStage::finish(std::unique_ptr<Wad> wad, const std::string &name)
+{
     {
-        std::swap(m_handle, other.m_handle);
-        return *this;
+        std::lock_guard<std::mutex> lock(mutex);
+        m_wad = std::move(wad);
+        m_name = name;
+        finished = true;
     }
+    cond.notify_all();
+}
 
-    operator bool() const noexcept
-    {
-        return m_handle != INVALID_HANDLE_VALUE;
+bool WadStage::wait(const std::atomic<bool> &cancelled)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!finished) {
+        if (cancelled)
+            return false;
+        cond.wait_for(lock, std::chrono::milliseconds(100));
     }
+    return true;
+}
 
-    HANDLE get() const noexcept
-    {
-        return m_handle;
-    }
-    HANDLE *ptr()
-    {
-        if (m_handle == INVALID_HANDLE_VALUE)
-            return &m_handle;
-        else
-            throw std::bad_cast();
-    }
-    HANDLE release() noexcept
-    {
-        HANDLE handle = m_handle;
-        m_handle = INVALID_HANDLE_VALUE;
-        return handle;
-    }
-    void reset(HANDLE handle = INVALID_HANDLE_VALUE) noexcept
-    {
-        *this = unique_handle(handle);
-    }
-    void reset(unique_handle &&other) noexcept
-    {
-        *this = std::move(other);
-    }
+const Wad *WadStage::wad() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return m_wad.get();
+}
+
+std::string WadStage::name() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return m_name;
+}
+
+Patcher::Patcher(const PatcherSettings &settings, QObject *parent)
+    : QThread(parent)
+    , settings(settings)
+{
+}
 
-private:
-    HANDLE m_handle;
-};
+/* output is handed to the receiving thread in batches, at most one delivery
+   is queued at a time and whatever arrives meanwhile is appended to it. if
+   the receiver falls too far behind, the producer waits for it to catch up
+   (but not indefinitely, so that a blocked receiver can't stall the patch) */
+static const size_t output_limit = 8 << 20;
+static const std::chrono::milliseconds output_wait(250);
 
-#define TRY_WINAPI(f,...) \
-{ \
-    if (!(f)(__VA_ARGS__)) \
-        throw winapi_exception(GetLastError(), #f); \
+/* length of the longest prefix of data that doesn't end in a truncated
+   UTF-8 sequence */
+static size_t utf8_complete(const std::string &data)
+{
+    size_t n = data.size();
+    for (size_t i = 1; i <= 4 && i <= n; i++) {
+        unsigned char c = static_cast<unsigned char>(data[n - i]);
+        if ((c & 0xC0) == 0x80)
+            continue;
+        size_t len = c < 0x80 ? 1 : c >= 0xF0 ? 4 : c >= 0xE0 ? 3 :
+                     c >= 0xC0 ? 2 : 1;
+        return len > i ? n - i : n;
+    }
+    return n;
 }
 
-class winapi_exception : public std::exception
+int Patcher::getResult()
 {
-public:
-    winapi_exception(DWORD dwErrorCode, const char *s)
-        : m_dwErrorCode(dwErrorCode)
-    {
-        LPSTR lpMsgBuf;
+    wait();
+    if (eptr)
+        std::rethrow_exception(eptr);
+    return result;
+}
 
-        TRY_WINAPI(FormatMessageA,
-                   FORMAT_MESSAGE_ALLOCATE_BUFFER
-                   | FORMAT_MESSAGE_FROM_SYSTEM
-                   | FORMAT_MESSAGE_IGNORE_INSERTS,
-                   nullptr, m_dwErrorCode,
-                   MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT),
-                   reinterpret_cast<LPSTR>(&lpMsgBuf), 0, nullptr)
+void Patcher::write_output(const char *data, size_t size)
+{
+    if (size == 0 || !isSignalConnected(QMetaMethod::fromSignal(
+                                            &Patcher::output)))
+    {
+        return;
+    }
 
-        try {
-            m_error_str = std::string(s) + ": " + lpMsgBuf;
-        }
-        catch (...) {
-            LocalFree(lpMsgBuf);
-            throw;
+    if (QThread::currentThread() == thread()) {
+        {
+            std::lock_guard<std::mutex> lock(output_mutex);
+            output_pending.append(data, size);
         }
-
-        LocalFree(lpMsgBuf);
+        deliver_output();
+        return;
     }
 
-    DWORD error_code() const noexcept
-    {
-        return m_dwErrorCode;
+    std::unique_lock<std::mutex> lock(output_mutex);
+    if (output_pending.size() >= output_limit) {
+        output_cond.wait_for(lock, output_wait,
+            [this]()
+            {
+                return output_pending.size() < output_limit;
+            });
     }
-    const char *what() const noexcept override
-    {
-        return m_error_str.c_str();
+    output_pending.append(data, size);
+    if (!output_queued) {
+        output_queued = true;
+        QMetaObject::invokeMethod(this, "deliver_output",
+                                  Qt::QueuedConnection);
     }
+}
 
-private:
-    DWORD m_dwErrorCode;
-    std::string m_error_str;
-};
-#endif
+void Patcher::write_output(const std::string &str)
+{
+    write_output(str.data(), str.size());
+}
 
-class unique_fileno
+void Patcher::flush_output()
 {
-public:
-    unique_fileno() noexcept
-        : m_fileno(-1)
-    {
-    }
-    explicit unique_fileno(int fileno) noexcept
-        : m_fileno(fileno)
-    {
-    }
-    unique_fileno(const unique_fileno &) = delete;
-    unique_fileno(unique_fileno &&other) noexcept
-    {
-        std::swap(m_fileno, other.m_fileno);
+    std::unique_lock<std::mutex> lock(output_mutex);
+    output_final = true;
+    if (output_pending.empty())
+        return;
+    if (QThread::currentThread() == thread()) {
+        lock.unlock();
+        deliver_output();
+    }
+    else if (!output_queued) {
+        output_queued = true;
+        QMetaObject::invokeMethod(this, "deliver_output",
+                                  Qt::QueuedConnection);
     }
+}
 
-    ~unique_fileno()
-    {
-        if (m_fileno != -1)
-            close(m_fileno);
+void Patcher::deliver_output()
+{
+    std::string data;
+    {
+        std::lock_guard<std::mutex> lock(output_mutex);
+        output_queued = false;
+        data.swap(output_pending);
+        size_t n = output_final ? data.size() : utf8_complete(data);
+        if (n != data.size()) {
+            output_pending.assign(data, n, std::string::npos);
+            data.resize(n);
+        }
     }
+    output_cond.notify_all();
 
-    unique_fileno &operator=(const unique_fileno &) = delete;
-    unique_fileno &operator=(unique_fileno &&other) noexcept
-    {
-        std::swap(m_fileno, other.m_fileno);
-        return *this;
+    if (!data.empty()) {
+        emit output(QString::fromUtf8(data.data(),
+                                      static_cast<int>(data.size())));
     }
+}
 
-    operator bool() const noexcept
-    {
-        return m_fileno != -1;
-    }
+void Patcher::cancel()
+{
+    cancelled = true;
+}
 
-    int get() const noexcept
-    {
-        return m_fileno;
-    }
-    int *ptr()
-    {
-        if (m_fileno == -1)
-            return &m_fileno;
-        else
-            throw std::bad_cast();
-    }
-    int release() noexcept
-    {
-        int fileno = m_fileno;
-        m_fileno = -1;
-        return fileno;
-    }
-    void reset(int fileno = -1) noexcept
-    {
-        *this = unique_fileno(fileno);
-    }
-    void reset(unique_fileno &&other) noexcept
-    {
-        *this = std::move(other);
-    }
+bool Patcher::isCancelled() const
+{
+    return cancelled;
+}
 
-private:
-    int m_fileno;
-};
+std::string Patcher::outputName() const
+{
+    return output_name;
+}
 
-#define TRY_POSIX(f,...) \
-{ \
-    if ((f)(__VA_ARGS__) == -1) \
-        throw posix_exception(errno, #f); \
+void Patcher::setWadStage(std::shared_ptr<WadStage> stage)
+{
+    wad_stage = std::move(stage);
 }
 
-class posix_exception : public std::exception
+std::vector<std::string> Patcher::environment()
 {
-public:
-    posix_exception(int error_code, const char *s)
-        : m_error_code(error_code)
-    {
-        m_error_str = std::string(s) + ": " + strerror(m_error_code);
+    QString self = QCoreApplication::applicationFilePath();
+    if (!(settings.use_cache || settings.use_native) || self.isEmpty())
+        return {std::string("GZINJECT=") + gzinject};
+
+    /* route gzinject through this program so that WAD extractions are
+       served from the cache and patch scripts run in-process, see
+       gzinjectshim.cpp */
+    std::vector<std::string> env = {
+        "GZINJECT=" + QDir::toNativeSeparators(self).toStdString(),
+        "GZ_GUI_GZINJECT=" + QDir::toNativeSeparators(
+            QFileInfo(gzinject).absoluteFilePath()).toStdString(),
+    };
+    if (settings.use_cache) {
+        env.push_back("GZ_GUI_WAD_CACHE="
+                      + WadCache::defaultPath().toStdString());
     }
+    if (settings.use_native)
+        env.push_back("GZ_GUI_NATIVE=1");
+    return env;
+}
 
-    int error_code() const noexcept
+int Patcher::execute(const std::vector<std::string> &args,
+                     const std::string &input, std::string *output_str)
+{
+    auto output_to_log = [this](const char *data, size_t size)
     {
-        return m_error_code;
-    }
-    const char *what() const noexcept override
+        write_output(data, size);
+    };
+    auto output_to_str = [output_str](const char *data, size_t size)
     {
-        return m_error_str.c_str();
+        output_str->append(data, size);
+    };
+    /* each subprocess is a stage with its own timeout. checking the limits
+       up front also stops a cancelled patch between stages */
+    subprocess_limits limits(&cancelled,
+                             std::chrono::seconds(settings.stage_timeout));
+    limits.check();
+    std::vector<std::string> env = environment();
+
+    write_output("executing: " + join_args(args) + "\n");
+    std::function<void(const char *, size_t)> stdout_fn = output_to_log;
+    if (output_str) {
+        output_str->clear();
+        stdout_fn = output_to_str;
+    }
+
+    if (settings.use_worker && args.front() == gru && input.empty()) {
+        bool emitted = false;
+        auto worker_stdout = [&](const char *data, size_t size)
+        {
+            emitted = emitted || !output_str;
+            stdout_fn(data, size);
+        };
+        auto worker_stderr = [&](const char *data, size_t size)
+        {
+            emitted = true;
+            output_to_log(data, size);
+        };
+        int status;
+        if (GruWorker::execute(args, env, worker_stdout, worker_stderr,
+                               &status, &limits))
+        {
+            return status;
+        }
+        if (output_str)
+            output_str->clear();
+        if (emitted) {
+            write_output("\n--- the gru worker did not finish this job, the"
+                         " output above is incomplete. running it again in"
+                         " a new process ---\n");
+        }
+        else
+            write_output("gru worker unavailable, starting a new process\n");
     }
 
-private:
-    int m_error_code;
-    std::string m_error_str;
-};
+    return invoke_subprogram(args, env, input, stdout_fn, output_to_log,
+                             &limits);
+}
 
-static int invoke_subprogram(const std::string &cmd, const std::string &input,
-                             std::function<void(const std::string &)> stdout_fn,
-                             std::function<void(const std::string &)> stderr_fn)
+static mapped_file scratch_file(const QTemporaryDir &tmpdir, const char *name,
+                               size_t size)
 {
-#ifdef Q_OS_WIN
-    unique_handle hStdInRd;
-    unique_handle hStdInWr;
-    unique_handle hStdOutRd;
-    unique_handle hStdOutWr;
-    unique_handle hStdErrRd;
-    unique_handle hStdErrWr;
-
-    {
-        SECURITY_ATTRIBUTES sa;
-        sa.nLength = sizeof(sa);
-        sa.bInheritHandle = TRUE;
-        sa.lpSecurityDescriptor = nullptr;
-
-        TRY_WINAPI(CreatePipe, hStdInRd.ptr(), hStdInWr.ptr(), &sa, 0)
-        TRY_WINAPI(SetHandleInformation, hStdInWr.get(),
-                   HANDLE_FLAG_INHERIT, 0)
-
-        TRY_WINAPI(CreatePipe, hStdOutRd.ptr(), hStdOutWr.ptr(), &sa, 0)
-        TRY_WINAPI(SetHandleInformation, hStdOutRd.get(),
-                   HANDLE_FLAG_INHERIT, 0)
-
-        TRY_WINAPI(CreatePipe, hStdErrRd.ptr(), hStdErrWr.ptr(), &sa, 0)
-        TRY_WINAPI(SetHandleInformation, hStdErrRd.get(),
-                   HANDLE_FLAG_INHERIT, 0)
+#ifdef Q_OS_LINUX
+    try {
+        return mapped_file::create_memory(name, size);
+    }
+    catch (const posix_exception &) {
     }
+#endif
+    return mapped_file::create(tmpdir.filePath(name).toStdString(), size);
+}
 
-    unique_handle hChildProcess;
-    unique_handle hChildThread;
+std::string Patcher::normalize_rom(const QTemporaryDir &tmpdir,
+                                   const std::string &path,
+                                   const char *name, mapped_file *buffer)
+{
+    mapped_file rom_file;
+    try {
+        rom_file = mapped_file(path, mapped_file::mode_t::READ);
+    }
+    catch (const std::exception &) {
+        return path;
+    }
 
+    RomFormat::format_t format = RomFormat::detect(rom_file.data(),
+                                                   rom_file.size());
+    if (format != RomFormat::format_t::V64
+        && format != RomFormat::format_t::N64)
     {
-        STARTUPINFOA si;
-        ZeroMemory(&si, sizeof(si));
-        si.cb = sizeof(si);
-        si.hStdInput = hStdInRd.get();
-        si.hStdOutput = hStdOutWr.get();
-        si.hStdError = hStdErrWr.get();
-        si.dwFlags = STARTF_USESTDHANDLES;
-
-        PROCESS_INFORMATION pi;
-        ZeroMemory(&pi, sizeof(pi));
-
-        TRY_WINAPI(CreateProcessA, nullptr, const_cast<char*>(cmd.c_str()),
-                   nullptr, nullptr, TRUE, CREATE_NO_WINDOW, nullptr, nullptr,
-                   &si, &pi)
-        hChildProcess = unique_handle(pi.hProcess);
-        hChildThread = unique_handle(pi.hThread);
-
-        hStdInRd.reset();
-        hStdOutWr.reset();
-        hStdErrWr.reset();
+        return path;
     }
 
-    {
-        DWORD dwWritten;
-        TRY_WINAPI(WriteFile, hStdInWr.get(), input.c_str(),
-                   static_cast<DWORD>(input.size()), &dwWritten, nullptr)
-        hStdInWr.reset();
+    trace_scope trace("normalize", "patcher",
+                      trace_enabled() ? trace_arg("path", path)
+                                      : std::string());
+
+    /* swap into the scratch buffer a chunk at a time so that the source is
+       only read once and the copy stays in cache while it's converted */
+    const size_t chunk_size = 1 << 20;
+    *buffer = scratch_file(tmpdir, name, rom_file.size());
+    for (size_t pos = 0; pos < rom_file.size(); pos += chunk_size) {
+        size_t n = std::min(chunk_size, rom_file.size() - pos);
+        memcpy(buffer->data() + pos, rom_file.data() + pos, n);
+        RomFormat::normalize(buffer->data() + pos, n, format);
     }
+    write_output("converted " + path + " to big endian\n");
 
-    while (true) {
-        bool stdout_hup = false;
-        bool stderr_hup = false;
-        char output_buf[1024];
-        DWORD dwBytes;
+    return buffer->path();
+}
 
-        if (!PeekNamedPipe(hStdOutRd.get(), nullptr, 0, nullptr,
-                           &dwBytes, nullptr))
+bool Patcher::patch_rom_native(const std::string &in_rom_path,
+                               const std::string &rom_path,
+                               std::string *gz_rom_name)
+{
+    trace_scope trace("ups", "patcher");
+    try {
+        mapped_file in_rom(in_rom_path, mapped_file::mode_t::READ);
+        uint32_t in_crc = crc32(0, in_rom.data(), in_rom.size());
+
+        /* patches are tried in name order so that the choice doesn't
+           depend on the directory order. one that can't be read only
+           rules out itself */
+        QStringList matches;
+        QDir ups_dir("ups");
+        for (const QString &name : ups_dir.entryList({"*.ups"}, QDir::Files,
+                                                     QDir::Name))
         {
-            DWORD dwErrorCode = GetLastError();
-            if (dwErrorCode == ERROR_BROKEN_PIPE)
-                stdout_hup = true;
-            else
-                throw winapi_exception(dwErrorCode, "PeekNamedPipe");
+            QString ups_path = ups_dir.filePath(name);
+            try {
+                mapped_file ups_file(ups_path.toStdString(),
+                                     mapped_file::mode_t::READ);
+                UpsPatch ups(ups_file.data(), ups_file.size());
+                if (ups.sourceSize() == in_rom.size()
+                    && ups.sourceCrc() == in_crc)
+                {
+                    matches.push_back(ups_path);
+                }
+            }
+            catch (const std::exception &e) {
+                write_output("skipping " + ups_path.toStdString() + ": "
+                             + e.what() + "\n");
+            }
         }
-        else if (dwBytes != 0) {
-            TRY_WINAPI(ReadFile, hStdOutRd.get(), output_buf, 1024,
-                       &dwBytes, nullptr)
-            stdout_fn(std::string(output_buf, dwBytes));
+        if (matches.size() > 1) {
+            write_output("several patches in ups match, trying them in"
+                         " name order\n");
         }
 
-        if (!PeekNamedPipe(hStdErrRd.get(), nullptr, 0, nullptr,
-                           &dwBytes, nullptr))
-        {
-            DWORD dwErrorCode = GetLastError();
-            if (dwErrorCode == ERROR_BROKEN_PIPE)
-                stderr_hup = true;
-            else
-                throw winapi_exception(dwErrorCode, "PeekNamedPipe");
-        }
-        else if (dwBytes != 0) {
-            TRY_WINAPI(ReadFile, hStdErrRd.get(), output_buf, 1024,
-                       &dwBytes, nullptr)
-            stderr_fn(std::string(output_buf, dwBytes));
+        /* the hunks and the patch checksum are only checked here */
+        for (const QString &ups_path : matches) {
+            try {
+                mapped_file ups_file(ups_path.toStdString(),
+                                     mapped_file::mode_t::READ);
+                UpsPatch ups(ups_file.data(), ups_file.size());
+                mapped_file out_rom = mapped_file::create(rom_path,
+                                                          ups.targetSize());
+                ups.apply(in_rom.data(), in_rom.size(), out_rom.data(),
+                          out_rom.size());
+                *gz_rom_name = QFileInfo(ups_path).completeBaseName()
+                                   .toStdString() + ".z64";
+                write_output("applied " + ups_path.toStdString() + "\n");
+                return true;
+            }
+            catch (const std::exception &e) {
+                write_output("skipping " + ups_path.toStdString() + ": "
+                             + e.what() + "\n");
+            }
         }
-
-        if (stdout_hup && stderr_hup)
-            break;
     }
-    hStdOutRd.reset();
-    hStdErrRd.reset();
-
-    WaitForSingleObject(hChildProcess.get(), INFINITE);
-    DWORD dwStatus;
-    TRY_WINAPI(GetExitCodeProcess, hChildProcess.get(), &dwStatus)
+    catch (const std::exception &e) {
+        write_output(std::string("native patcher failed: ") + e.what()
+                     + "\n");
+        return false;
+    }
+    write_output("no matching patch in ups, falling back to gru\n");
+    return false;
+}
 
-    return static_cast<int>(dwStatus);
-#else
-    unique_fileno stdin_rd;
-    unique_fileno stdin_wr;
-    unique_fileno stdout_rd;
-    unique_fileno stdout_wr;
-    unique_fileno stderr_rd;
-    unique_fileno stderr_wr;
+/* every rom that comes out of patch_rom goes through here, whichever steps
+   produced it, so that its boot checksum always matches */
+void Patcher::finish_rom(const std::string &rom_path)
+{
+    trace_scope trace("checksum", "patcher");
+    mapped_file rom(rom_path, mapped_file::mode_t::READ_WRITE);
+    if (RomFormat::updateChecksum(rom.data(), rom.size()))
+        write_output("updated the rom checksum\n");
+}
 
+int Patcher::patch_rom(const QTemporaryDir &tmpdir,
+                       const std::string &rom_path, std::string *gz_rom_name)
+{
+    mapped_file in_rom_buffer;
+    mapped_file ucode_buffer;
+    std::string in_rom_path = normalize_rom(tmpdir, settings.rom_path,
+                                            "in.z64", &in_rom_buffer);
+    std::string ucode_path;
+    if (settings.opt_ucode) {
+        ucode_path = normalize_rom(tmpdir, settings.ucode_path, "ucode.z64",
+                                   &ucode_buffer);
+    }
+
+    /* applying the patch in-process saves starting gru and keeps the rom
+       in memory. the target checksum in the patch guarantees the same
+       output, and anything the native path can't handle goes to the script
+       instead */
+    int status = 0;
+    if (!settings.use_native
+        || !patch_rom_native(in_rom_path, rom_path, gz_rom_name))
     {
-        int pipefd[2];
-
-        TRY_POSIX(pipe, pipefd)
-        stdin_rd = unique_fileno(pipefd[0]);
-        stdin_wr = unique_fileno(pipefd[1]);
-
-        TRY_POSIX(pipe, pipefd)
-        stdout_rd = unique_fileno(pipefd[0]);
-        stdout_wr = unique_fileno(pipefd[1]);
-
-        TRY_POSIX(pipe, pipefd)
-        stderr_rd = unique_fileno(pipefd[0]);
-        stderr_wr = unique_fileno(pipefd[1]);
-    }
-
-    pid_t cpid = fork();
-
-    if (cpid == -1)
-        throw posix_exception(errno, "fork");
-    else if (cpid == 0) {
-        stdin_wr.reset();
-        stdout_rd.reset();
-        stderr_rd.reset();
-        if (dup2(stdin_rd.get(), STDIN_FILENO) == -1)
-            exit(EXIT_FAILURE);
-        if (dup2(stdout_wr.get(), STDOUT_FILENO) == -1)
-            exit(EXIT_FAILURE);
-        if (dup2(stderr_wr.get(), STDERR_FILENO) == -1)
-            exit(EXIT_FAILURE);
-        if (execl("/bin/sh", "sh", "-c", cmd.c_str(), nullptr) == -1)
-            exit(EXIT_FAILURE);
+        status = execute({gru, "lua/patch-rom.lua", "-s", "-o", rom_path,
+                              in_rom_path},
+                             "", gz_rom_name);
     }
-    else {
-        stdin_rd.reset();
-        stdout_wr.reset();
-        stderr_wr.reset();
+    if (status == 0 && settings.opt_ucode) {
+        status = execute({gru, "lua/inject_ucode.lua", rom_path,
+                          ucode_path},
+                         "", nullptr);
     }
+    if (status == 0 && settings.use_native)
+        finish_rom(rom_path);
+    return status;
+}
 
-    TRY_POSIX(write, stdin_wr.get(), input.c_str(), input.size())
-    close(stdin_wr.get());
+static QByteArray file_digest(const QString &path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return QByteArray();
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+    if (!hash.addData(&file))
+        return QByteArray();
+    return hash.result().toHex();
+}
 
-    struct pollfd pollfds[] =
-    {
-        {stdout_rd.get(), POLLIN, 0},
-        {stderr_rd.get(), POLLIN, 0},
-    };
-    while (true) {
-        bool stdout_hup = false;
-        bool stderr_hup = false;
-        char output_buf[1024];
-        ssize_t n_bytes;
-
-        TRY_POSIX(poll, pollfds, 2, -1)
-
-        if (pollfds[0].revents) {
-            n_bytes = read(stdout_rd.get(), output_buf, 1024);
-            if (n_bytes == -1)
-                throw posix_exception(errno, "read");
-            else if (n_bytes == 0)
-                stdout_hup = true;
-            else {
-                stdout_fn(std::string(output_buf,
-                                      static_cast<size_t>(n_bytes)));
-            }
-        }
+static bool verify_common_key(const QString &path)
+{
+    if (QFileInfo(path).size() != 16)
+        return false;
+    QFile digest_file(path + ".sha256");
+    if (!digest_file.open(QIODevice::ReadOnly))
+        return false;
+    QByteArray digest = file_digest(path);
+    return !digest.isEmpty() && digest_file.readAll().trimmed() == digest;
+}
 
-        if (pollfds[1].revents) {
-            n_bytes = read(stderr_rd.get(), output_buf, 1024);
-            if (n_bytes == -1)
-                throw posix_exception(errno, "read");
-            else if (n_bytes == 0)
-                stderr_hup = true;
-            else {
-                stderr_fn(std::string(output_buf,
-                                      static_cast<size_t>(n_bytes)));
-            }
+int Patcher::common_key(std::string *key_path)
+{
+    static std::mutex mutex;
+    std::lock_guard<std::mutex> guard(mutex);
+
+    QString dir = QStandardPaths::
+        writableLocation(QStandardPaths::CacheLocation);
+    QString path = dir + "/common-key.bin";
+    if (!QDir().mkpath(dir))
+        throw std::runtime_error("could not create " + dir.toStdString());
+
+    QLockFile lock(path + ".lock");
+    if (!lock.lock())
+        throw std::runtime_error("could not lock " + path.toStdString());
+
+    if (!verify_common_key(path)) {
+        QString tmp_path = path + ".tmp";
+        QFile::remove(tmp_path);
+        int status = execute({gzinject, "-a", "genkey", "-k",
+                              tmp_path.toStdString()},
+                             "45e", nullptr);
+        if (status != 0)
+            return status;
+
+        QSaveFile digest_file(path + ".sha256");
+        QByteArray digest = file_digest(tmp_path);
+        if (digest.isEmpty()
+            || !digest_file.open(QIODevice::WriteOnly)
+            || digest_file.write(digest) != digest.size()
+            || !digest_file.commit())
+        {
+            throw std::runtime_error("could not write "
+                                     + digest_file.fileName().toStdString());
         }
 
-        if (stdout_hup && stderr_hup)
-            break;
+        publish_file(tmp_path.toStdString(), path.toStdString());
     }
-    stdout_rd.reset();
-    stderr_rd.reset();
 
-    int status;
-    TRY_POSIX(waitpid, cpid, &status, 0)
+    *key_path = path.toStdString();
+    return 0;
+}
 
-    return WEXITSTATUS(status);
-#endif
+int Patcher::run_patch_wad(const std::string &extract_path,
+                           const std::string &key_path,
+                           const std::string &wad_path,
+                           std::string *gz_wad_name)
+{
+    std::vector<std::string> args = {gru, "lua/patch-wad.lua", "-s", "-k",
+                                     key_path, "-d", extract_path};
+    if (settings.wad_remap == PatcherSettings::wad_remap_t::RAPHNET)
+        args.push_back("--raphnet");
+    else if (settings.wad_remap == PatcherSettings::wad_remap_t::NONE)
+        args.push_back("--disable-controller-remappings");
+    if (!settings.channel_id.empty()) {
+        args.push_back("-i");
+        args.push_back(settings.channel_id);
+    }
+    if (!settings.channel_title.empty()) {
+        args.push_back("-t");
+        args.push_back(settings.channel_title);
+    }
+    args.push_back("-r");
+    args.push_back(std::to_string(settings.wad_region));
+    if (settings.opt_extrom) {
+        args.push_back("-m");
+        args.push_back(settings.extrom_path);
+    }
+    args.push_back("-o");
+    args.push_back(wad_path);
+    args.push_back(settings.wad_path);
+
+    return execute(args, "", gz_wad_name);
 }
 
-Patcher::Patcher(const PatcherSettings &settings, QWidget *parent)
-    : QThread(parent)
-    , settings(settings)
+/* run patch-wad.lua with the shim staging its pack, and patch the staged
+   contents once for every job sharing the stage. the region is the only
+   thing those jobs differ in, so the stage is only used if patch-wad.lua
+   passed it through to gzinject unchanged */
+int Patcher::stage_wad(const QTemporaryDir &tmpdir,
+                       const std::string &key_path,
+                       const std::string &wad_path, std::string *gz_wad_name)
 {
+    std::string extract_path = tmpdir.filePath("wadextract").toStdString();
+    std::unique_ptr<Wad> wad;
+    staged_pack pack;
+    bool staged = false;
+    int status = 0;
+    try {
+        staged_pack::mark(tmpdir.path());
+        status = run_patch_wad(extract_path, key_path, wad_path,
+                               gz_wad_name);
+        staged = status == 0 && staged_pack::load(tmpdir.path(), &pack);
+    }
+    catch (...) {
+        wad_stage->finish(nullptr, std::string());
+        throw;
+    }
+
+    if (staged) {
+        trace_scope trace("stage", "patcher");
+        try {
+            if (pack.region != std::to_string(settings.wad_region))
+                throw std::runtime_error("region " + pack.region
+                                         + " was packed");
+            wad.reset(new Wad(pack.patch()));
+        }
+        catch (const std::exception &e) {
+            write_output(std::string("could not stage the patch: ")
+                         + e.what() + "\n");
+        }
+    }
+    wad_stage->finish(std::move(wad), *gz_wad_name);
+
+    if (!staged)
+        return status;
+    if (!wad_stage->wad()) {
+        /* the shim left the pack to us, so do it all over. the marker now
+           holds a record, so the shim won't stage again */
+        return run_patch_wad(extract_path, key_path, wad_path, gz_wad_name);
+    }
+    pack_staged(wad_path);
+    return 0;
 }
 
-int Patcher::getResult()
+void Patcher::pack_staged(const std::string &wad_path)
 {
-    wait();
-    if (eptr)
-        std::rethrow_exception(eptr);
-    return result;
+    trace_scope trace("pack staged", "patcher");
+    Wad wad = *wad_stage->wad();
+    wad.setRegion(settings.wad_region);
+    wad.save(wad_path);
+    write_output("packed " + wad_path + " from the staged patch\n");
 }
 
-int Patcher::patch()
+int Patcher::patch_wad(const QTemporaryDir &tmpdir,
+                       const std::string &wad_path, std::string *gz_wad_name)
 {
-    auto output_to_log = [this](const std::string &str)
-    {
-        emit output(QString::fromStdString(str));
-    };
-    std::string output_str;
-    auto output_to_str = [&output_str](const std::string &str)
-    {
-        output_str += str;
-    };
+    std::string key_path;
+    int status = common_key(&key_path);
+    if (status != 0)
+        return status;
+
+    if (wad_stage) {
+        if (wad_stage->claim())
+            return stage_wad(tmpdir, key_path, wad_path, gz_wad_name);
+
+        write_output("waiting for the staged patch\n");
+        if (!wad_stage->wait(cancelled)) {
+            throw subprocess_aborted(subprocess_aborted::reason_t::CANCELLED,
+                                     "cancelled");
+        }
+        if (wad_stage->wad()) {
+            pack_staged(wad_path);
+            *gz_wad_name = wad_stage->name();
+            return 0;
+        }
+        write_output("the staged patch failed, patching unstaged\n");
+    }
 
-#ifdef Q_OS_WIN
-    std::string gru = "bin\\gru.exe";
-    std::string gzinject = "bin\\gzinject.exe";
-    _putenv_s("GZINJECT", gzinject.c_str());
-#else
-    std::string gru = "bin/gru";
-    std::string gzinject = "bin/gzinject";
-    setenv("GZINJECT", gzinject.c_str(), 1);
-#endif
+    std::string extract_path = tmpdir.filePath("wadextract").toStdString();
+    return run_patch_wad(extract_path, key_path, wad_path, gz_wad_name);
+}
 
-    int status = 0;
-    QTemporaryDir tmpdir;
+int Patcher::patch()
+{
+    std::unique_ptr<QTemporaryDir> tmpdir_ptr;
+    {
+        trace_scope trace("tmpdir", "patcher");
+        if (!settings.output_path.empty()) {
+            QFileInfo info(QString::fromStdString(settings.output_path));
+            tmpdir_ptr.reset(new QTemporaryDir(info.absolutePath()
+                                               + "/.gz-gui-XXXXXX"));
+            if (!tmpdir_ptr->isValid())
+                tmpdir_ptr.reset();
+        }
+        if (!tmpdir_ptr)
+            tmpdir_ptr.reset(new QTemporaryDir);
+    }
+    QTemporaryDir &tmpdir = *tmpdir_ptr;
     if (!tmpdir.isValid())
         throw std::runtime_error(tmpdir.errorString().toStdString());
+    if (settings.use_cache)
+        WadCache::markTmpdir(tmpdir.path());
 
+    mapped_file out_buffer;
+    std::string out_path;
+    std::string out_name;
+    QString filter;
     switch (settings.patch_mode) {
         case PatcherSettings::patch_mode_t::ROM: {
-            std::string rom_path = tmpdir.filePath("gz.z64").toStdString();
-            std::string cmd;
-
-            cmd = gru + " lua/patch-rom.lua -s -o " + quote(rom_path) + " "
-                  + quote(settings.rom_path);
-
-            emit output(QString::fromStdString("executing: " + cmd + "\n"));
-            output_str.clear();
-            status = invoke_subprogram(cmd, "", output_to_str, output_to_log);
-            if (status != 0)
-                break;
-
-            std::string gz_rom_name = std::move(output_str);
-            while (!gz_rom_name.empty() && isspace(gz_rom_name.back()))
-                gz_rom_name.pop_back();
-
-            if (settings.opt_ucode) {
-                cmd = gru + " lua/inject_ucode.lua " + quote(rom_path) + " "
-                      + quote(settings.ucode_path);
-                emit output(QString::fromStdString("executing: " + cmd + "\n"));
-                status = invoke_subprogram(cmd, "", output_to_log,
-                                           output_to_log);
-                if (status != 0)
-                    break;
+#ifdef Q_OS_LINUX
+            try {
+                out_buffer = mapped_file::create_memory("gz.z64", 0);
+                out_path = out_buffer.path();
             }
-
-            QString save_name;
-            emit needSaveFileName(&save_name, "Save as...", gz_rom_name.c_str(),
-                                  "Nintendo 64 ROM (Big Endian) (*.z64)");
-            if (save_name.isEmpty()) {
-                status = 0;
-                break;
+            catch (const posix_exception &) {
             }
-
-            emit output("saving: " + save_name + "\n");
-            QFile rom_file(rom_path.c_str());
-            rom_file.rename(save_name);
-            if (rom_file.error() == QFile::RenameError) {
-              QFile::remove(save_name);
-              rom_file.rename(save_name);
-            }
-            if (rom_file.error() != QFile::NoError)
-              throw std::runtime_error(rom_file.errorString().toStdString());
-
+#endif
+            if (out_path.empty())
+                out_path = tmpdir.filePath("gz.z64").toStdString();
+            filter = "Nintendo 64 ROM (Big Endian) (*.z64)";
             break;
         }
         case PatcherSettings::patch_mode_t::WAD: {
-            std::string key_path = tmpdir.filePath("common-key.bin")
-                    .toStdString();
-            std::string extract_path = tmpdir.filePath("wadextract")
-                    .toStdString();
-            std::string wad_path = tmpdir.filePath("gz.wad").toStdString();
-            std::string cmd;
-
-            cmd = gzinject + " -a genkey -k " + quote(key_path);
-            emit output(QString::fromStdString("executing: " + cmd + "\n"));
-            status = invoke_subprogram(cmd, "45e", output_to_log,
-                                       output_to_log);
-            if (status != 0)
-                break;
-
-            cmd = gru + " lua/patch-wad.lua -s -k " + quote(key_path) + " -d "
-                  + quote(extract_path);
-            if (settings.wad_remap == PatcherSettings::wad_remap_t::RAPHNET)
-                cmd += " --raphnet";
-            else if (settings.wad_remap == PatcherSettings::wad_remap_t::NONE)
-                cmd += " --disable-controller-remappings";
-            if (!settings.channel_id.empty())
-                cmd += " -i " + quote(settings.channel_id);
-            if (!settings.channel_title.empty())
-                cmd += " -t " + quote(settings.channel_title);
-            cmd += " -r " + std::to_string(settings.wad_region);
-            if (settings.opt_extrom)
-                cmd += " -m " + quote(settings.extrom_path);
-            cmd += " -o " + quote(wad_path) + " " + quote(settings.wad_path);
-
-            emit output(QString::fromStdString("executing: " + cmd + "\n"));
-            output_str.clear();
-            status = invoke_subprogram(cmd, "", output_to_str, output_to_log);
-            if (status != 0)
-                break;
+            out_path = tmpdir.filePath("gz.wad").toStdString();
+            filter = "Nintendo Wii WAD (*.wad)";
+            break;
+        }
+    }
 
-            std::string gz_wad_name = std::move(output_str);
-            while (!gz_wad_name.empty() && isspace(gz_wad_name.back()))
-                gz_wad_name.pop_back();
+    ResultCache cache;
+    QByteArray cache_key;
+    bool cache_hit = false;
+    if (settings.use_cache) {
+        trace_scope trace("cache fetch", "patcher");
+        cache_key = ResultCache::key(settings);
+        cache_hit = cache.fetch(cache_key, QString::fromStdString(out_path),
+                                &out_name);
+    }
 
-            QString save_name;
-            emit needSaveFileName(&save_name, "Save as...", gz_wad_name.c_str(),
-                                  "Nintendo Wii WAD (*.wad)");
-            if (save_name.isEmpty()) {
-                status = 0;
+    if (cache_hit)
+        write_output("using cached result\n");
+    else {
+        int status = 0;
+        switch (settings.patch_mode) {
+            case PatcherSettings::patch_mode_t::ROM: {
+                status = patch_rom(tmpdir, out_path, &out_name);
                 break;
             }
-
-            emit output("saving: " + save_name + "\n");
-            QFile wad_file(wad_path.c_str());
-            wad_file.rename(save_name);
-            if (wad_file.error() == QFile::RenameError) {
-              QFile::remove(save_name);
-              wad_file.rename(save_name);
+            case PatcherSettings::patch_mode_t::WAD: {
+                status = patch_wad(tmpdir, out_path, &out_name);
+                break;
             }
-            if (wad_file.error() != QFile::NoError)
-              throw std::runtime_error(wad_file.errorString().toStdString());
+        }
+        if (status != 0)
+            return status;
 
-            break;
+        while (!out_name.empty() && isspace(out_name.back()))
+            out_name.pop_back();
+
+        if (!cache_key.isEmpty()) {
+            trace_scope trace("cache insert", "patcher");
+            cache.insert(cache_key, QString::fromStdString(out_path),
+                         out_name);
         }
     }
 
-    return status;
+    output_name = out_name;
+    QString save_name = QString::fromStdString(settings.output_path);
+    if (save_name.isEmpty()) {
+        trace_scope trace("save dialog", "patcher");
+        emit needSaveFileName(&save_name, "Save as...", out_name.c_str(),
+                              filter);
+        if (save_name.isEmpty())
+            return 0;
+    }
+
+    if (cancelled) {
+        throw subprocess_aborted(subprocess_aborted::reason_t::CANCELLED,
+                                 "cancelled");
+    }
+    write_output(("saving: " + save_name + "\n").toStdString());
+    {
+        trace_scope trace("publish", "patcher");
+        publish_file(out_path, save_name.toStdString());
+    }
+
+    return 0;
 }
 
 void Patcher::run()
 {
+    trace_scope trace("patch", "patcher",
+                      trace_enabled() ? trace_arg("output",
+                                                  settings.output_path)
+                                      : std::string());
     try {
         result = patch();
     }
     catch (...) {
         eptr = std::current_exception();
     }
+    flush_output();
 }
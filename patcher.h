@@ -1,10 +1,19 @@
 #ifndef PATCHER_H
 #define PATCHER_H
+#include <atomic>
+#include <condition_variable>
 #include <string>
 #include <exception>
+#include <memory>
+#include <mutex>
+#include <vector>
 #include <QFileDialog>
+#include <QTemporaryDir>
 #include <QThread>
 
+class mapped_file;
+class Wad;
+
 class PatcherSettings
 {
 public:
@@ -42,6 +51,39 @@ public:
     std::string channel_id;
     std::string channel_title;
     enum wad_region_t wad_region = wad_region_t::FREE;
+
+    std::string output_path;
+    bool use_cache = true;
+    bool use_worker = true;
+    bool use_native = true;
+    int stage_timeout = 0; /* seconds per subprocess, 0 for no limit */
+};
+
+/* the patched contents of a wad that several jobs pack in different
+   regions. the first job to claim it builds it and the others wait for
+   it, see Patcher::patch_wad */
+class WadStage
+{
+public:
+    WadStage();
+    ~WadStage();
+
+    bool claim();
+    /* a null wad if it couldn't be built */
+    void finish(std::unique_ptr<Wad> wad, const std::string &name);
+    /* false if cancelled first */
+    bool wait(const std::atomic<bool> &cancelled);
+
+    const Wad *wad() const;
+    std::string name() const;
+
+private:
+    mutable std::mutex mutex;
+    std::condition_variable cond;
+    bool claimed = false;
+    bool finished = false;
+    std::unique_ptr<Wad> m_wad;
+    std::string m_name;
 };
 
 class Patcher : public QThread
@@ -49,11 +91,16 @@ class Patcher : public QThread
     Q_OBJECT
 
 public:
-    Patcher(const PatcherSettings &settings, QWidget *parent = nullptr);
+    Patcher(const PatcherSettings &settings, QObject *parent = nullptr);
 
     int getResult();
     void run() override;
 
+    void cancel();
+    bool isCancelled() const;
+    std::string outputName() const;
+    void setWadStage(std::shared_ptr<WadStage> stage);
+
 signals:
     void output(const QString &);
     void needSaveFileName(QString *result,
@@ -64,11 +111,47 @@ signals:
                           QFileDialog::Option options =
                               static_cast<QFileDialog::Option>(0));
 
+private slots:
+    void deliver_output();
+
 private:
     PatcherSettings settings;
     std::exception_ptr eptr;
     int result;
+    std::atomic<bool> cancelled{false};
+    std::string output_name;
+    std::shared_ptr<WadStage> wad_stage;
+
+    std::mutex output_mutex;
+    std::condition_variable output_cond;
+    std::string output_pending;
+    bool output_queued = false;
+    bool output_final = false;
 
+    void write_output(const char *data, size_t size);
+    void write_output(const std::string &str);
+    void flush_output();
+    std::vector<std::string> environment();
+    int execute(const std::vector<std::string> &args,
+                const std::string &input, std::string *output_str);
+    int common_key(std::string *key_path);
+    std::string normalize_rom(const QTemporaryDir &tmpdir,
+                              const std::string &path, const char *name,
+                              mapped_file *buffer);
+    void finish_rom(const std::string &rom_path);
+    bool patch_rom_native(const std::string &in_rom_path,
+                          const std::string &rom_path,
+                          std::string *gz_rom_name);
+    int patch_rom(const QTemporaryDir &tmpdir, const std::string &rom_path,
+                  std::string *gz_rom_name);
+    int run_patch_wad(const std::string &extract_path,
+                      const std::string &key_path,
+                      const std::string &wad_path, std::string *gz_wad_name);
+    int stage_wad(const QTemporaryDir &tmpdir, const std::string &key_path,
+                  const std::string &wad_path, std::string *gz_wad_name);
+    void pack_staged(const std::string &wad_path);
+    int patch_wad(const QTemporaryDir &tmpdir, const std::string &wad_path,
+                  std::string *gz_wad_name);
     int patch();
 };
 
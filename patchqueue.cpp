@@ -0,0 +1,289 @@
+#include <exception>
+#include <memory>
+#include <QDir>
+#include <QFileInfo>
+#include "patchqueue.h"
+
+PatchQueue::PatchQueue(QObject *parent)
+    : QObject(parent)
+    , max_workers(QThread::idealThreadCount())
+    , next_job(0)
+    , n_finished(0)
+    , bytes_finished(0)
+    , batch_elapsed_ms(0)
+{
+    if (max_workers < 1)
+        max_workers = 1;
+}
+
+PatchQueue::~PatchQueue()
+{
+    for (auto &w : workers)
+        w.patcher->wait();
+}
+
+std::vector<PatcherSettings> PatchQueue::wadVariants(
+    const PatcherSettings &settings, const QString &dir,
+    const std::vector<PatcherSettings::wad_region_t> &regions,
+    const std::vector<PatcherSettings::wad_remap_t> &remaps)
+{
+    static const char *region_names[] = {"jap", "usa", "eur", "free"};
+    static const char *remap_names[] = {"default", "raphnet", "none"};
+
+    QString base = QFileInfo(QString::fromStdString(settings.wad_path))
+                   .completeBaseName();
+    std::vector<PatcherSettings> variants;
+    for (auto region : regions) {
+        for (auto remap : remaps) {
+            PatcherSettings variant = settings;
+            variant.patch_mode = PatcherSettings::patch_mode_t::WAD;
+            variant.wad_region = region;
+            variant.wad_remap = remap;
+            variant.output_path = QDir(dir).filePath(
+                QString("%1-%2-%3.wad").arg(base, region_names[region],
+                                            remap_names[remap]))
+                                  .toStdString();
+            variants.push_back(variant);
+        }
+    }
+    return variants;
+}
+
+/* jobs that only differ in their region and output patch the same contents,
+   and can share one run of patch-wad.lua. a channel title makes the shim
+   hand the pack to gzinject, which leaves nothing to share */
+static bool can_stage(const PatcherSettings &settings)
+{
+    return settings.patch_mode == PatcherSettings::patch_mode_t::WAD
+           && settings.use_native && settings.channel_title.empty();
+}
+
+static bool same_stage(const PatcherSettings &a, const PatcherSettings &b)
+{
+    return can_stage(a) && can_stage(b)
+           && a.wad_path == b.wad_path
+           && a.opt_extrom == b.opt_extrom
+           && (!a.opt_extrom || a.extrom_path == b.extrom_path)
+           && a.wad_remap == b.wad_remap
+           && a.channel_id == b.channel_id;
+}
+
+int PatchQueue::addJob(const PatcherSettings &settings)
+{
+    PatchJob job;
+    job.settings = settings;
+    jobs.push_back(std::move(job));
+    return static_cast<int>(jobs.size()) - 1;
+}
+
+void PatchQueue::clear()
+{
+    if (isRunning())
+        return;
+    jobs.clear();
+    job_stages.clear();
+    next_job = 0;
+    n_finished = 0;
+    bytes_finished = 0;
+    batch_elapsed_ms = 0;
+}
+
+int PatchQueue::jobCount() const
+{
+    return static_cast<int>(jobs.size());
+}
+
+const PatchJob &PatchQueue::job(int index) const
+{
+    return jobs.at(static_cast<size_t>(index));
+}
+
+int PatchQueue::maxWorkers() const
+{
+    return max_workers;
+}
+
+void PatchQueue::setMaxWorkers(int max_workers)
+{
+    this->max_workers = max_workers < 1 ? 1 : max_workers;
+    if (isRunning())
+        schedule();
+}
+
+bool PatchQueue::isRunning() const
+{
+    return !workers.empty();
+}
+
+int PatchQueue::finishedCount() const
+{
+    return n_finished;
+}
+
+double PatchQueue::jobsPerSecond() const
+{
+    qint64 elapsed = isRunning() ? batch_timer.elapsed() : batch_elapsed_ms;
+    if (elapsed <= 0)
+        return 0.;
+    return n_finished * 1000. / elapsed;
+}
+
+double PatchQueue::bytesPerSecond() const
+{
+    qint64 elapsed = isRunning() ? batch_timer.elapsed() : batch_elapsed_ms;
+    if (elapsed <= 0)
+        return 0.;
+    return bytes_finished * 1000. / elapsed;
+}
+
+void PatchQueue::start()
+{
+    if (isRunning())
+        return;
+
+    /* requeue anything left over from a previous run */
+    for (auto &job : jobs) {
+        if (job.status != PatchJob::status_t::DONE) {
+            job.status = PatchJob::status_t::PENDING;
+            job.result = 0;
+            job.error.clear();
+            job.log.clear();
+        }
+    }
+
+    /* give each group of jobs that can share a patch its own stage, and
+       leave the rest to patch on their own */
+    job_stages.assign(jobs.size(), nullptr);
+    for (size_t i = 0; i < jobs.size(); i++) {
+        const PatchJob &job = jobs[i];
+        if (job.status != PatchJob::status_t::PENDING
+            || !can_stage(job.settings))
+        {
+            continue;
+        }
+        for (size_t j = 0; j < i && !job_stages[i]; j++) {
+            if (job_stages[j] && same_stage(job.settings, jobs[j].settings))
+                job_stages[i] = job_stages[j];
+        }
+        if (!job_stages[i])
+            job_stages[i] = std::make_shared<WadStage>();
+    }
+    for (auto &stage : job_stages) {
+        if (stage && stage.use_count() == 1)
+            stage.reset();
+    }
+
+    next_job = 0;
+    n_finished = 0;
+    bytes_finished = 0;
+    batch_elapsed_ms = 0;
+    batch_timer.start();
+
+    schedule();
+    if (!isRunning())
+        emit finished();
+}
+
+void PatchQueue::cancel()
+{
+    for (int i = 0; i < jobCount(); i++)
+        cancelJob(i);
+}
+
+void PatchQueue::cancelJob(int index)
+{
+    auto &job = jobs.at(static_cast<size_t>(index));
+    if (job.status == PatchJob::status_t::PENDING) {
+        job.status = PatchJob::status_t::CANCELLED;
+        emit jobFinished(index);
+    }
+    else if (job.status == PatchJob::status_t::RUNNING) {
+        /* the slot is handed to the next job once the patcher has
+           unwound, see retire() */
+        for (auto &w : workers) {
+            if (w.job_index == index)
+                w.patcher->cancel();
+        }
+    }
+}
+
+void PatchQueue::schedule()
+{
+    while (static_cast<int>(workers.size()) < max_workers
+           && next_job < jobs.size())
+    {
+        int index = static_cast<int>(next_job++);
+        auto &job = jobs[static_cast<size_t>(index)];
+        if (job.status != PatchJob::status_t::PENDING)
+            continue;
+
+        Patcher *patcher = new Patcher(job.settings, this);
+        /* jobs added since start() don't get a stage */
+        if (static_cast<size_t>(index) < job_stages.size())
+            patcher->setWadStage(job_stages[static_cast<size_t>(index)]);
+        worker w;
+        w.job_index = index;
+        w.patcher = patcher;
+        w.timer.start();
+
+        connect(patcher, &Patcher::output, this,
+            [this, index](const QString &output)
+            {
+                jobs[static_cast<size_t>(index)].log.append(output);
+                emit jobOutput(index, output);
+            });
+        connect(patcher, &Patcher::finished, this,
+            [this, patcher]()
+            {
+                retire(patcher);
+            });
+
+        job.status = PatchJob::status_t::RUNNING;
+        workers.push_back(w);
+        patcher->start();
+        emit jobStarted(index);
+    }
+}
+
+void PatchQueue::retire(Patcher *patcher)
+{
+    auto it = workers.begin();
+    while (it != workers.end() && it->patcher != patcher)
+        ++it;
+    if (it == workers.end())
+        return;
+
+    int index = it->job_index;
+    auto &job = jobs[static_cast<size_t>(index)];
+    job.elapsed_ms = it->timer.elapsed();
+    workers.erase(it);
+
+    try {
+        job.result = patcher->getResult();
+        job.status = job.result == 0 ? PatchJob::status_t::DONE
+                                     : PatchJob::status_t::FAILED;
+    }
+    catch (const std::exception &e) {
+        job.result = -1;
+        job.error = e.what();
+        job.status = patcher->isCancelled() ? PatchJob::status_t::CANCELLED
+                                            : PatchJob::status_t::FAILED;
+    }
+    patcher->deleteLater();
+
+    if (job.status == PatchJob::status_t::DONE) {
+        job.output_size = QFileInfo(QString::fromStdString(job.settings
+                                                           .output_path))
+                          .size();
+        bytes_finished += job.output_size;
+    }
+    n_finished++;
+    emit jobFinished(index);
+
+    schedule();
+    if (!isRunning()) {
+        batch_elapsed_ms = batch_timer.elapsed();
+        job_stages.clear();
+        emit finished();
+    }
+}
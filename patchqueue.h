@@ -0,0 +1,90 @@
+#ifndef PATCHQUEUE_H
+#define PATCHQUEUE_H
+#include <memory>
+#include <string>
+#include <vector>
+#include <QElapsedTimer>
+#include <QObject>
+#include "patcher.h"
+
+class PatchJob
+{
+public:
+    enum status_t
+    {
+        PENDING,
+        RUNNING,
+        DONE,
+        FAILED,
+        CANCELLED,
+    };
+
+    PatcherSettings settings;
+    status_t status = status_t::PENDING;
+    int result = 0;
+    std::string error;
+    QString log;
+    qint64 output_size = 0;
+    qint64 elapsed_ms = 0;
+};
+
+class PatchQueue : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit PatchQueue(QObject *parent = nullptr);
+    ~PatchQueue() override;
+
+    static std::vector<PatcherSettings> wadVariants(
+        const PatcherSettings &settings, const QString &dir,
+        const std::vector<PatcherSettings::wad_region_t> &regions,
+        const std::vector<PatcherSettings::wad_remap_t> &remaps);
+
+    int addJob(const PatcherSettings &settings);
+    void clear();
+    int jobCount() const;
+    const PatchJob &job(int index) const;
+
+    int maxWorkers() const;
+    void setMaxWorkers(int max_workers);
+
+    bool isRunning() const;
+    int finishedCount() const;
+    double jobsPerSecond() const;
+    double bytesPerSecond() const;
+
+public slots:
+    void start();
+    void cancel();
+    void cancelJob(int index);
+
+signals:
+    void jobStarted(int index);
+    void jobOutput(int index, const QString &output);
+    void jobFinished(int index);
+    void finished();
+
+private:
+    struct worker
+    {
+        int job_index;
+        Patcher *patcher;
+        QElapsedTimer timer;
+    };
+
+    std::vector<PatchJob> jobs;
+    std::vector<worker> workers;
+    std::vector<std::shared_ptr<WadStage>> job_stages;
+    int max_workers;
+    size_t next_job;
+    int n_finished;
+    qint64 bytes_finished;
+    QElapsedTimer batch_timer;
+    qint64 batch_elapsed_ms;
+
+    void schedule();
+    void retire(Patcher *patcher);
+};
+
+#endif
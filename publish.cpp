@@ -0,0 +1,257 @@
+#include <atomic>
+#include <cerrno>
+#include <vector>
+#include "publish.h"
+#include "sysutil.h"
+
+#ifdef Q_OS_WIN
+# include <windows.h>
+#else
+# include <cstdio>
+# include <cstdlib>
+# include <fcntl.h>
+# include <sys/stat.h>
+# include <unistd.h>
+# ifdef Q_OS_LINUX
+#  include <sys/ioctl.h>
+#  include <sys/sendfile.h>
+#  include <linux/fs.h>
+# endif
+# ifdef Q_OS_DARWIN
+#  include <copyfile.h>
+#  include <sys/clonefile.h>
+# endif
+#endif
+
+static std::string staging_path(const std::string &dest_path)
+{
+    static std::atomic<unsigned> counter(0);
+#ifdef Q_OS_WIN
+    unsigned long pid = GetCurrentProcessId();
+#else
+    unsigned long pid = static_cast<unsigned long>(getpid());
+#endif
+    return dest_path + ".tmp" + std::to_string(pid) + "."
+           + std::to_string(counter++);
+}
+
+#ifndef Q_OS_WIN
+static std::string dir_name(const std::string &path)
+{
+    auto pos = path.find_last_of('/');
+    if (pos == std::string::npos)
+        return ".";
+    if (pos == 0)
+        return "/";
+    return path.substr(0, pos);
+}
+
+static void copy_fd(int src_fd, int dest_fd, off_t size)
+{
+#ifdef Q_OS_LINUX
+# ifdef FICLONE
+    if (ioctl(dest_fd, FICLONE, src_fd) == 0)
+        return;
+# endif
+# if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 27)
+    off_t copied = 0;
+    while (copied < size) {
+        ssize_t n = copy_file_range(src_fd, nullptr, dest_fd, nullptr,
+                                    static_cast<size_t>(size - copied), 0);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EXDEV || errno == EINVAL || errno == ENOSYS
+                || errno == EOPNOTSUPP)
+            {
+                break;
+            }
+            throw posix_exception(errno, "copy_file_range");
+        }
+        if (n == 0)
+            return;
+        copied += n;
+    }
+    if (copied >= size)
+        return;
+# endif
+    for (;;) {
+        ssize_t n = sendfile(dest_fd, src_fd, nullptr, 1 << 30);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EINVAL || errno == ENOSYS)
+                break;
+            throw posix_exception(errno, "sendfile");
+        }
+        if (n == 0)
+            return;
+    }
+#else
+    (void)size;
+#endif
+#ifdef Q_OS_DARWIN
+    if (fcopyfile(src_fd, dest_fd, nullptr, COPYFILE_DATA) == 0)
+        return;
+#endif
+
+    std::vector<char> buf(1 << 20);
+    for (;;) {
+        ssize_t n = read(src_fd, buf.data(), buf.size());
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            throw posix_exception(errno, "read");
+        }
+        if (n == 0)
+            break;
+        for (ssize_t done = 0; done < n; ) {
+            ssize_t m = write(dest_fd, buf.data() + done,
+                              static_cast<size_t>(n - done));
+            if (m == -1) {
+                if (errno == EINTR)
+                    continue;
+                throw posix_exception(errno, "write");
+            }
+            done += m;
+        }
+    }
+}
+
+static unique_fileno open_source(const std::string &src_path,
+                                 struct stat *statbuf)
+{
+    unique_fileno src_fd(open(src_path.c_str(), O_RDONLY | O_CLOEXEC));
+    if (!src_fd)
+        throw posix_exception(errno, "open");
+    TRY_POSIX(fstat, src_fd.get(), statbuf)
+    return src_fd;
+}
+
+#ifdef O_TMPFILE
+static bool stage_anonymous(int src_fd, const struct stat &statbuf,
+                            const std::string &dest_path,
+                            std::string *tmp_path)
+{
+    unique_fileno tmp_fd(open(dir_name(dest_path).c_str(),
+                              O_TMPFILE | O_WRONLY | O_CLOEXEC,
+                              statbuf.st_mode & 0666));
+    if (!tmp_fd)
+        return false;
+    copy_fd(src_fd, tmp_fd.get(), statbuf.st_size);
+    TRY_POSIX(fsync, tmp_fd.get())
+
+    std::string fd_path = "/proc/self/fd/" + std::to_string(tmp_fd.get());
+    for (;;) {
+        *tmp_path = staging_path(dest_path);
+        if (linkat(AT_FDCWD, fd_path.c_str(), AT_FDCWD, tmp_path->c_str(),
+                   AT_SYMLINK_FOLLOW) == 0)
+        {
+            return true;
+        }
+        if (errno != EEXIST) {
+            tmp_path->clear();
+            if (lseek(src_fd, 0, SEEK_SET) == -1)
+                throw posix_exception(errno, "lseek");
+            return false;
+        }
+    }
+}
+#endif
+
+static void stage_named(int src_fd, const struct stat &statbuf,
+                        const std::string &dest_path, std::string *tmp_path)
+{
+    std::string tmp_template = dest_path + ".XXXXXX";
+    unique_fileno tmp_fd(mkstemp(&tmp_template[0]));
+    if (!tmp_fd)
+        throw posix_exception(errno, "mkstemp");
+    *tmp_path = tmp_template;
+    try {
+        fcntl(tmp_fd.get(), F_SETFD, FD_CLOEXEC);
+        TRY_POSIX(fchmod, tmp_fd.get(), statbuf.st_mode & 0666)
+        copy_fd(src_fd, tmp_fd.get(), statbuf.st_size);
+        TRY_POSIX(fsync, tmp_fd.get())
+    }
+    catch (...) {
+        unlink(tmp_path->c_str());
+        throw;
+    }
+}
+#endif
+
+void copy_file(const std::string &src_path, const std::string &dest_path)
+{
+#ifdef Q_OS_WIN
+    TRY_WINAPI(CopyFileW, wide_path(src_path).c_str(),
+               wide_path(dest_path).c_str(), FALSE)
+#else
+#ifdef Q_OS_DARWIN
+    /* only works when dest_path doesn't exist yet, copy_fd can't clone */
+    if (clonefile(src_path.c_str(), dest_path.c_str(), 0) == 0)
+        return;
+#endif
+    struct stat statbuf;
+    unique_fileno src_fd = open_source(src_path, &statbuf);
+    unique_fileno dest_fd(open(dest_path.c_str(),
+                               O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                               statbuf.st_mode & 0666));
+    if (!dest_fd)
+        throw posix_exception(errno, "open");
+    try {
+        copy_fd(src_fd.get(), dest_fd.get(), statbuf.st_size);
+    }
+    catch (...) {
+        dest_fd.reset();
+        unlink(dest_path.c_str());
+        throw;
+    }
+#endif
+}
+
+void publish_file(const std::string &src_path, const std::string &dest_path)
+{
+#ifdef Q_OS_WIN
+    std::wstring src_wpath = wide_path(src_path);
+    std::wstring dest_wpath = wide_path(dest_path);
+    if (MoveFileExW(src_wpath.c_str(), dest_wpath.c_str(),
+                    MOVEFILE_REPLACE_EXISTING))
+    {
+        return;
+    }
+    DWORD dwError = GetLastError();
+    if (dwError != ERROR_NOT_SAME_DEVICE)
+        throw winapi_exception(dwError, "MoveFileExW");
+
+    std::wstring tmp_wpath = wide_path(staging_path(dest_path));
+    TRY_WINAPI(CopyFileW, src_wpath.c_str(), tmp_wpath.c_str(), TRUE)
+    if (!MoveFileExW(tmp_wpath.c_str(), dest_wpath.c_str(),
+                     MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+    {
+        dwError = GetLastError();
+        DeleteFileW(tmp_wpath.c_str());
+        throw winapi_exception(dwError, "MoveFileExW");
+    }
+    DeleteFileW(src_wpath.c_str());
+#else
+    if (rename(src_path.c_str(), dest_path.c_str()) == 0)
+        return;
+    if (errno != EXDEV)
+        throw posix_exception(errno, "rename");
+
+    struct stat statbuf;
+    unique_fileno src_fd = open_source(src_path, &statbuf);
+    std::string tmp_path;
+#ifdef O_TMPFILE
+    if (!stage_anonymous(src_fd.get(), statbuf, dest_path, &tmp_path))
+#endif
+        stage_named(src_fd.get(), statbuf, dest_path, &tmp_path);
+
+    if (rename(tmp_path.c_str(), dest_path.c_str()) == -1) {
+        int e = errno;
+        unlink(tmp_path.c_str());
+        throw posix_exception(e, "rename");
+    }
+    unlink(src_path.c_str());
+#endif
+}
@@ -0,0 +1,8 @@
+#ifndef PUBLISH_H
+#define PUBLISH_H
+#include <string>
+
+void copy_file(const std::string &src_path, const std::string &dest_path);
+void publish_file(const std::string &src_path, const std::string &dest_path);
+
+#endif
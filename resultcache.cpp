@@ -0,0 +1,194 @@
+#include <algorithm>
+#include <stdexcept>
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QLockFile>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QStringList>
+#include "manifest.h"
+#include "publish.h"
+#include "resultcache.h"
+
+static void hash_field(QCryptographicHash &hash, const char *name,
+                       const std::string &value)
+{
+    hash.addData(QByteArray(name) + "="
+                 + QByteArray::number(static_cast<qulonglong>(value.size()))
+                 + ":");
+    hash.addData(QByteArray(value.data(), static_cast<int>(value.size())));
+}
+
+static void hash_file(QCryptographicHash &hash, const QString &path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly) || !hash.addData(&file)) {
+        throw std::runtime_error(path.toStdString() + ": "
+                                 + file.errorString().toStdString());
+    }
+}
+
+static QByteArray compute_asset_digest()
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    for (auto dir : {"lua", "ups", "gzi"}) {
+        QStringList files;
+        QDirIterator it(dir, QDir::Files, QDirIterator::Subdirectories);
+        while (it.hasNext())
+            files.append(it.next());
+        std::sort(files.begin(), files.end());
+        for (auto &file : files) {
+            hash_field(hash, "asset", file.toStdString());
+            hash_file(hash, file);
+        }
+    }
+    return hash.result();
+}
+
+ResultCache::ResultCache(const QString &path, qint64 max_size)
+    : path(path)
+    , max_size(max_size)
+{
+    if (this->path.isEmpty()) {
+        this->path = QStandardPaths::
+            writableLocation(QStandardPaths::CacheLocation) + "/results";
+    }
+}
+
+QByteArray ResultCache::assetDigest()
+{
+    /* a verified manifest holds the hash of every asset, so its own hash
+       covers them all without reading them again */
+    QByteArray digest = ManifestCheck::verifiedDigest();
+    if (!digest.isEmpty())
+        return digest;
+    static const QByteArray fallback = compute_asset_digest();
+    return fallback;
+}
+
+QByteArray ResultCache::key(const PatcherSettings &settings)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(assetDigest());
+    hash_field(hash, "patch_mode", std::to_string(settings.patch_mode));
+    hash_field(hash, "use_native", std::to_string(settings.use_native));
+
+    switch (settings.patch_mode) {
+        case PatcherSettings::patch_mode_t::ROM: {
+            hash_file(hash, QString::fromStdString(settings.rom_path));
+            hash_field(hash, "opt_ucode", std::to_string(settings.opt_ucode));
+            if (settings.opt_ucode)
+                hash_file(hash, QString::fromStdString(settings.ucode_path));
+            break;
+        }
+        case PatcherSettings::patch_mode_t::WAD: {
+            hash_file(hash, QString::fromStdString(settings.wad_path));
+            hash_field(hash, "opt_extrom",
+                       std::to_string(settings.opt_extrom));
+            if (settings.opt_extrom)
+                hash_file(hash, QString::fromStdString(settings.extrom_path));
+            hash_field(hash, "wad_remap", std::to_string(settings.wad_remap));
+            hash_field(hash, "channel_id", settings.channel_id);
+            hash_field(hash, "channel_title", settings.channel_title);
+            hash_field(hash, "wad_region",
+                       std::to_string(settings.wad_region));
+            break;
+        }
+    }
+
+    return hash.result();
+}
+
+bool ResultCache::fetch(const QByteArray &key, const QString &dest_path,
+                        std::string *name)
+{
+    if (!QDir().mkpath(path))
+        return false;
+    QLockFile lock(path + "/lock");
+    if (!lock.lock())
+        return false;
+
+    QString out_path = entry_path(key, ".out");
+    QFile name_file(entry_path(key, ".name"));
+    if (!QFile::exists(out_path) || !name_file.open(QIODevice::ReadOnly))
+        return false;
+    *name = name_file.readAll().toStdString();
+
+    try {
+        copy_file(out_path.toStdString(), dest_path.toStdString());
+    }
+    catch (const std::exception &) {
+        return false;
+    }
+
+    QFile out_file(out_path);
+    if (out_file.open(QIODevice::Append)) {
+        out_file.setFileTime(QDateTime::currentDateTimeUtc(),
+                             QFileDevice::FileModificationTime);
+    }
+    return true;
+}
+
+void ResultCache::insert(const QByteArray &key, const QString &src_path,
+                         const std::string &name)
+{
+    if (!QDir().mkpath(path))
+        return;
+    QLockFile lock(path + "/lock");
+    if (!lock.lock())
+        return;
+
+    QString tmp_path = entry_path(key, ".tmp");
+    QString out_path = entry_path(key, ".out");
+    try {
+        copy_file(src_path.toStdString(), tmp_path.toStdString());
+    }
+    catch (const std::exception &) {
+        return;
+    }
+
+    QSaveFile name_file(entry_path(key, ".name"));
+    if (!name_file.open(QIODevice::WriteOnly)
+        || name_file.write(name.data(), static_cast<qint64>(name.size()))
+           != static_cast<qint64>(name.size())
+        || !name_file.commit())
+    {
+        QFile::remove(tmp_path);
+        return;
+    }
+
+    try {
+        publish_file(tmp_path.toStdString(), out_path.toStdString());
+    }
+    catch (const std::exception &) {
+        QFile::remove(tmp_path);
+        return;
+    }
+
+    evict();
+}
+
+QString ResultCache::entry_path(const QByteArray &key, const char *suffix)
+{
+    return path + "/" + QString::fromLatin1(key.toHex()) + suffix;
+}
+
+void ResultCache::evict()
+{
+    QFileInfoList entries = QDir(path).entryInfoList({"*.out"}, QDir::Files,
+                                                     QDir::Time);
+    qint64 size = 0;
+    for (auto &entry : entries) {
+        size += entry.size();
+        if (size > max_size) {
+            QString base = entry.absoluteFilePath();
+            base.chop(4);
+            QFile::remove(base + ".out");
+            QFile::remove(base + ".name");
+        }
+    }
+}
@@ -0,0 +1,30 @@
+#ifndef RESULTCACHE_H
+#define RESULTCACHE_H
+#include <string>
+#include <QByteArray>
+#include <QString>
+#include "patcher.h"
+
+class ResultCache
+{
+public:
+    explicit ResultCache(const QString &path = QString(),
+                         qint64 max_size = 2048LL * 1024 * 1024);
+
+    static QByteArray assetDigest();
+    static QByteArray key(const PatcherSettings &settings);
+
+    bool fetch(const QByteArray &key, const QString &dest_path,
+               std::string *name);
+    void insert(const QByteArray &key, const QString &src_path,
+                const std::string &name);
+
+private:
+    QString path;
+    qint64 max_size;
+
+    QString entry_path(const QByteArray &key, const char *suffix);
+    void evict();
+};
+
+#endif
@@ -0,0 +1,402 @@
+#include <cstdint>
+#include <cstring>
+#include "crc32.h"
+#include "romformat.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define ROMFORMAT_SIMD
+# include <immintrin.h>
+#endif
+
+RomFormat::format_t RomFormat::detect(const void *header, size_t size)
+{
+    static const unsigned char z64_magic[] = {0x80, 0x37, 0x12, 0x40};
+    static const unsigned char v64_magic[] = {0x37, 0x80, 0x40, 0x12};
+    static const unsigned char n64_magic[] = {0x40, 0x12, 0x37, 0x80};
+
+    if (size < 4)
+        return format_t::UNKNOWN;
+    if (memcmp(header, z64_magic, 4) == 0)
+        return format_t::Z64;
+    if (memcmp(header, v64_magic, 4) == 0)
+        return format_t::V64;
+    if (memcmp(header, n64_magic, 4) == 0)
+        return format_t::N64;
+    return format_t::UNKNOWN;
+}
+
+static void swap16_scalar(unsigned char *p, size_t size)
+{
+    for (size_t i = 0; i + 2 <= size; i += 2) {
+        uint16_t h;
+        memcpy(&h, p + i, 2);
+        h = static_cast<uint16_t>((h >> 8) | (h << 8));
+        memcpy(p + i, &h, 2);
+    }
+}
+
+static void swap32_scalar(unsigned char *p, size_t size)
+{
+    for (size_t i = 0; i + 4 <= size; i += 4) {
+        uint32_t w;
+        memcpy(&w, p + i, 4);
+        w = (w >> 24) | ((w >> 8) & 0xFF00) | ((w << 8) & 0xFF0000)
+            | (w << 24);
+        memcpy(p + i, &w, 4);
+    }
+}
+
+#ifdef ROMFORMAT_SIMD
+__attribute__((target("sse2")))
+static size_t swap16_sse2(unsigned char *p, size_t size)
+{
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        auto q = reinterpret_cast<__m128i *>(p + i);
+        __m128i v = _mm_loadu_si128(q);
+        v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        _mm_storeu_si128(q, v);
+    }
+    return i;
+}
+
+__attribute__((target("sse2")))
+static size_t swap32_sse2(unsigned char *p, size_t size)
+{
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        auto q = reinterpret_cast<__m128i *>(p + i);
+        __m128i v = _mm_loadu_si128(q);
+        v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+        v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+        _mm_storeu_si128(q, v);
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+static size_t shuffle_avx2(unsigned char *p, size_t size, __m256i mask)
+{
+    size_t i = 0;
+    for (; i + 64 <= size; i += 64) {
+        auto q0 = reinterpret_cast<__m256i *>(p + i);
+        auto q1 = reinterpret_cast<__m256i *>(p + i + 32);
+        __m256i v0 = _mm256_loadu_si256(q0);
+        __m256i v1 = _mm256_loadu_si256(q1);
+        _mm256_storeu_si256(q0, _mm256_shuffle_epi8(v0, mask));
+        _mm256_storeu_si256(q1, _mm256_shuffle_epi8(v1, mask));
+    }
+    for (; i + 32 <= size; i += 32) {
+        auto q = reinterpret_cast<__m256i *>(p + i);
+        _mm256_storeu_si256(q, _mm256_shuffle_epi8(_mm256_loadu_si256(q),
+                                                   mask));
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+static size_t swap16_avx2(unsigned char *p, size_t size)
+{
+    return shuffle_avx2(p, size,
+                        _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6,
+                                         9, 8, 11, 10, 13, 12, 15, 14,
+                                         1, 0, 3, 2, 5, 4, 7, 6,
+                                         9, 8, 11, 10, 13, 12, 15, 14));
+}
+
+__attribute__((target("avx2")))
+static size_t swap32_avx2(unsigned char *p, size_t size)
+{
+    return shuffle_avx2(p, size,
+                        _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4,
+                                         11, 10, 9, 8, 15, 14, 13, 12,
+                                         3, 2, 1, 0, 7, 6, 5, 4,
+                                         11, 10, 9, 8, 15, 14, 13, 12));
+}
+#endif
+
+bool RomFormat::kernelSupported(kernel_t kernel)
+{
+    switch (kernel) {
+        case kernel_t::AUTO:
+        case kernel_t::SCALAR:
+            return true;
+#ifdef ROMFORMAT_SIMD
+        case kernel_t::SSE2:
+            return __builtin_cpu_supports("sse2");
+        case kernel_t::AVX2:
+            return __builtin_cpu_supports("avx2");
+#endif
+        default:
+            return false;
+    }
+}
+
+void RomFormat::normalize(void *data, size_t size, format_t format,
+                          kernel_t kernel)
+{
+    auto p = static_cast<unsigned char *>(data);
+    size_t done = 0;
+
+    if (format != format_t::V64 && format != format_t::N64)
+        return;
+
+    if (kernel == kernel_t::AUTO) {
+        static const kernel_t best = kernelSupported(kernel_t::AVX2)
+                                     ? kernel_t::AVX2
+                                     : kernelSupported(kernel_t::SSE2)
+                                       ? kernel_t::SSE2
+                                       : kernel_t::SCALAR;
+        kernel = best;
+    }
+
+#ifdef ROMFORMAT_SIMD
+    if (kernel == kernel_t::AVX2) {
+        if (format == format_t::V64)
+            done = swap16_avx2(p, size);
+        else
+            done = swap32_avx2(p, size);
+    }
+    else if (kernel == kernel_t::SSE2) {
+        if (format == format_t::V64)
+            done = swap16_sse2(p, size);
+        else
+            done = swap32_sse2(p, size);
+    }
+#endif
+
+    if (format == format_t::V64)
+        swap16_scalar(p + done, size - done);
+    else
+        swap32_scalar(p + done, size - done);
+}
+
+static const size_t checksum_start = 0x1000;
+static const size_t checksum_end = 0x101000;
+
+static uint32_t read_be32(const unsigned char *p)
+{
+    return (static_cast<uint32_t>(p[0]) << 24)
+           | (static_cast<uint32_t>(p[1]) << 16)
+           | (static_cast<uint32_t>(p[2]) << 8)
+           | static_cast<uint32_t>(p[3]);
+}
+
+static void write_be32(unsigned char *p, uint32_t v)
+{
+    p[0] = static_cast<unsigned char>(v >> 24);
+    p[1] = static_cast<unsigned char>(v >> 16);
+    p[2] = static_cast<unsigned char>(v >> 8);
+    p[3] = static_cast<unsigned char>(v);
+}
+
+/* six accumulators, all starting at a seed that depends on the cic */
+struct checksum_state
+{
+    uint32_t t1;
+    uint32_t t2;
+    uint32_t t3;
+    uint32_t t4;
+    uint32_t t5;
+    uint32_t t6;
+};
+
+static void checksum_scalar(const unsigned char *rom, size_t begin,
+                            size_t end, bool cic_6105, checksum_state &s)
+{
+    for (size_t i = begin; i < end; i += 4) {
+        uint32_t d = read_be32(rom + i);
+        if (s.t6 + d < s.t6)
+            s.t4++;
+        s.t6 += d;
+        s.t3 ^= d;
+        uint32_t n = d & 0x1F;
+        uint32_t r = n ? (d << n) | (d >> (32 - n)) : d;
+        s.t5 += r;
+        if (s.t2 > d)
+            s.t2 ^= r;
+        else
+            s.t2 ^= s.t6 ^ d;
+        if (cic_6105)
+            s.t1 += read_be32(rom + 0x750 + (i & 0xFF)) ^ d;
+        else
+            s.t1 += s.t5 ^ d;
+    }
+}
+
+#ifdef ROMFORMAT_SIMD
+/* inclusive prefix sum of the eight lanes */
+__attribute__((target("avx2")))
+static __m256i prefix_sum_avx2(__m256i x)
+{
+    x = _mm256_add_epi32(x, _mm256_slli_si256(x, 4));
+    x = _mm256_add_epi32(x, _mm256_slli_si256(x, 8));
+    __m256i low = _mm256_permutevar8x32_epi32(x, _mm256_set1_epi32(3));
+    return _mm256_add_epi32(x, _mm256_blend_epi32(_mm256_setzero_si256(),
+                                                  low, 0xF0));
+}
+
+/* all accumulators but t2 are sums or xors over the words, or over running
+   sums of them, and can be computed eight words at a time. t2 takes a
+   data dependent branch on its own value each word, so it's left to a
+   branchless scalar loop over the running sums that the vectors give */
+__attribute__((target("avx2")))
+static size_t checksum_avx2(const unsigned char *rom, size_t begin,
+                            size_t end, bool cic_6105, checksum_state &s)
+{
+    const __m256i bswap = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4,
+                                           11, 10, 9, 8, 15, 14, 13, 12,
+                                           3, 2, 1, 0, 7, 6, 5, 4,
+                                           11, 10, 9, 8, 15, 14, 13, 12);
+    const __m256i last = _mm256_set1_epi32(7);
+    const __m256i mask = _mm256_set1_epi32(0x1F);
+    const __m256i bits = _mm256_set1_epi32(32);
+
+    __m256i t1 = _mm256_setzero_si256();
+    __m256i t3 = _mm256_setzero_si256();
+    __m256i t5 = _mm256_set1_epi32(static_cast<int>(s.t5));
+    __m256i t6 = _mm256_set1_epi32(static_cast<int>(s.t6));
+    __m256i sum = _mm256_setzero_si256();
+    uint32_t t2 = s.t2;
+    alignas(32) uint32_t d_lanes[8];
+    alignas(32) uint32_t r_lanes[8];
+    alignas(32) uint32_t t6_lanes[8];
+
+    size_t i = begin;
+    for (; i + 32 <= end; i += 32) {
+        __m256i d = _mm256_shuffle_epi8(_mm256_loadu_si256(
+            reinterpret_cast<const __m256i *>(rom + i)), bswap);
+        __m256i n = _mm256_and_si256(d, mask);
+        /* a shift by 32 gives zero, so a rotation by 0 comes out right */
+        __m256i r = _mm256_or_si256(_mm256_sllv_epi32(d, n),
+                                    _mm256_srlv_epi32(d,
+                                        _mm256_sub_epi32(bits, n)));
+
+        t6 = _mm256_add_epi32(t6, prefix_sum_avx2(d));
+        t5 = _mm256_add_epi32(t5, prefix_sum_avx2(r));
+        t3 = _mm256_xor_si256(t3, d);
+        sum = _mm256_add_epi64(sum, _mm256_cvtepu32_epi64(
+            _mm256_castsi256_si128(d)));
+        sum = _mm256_add_epi64(sum, _mm256_cvtepu32_epi64(
+            _mm256_extracti128_si256(d, 1)));
+        if (cic_6105) {
+            __m256i k = _mm256_shuffle_epi8(_mm256_loadu_si256(
+                reinterpret_cast<const __m256i *>(rom + 0x750 + (i & 0xFF))),
+                bswap);
+            t1 = _mm256_add_epi32(t1, _mm256_xor_si256(k, d));
+        }
+        else
+            t1 = _mm256_add_epi32(t1, _mm256_xor_si256(t5, d));
+
+        _mm256_store_si256(reinterpret_cast<__m256i *>(d_lanes), d);
+        _mm256_store_si256(reinterpret_cast<__m256i *>(r_lanes), r);
+        _mm256_store_si256(reinterpret_cast<__m256i *>(t6_lanes), t6);
+        for (int j = 0; j < 8; j++) {
+            uint32_t select = 0u - static_cast<uint32_t>(t2 > d_lanes[j]);
+            t2 ^= (r_lanes[j] & select)
+                  | ((t6_lanes[j] ^ d_lanes[j]) & ~select);
+        }
+
+        t5 = _mm256_permutevar8x32_epi32(t5, last);
+        t6 = _mm256_permutevar8x32_epi32(t6, last);
+    }
+
+    alignas(32) uint32_t t1_lanes[8];
+    alignas(32) uint32_t t3_lanes[8];
+    alignas(32) uint64_t sum_lanes[4];
+    _mm256_store_si256(reinterpret_cast<__m256i *>(t1_lanes), t1);
+    _mm256_store_si256(reinterpret_cast<__m256i *>(t3_lanes), t3);
+    _mm256_store_si256(reinterpret_cast<__m256i *>(sum_lanes), sum);
+    /* t4 counts the times t6 wrapped, which a 64-bit sum gives at once */
+    uint64_t t6_wide = s.t6;
+    for (int j = 0; j < 8; j++) {
+        s.t1 += t1_lanes[j];
+        s.t3 ^= t3_lanes[j];
+    }
+    for (int j = 0; j < 4; j++)
+        t6_wide += sum_lanes[j];
+    s.t2 = t2;
+    s.t4 += static_cast<uint32_t>(t6_wide >> 32);
+    s.t5 = static_cast<uint32_t>(_mm256_cvtsi256_si32(t5));
+    s.t6 = static_cast<uint32_t>(t6_wide);
+    return i - begin;
+}
+#endif
+
+RomFormat::cic_t RomFormat::detectCic(const void *rom, size_t size)
+{
+    if (size < checksum_end)
+        return cic_t::CIC_UNKNOWN;
+    auto p = static_cast<const unsigned char *>(rom);
+    switch (crc32(0, p + 0x40, checksum_start - 0x40)) {
+        case 0x6170A4A1: return cic_t::CIC_6101;
+        case 0x90BB6CB5: return cic_t::CIC_6102;
+        case 0x0B050EE0: return cic_t::CIC_6103;
+        case 0x98BC2C86: return cic_t::CIC_6105;
+        case 0xACC8580A: return cic_t::CIC_6106;
+        default: return cic_t::CIC_UNKNOWN;
+    }
+}
+
+bool RomFormat::checksum(const void *rom, size_t size, uint32_t *crc1,
+                         uint32_t *crc2, kernel_t kernel)
+{
+    uint32_t seed;
+    cic_t cic = detectCic(rom, size);
+    switch (cic) {
+        case cic_t::CIC_6101:
+        case cic_t::CIC_6102: seed = 0xF8CA4DDC; break;
+        case cic_t::CIC_6103: seed = 0xA3886759; break;
+        case cic_t::CIC_6105: seed = 0xDF26F436; break;
+        case cic_t::CIC_6106: seed = 0x1FEA617A; break;
+        default: return false;
+    }
+
+    if (kernel == kernel_t::AUTO) {
+        static const kernel_t best = kernelSupported(kernel_t::AVX2)
+                                     ? kernel_t::AVX2
+                                     : kernel_t::SCALAR;
+        kernel = best;
+    }
+
+    auto p = static_cast<const unsigned char *>(rom);
+    checksum_state s = {seed, seed, seed, seed, seed, seed};
+    bool cic_6105 = cic == cic_t::CIC_6105;
+    size_t done = 0;
+#ifdef ROMFORMAT_SIMD
+    if (kernel == kernel_t::AVX2) {
+        done = checksum_avx2(p, checksum_start, checksum_end, cic_6105,
+                             s);
+    }
+#endif
+    checksum_scalar(p, checksum_start + done, checksum_end, cic_6105, s);
+
+    if (cic == cic_t::CIC_6103) {
+        *crc1 = (s.t6 ^ s.t4) + s.t3;
+        *crc2 = (s.t5 ^ s.t2) + s.t1;
+    }
+    else if (cic == cic_t::CIC_6106) {
+        *crc1 = (s.t6 * s.t4) + s.t3;
+        *crc2 = (s.t5 * s.t2) + s.t1;
+    }
+    else {
+        *crc1 = s.t6 ^ s.t4 ^ s.t3;
+        *crc2 = s.t5 ^ s.t2 ^ s.t1;
+    }
+    return true;
+}
+
+bool RomFormat::updateChecksum(void *rom, size_t size, kernel_t kernel)
+{
+    uint32_t crc1;
+    uint32_t crc2;
+    if (!checksum(rom, size, &crc1, &crc2, kernel))
+        return false;
+    auto p = static_cast<unsigned char *>(rom);
+    if (read_be32(p + 0x10) == crc1 && read_be32(p + 0x14) == crc2)
+        return false;
+    write_be32(p + 0x10, crc1);
+    write_be32(p + 0x14, crc2);
+    return true;
+}
@@ -0,0 +1,51 @@
+#ifndef ROMFORMAT_H
+#define ROMFORMAT_H
+#include <cstddef>
+#include <cstdint>
+
+class RomFormat
+{
+public:
+    enum format_t
+    {
+        UNKNOWN,
+        Z64,
+        V64,
+        N64,
+    };
+
+    enum kernel_t
+    {
+        AUTO,
+        SCALAR,
+        SSE2,
+        AVX2,
+    };
+
+    enum cic_t
+    {
+        CIC_UNKNOWN,
+        CIC_6101,
+        CIC_6102,
+        CIC_6103,
+        CIC_6105,
+        CIC_6106,
+    };
+
+    static format_t detect(const void *header, size_t size);
+    static bool kernelSupported(kernel_t kernel);
+    static void normalize(void *data, size_t size, format_t format,
+                          kernel_t kernel = kernel_t::AUTO);
+
+    /* the boot checksum of a big endian rom, as verified by the cic chip
+       its boot code was written for. false if the rom is too short or the
+       boot code isn't known */
+    static cic_t detectCic(const void *rom, size_t size);
+    static bool checksum(const void *rom, size_t size, uint32_t *crc1,
+                         uint32_t *crc2, kernel_t kernel = kernel_t::AUTO);
+    /* true if the header had to be changed */
+    static bool updateChecksum(void *rom, size_t size,
+                               kernel_t kernel = kernel_t::AUTO);
+};
+
+#endif
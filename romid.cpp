@@ -0,0 +1,141 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <vector>
+#include "romid.h"
+
+#ifdef HAVE_ROM_TABLE
+# include <QCryptographicHash>
+# include "crc32.h"
+# include "romformat.h"
+
+struct rom_table_entry
+{
+    unsigned char digest[20];
+    const char *name;
+};
+
+# include "rom_table.h"
+
+static constexpr uint32_t rom_table_key(const unsigned char *digest)
+{
+    return (static_cast<uint32_t>(digest[0]) << 24)
+           | (static_cast<uint32_t>(digest[1]) << 16)
+           | (static_cast<uint32_t>(digest[2]) << 8)
+           | static_cast<uint32_t>(digest[3]);
+}
+
+static constexpr unsigned rom_table_slot(uint32_t key)
+{
+    return static_cast<unsigned>(((key ^ rom_table_seed) * 0x9E3779B1u)
+                                 >> (32 - rom_table_bits));
+}
+
+/* c++11 constexpr can't loop, so the slots are checked by halving the range
+   to keep the recursion depth at rom_table_bits */
+static constexpr bool rom_table_valid(unsigned begin, unsigned end)
+{
+    return end - begin == 1
+           ? rom_table[begin].name == nullptr
+             || rom_table_slot(rom_table_key(rom_table[begin].digest))
+                == begin
+           : rom_table_valid(begin, begin + (end - begin) / 2)
+             && rom_table_valid(begin + (end - begin) / 2, end);
+}
+
+static_assert(sizeof(rom_table) / sizeof(rom_table[0])
+              == (1u << rom_table_bits),
+              "rom_table.h: bad table size");
+static_assert(rom_table_valid(0, 1u << rom_table_bits),
+              "rom_table.h: not a perfect hash");
+
+class rom_digest
+{
+public:
+    rom_digest()
+        : crc(0)
+#if ROM_TABLE_DIGEST_SIZE == 16
+        , hash(QCryptographicHash::Md5)
+#else
+        , hash(QCryptographicHash::Sha1)
+#endif
+    {
+    }
+
+    void update(const unsigned char *data, size_t size)
+    {
+#if ROM_TABLE_DIGEST_SIZE == 4
+        crc = crc32(crc, data, size);
+#else
+        hash.addData(reinterpret_cast<const char *>(data),
+                     static_cast<int>(size));
+#endif
+    }
+
+    std::vector<unsigned char> result()
+    {
+#if ROM_TABLE_DIGEST_SIZE == 4
+        return {static_cast<unsigned char>(crc >> 24),
+                static_cast<unsigned char>(crc >> 16),
+                static_cast<unsigned char>(crc >> 8),
+                static_cast<unsigned char>(crc)};
+#else
+        QByteArray r = hash.result();
+        return std::vector<unsigned char>(r.begin(), r.end());
+#endif
+    }
+
+private:
+    uint32_t crc;
+    QCryptographicHash hash;
+};
+#endif
+
+RomInfo identify_rom(const std::string &path)
+{
+    RomInfo info;
+
+#ifdef HAVE_ROM_TABLE
+    std::unique_ptr<FILE, int (*)(FILE *)> file(fopen(path.c_str(), "rb"),
+                                                 fclose);
+    if (!file)
+        return info;
+
+    static const size_t buf_size = 1024 * 1024;
+    std::vector<unsigned char> buf(buf_size);
+    rom_digest digest;
+    RomFormat::format_t format = RomFormat::format_t::UNKNOWN;
+    bool first = true;
+
+    while (true) {
+        size_t n = fread(buf.data(), 1, buf_size, file.get());
+        if (n == 0)
+            break;
+        if (first) {
+            format = RomFormat::detect(buf.data(), n);
+            first = false;
+        }
+        RomFormat::normalize(buf.data(), n, format);
+        digest.update(buf.data(), n);
+    }
+    if (ferror(file.get()))
+        return info;
+
+    std::vector<unsigned char> result = digest.result();
+    const rom_table_entry &entry = rom_table[rom_table_slot(
+                                       rom_table_key(result.data()))];
+    if (entry.name
+        && memcmp(entry.digest, result.data(), ROM_TABLE_DIGEST_SIZE) == 0)
+    {
+        info.status = RomInfo::status_t::SUPPORTED;
+        info.name = entry.name;
+    }
+    else
+        info.status = RomInfo::status_t::UNSUPPORTED;
+#else
+    (void)path;
+#endif
+
+    return info;
+}
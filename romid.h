@@ -0,0 +1,21 @@
+#ifndef ROMID_H
+#define ROMID_H
+#include <string>
+
+class RomInfo
+{
+public:
+    enum status_t
+    {
+        UNKNOWN,
+        SUPPORTED,
+        UNSUPPORTED,
+    };
+
+    status_t status = status_t::UNKNOWN;
+    std::string name;
+};
+
+RomInfo identify_rom(const std::string &path);
+
+#endif
@@ -0,0 +1,898 @@
+#include <algorithm>
+#include <climits>
+#include <mutex>
+#include <stdexcept>
+#include <QtGlobal>
+#include "subprocess.h"
+#include "sysutil.h"
+#include "trace.h"
+
+#ifdef Q_OS_WIN
+# include <thread>
+#else
+# include <fcntl.h>
+# include <poll.h>
+# include <signal.h>
+# include <spawn.h>
+# include <sys/wait.h>
+
+extern char **environ;
+#endif
+
+std::string quote(const std::string &str)
+{
+    std::string esc_str;
+    esc_str.push_back('"');
+    for (auto c : str) {
+        if (c == '"')
+            esc_str.push_back('\\');
+        esc_str.push_back(c);
+    }
+    esc_str.push_back('"');
+    return esc_str;
+}
+
+std::string join_args(const std::vector<std::string> &args)
+{
+    std::string cmd;
+    for (auto &arg : args) {
+        if (!cmd.empty())
+            cmd.push_back(' ');
+        if (arg.empty() || arg.find_first_of(" \t\n\"") != std::string::npos)
+            cmd += quote(arg);
+        else
+            cmd += arg;
+    }
+    return cmd;
+}
+
+static bool env_name_equal(const std::string &a, const std::string &b)
+{
+    size_t a_len = a.find('=');
+    size_t b_len = b.find('=');
+    if (a_len != b_len || a_len == 0 || a_len == std::string::npos)
+        return false;
+#ifdef Q_OS_WIN
+    return _strnicmp(a.c_str(), b.c_str(), a_len) == 0;
+#else
+    return a.compare(0, a_len, b, 0, b_len) == 0;
+#endif
+}
+
+static std::vector<std::string> make_env(const std::vector<std::string> &env)
+{
+    std::vector<std::string> parent_env;
+#ifdef Q_OS_WIN
+    LPCH lpEnv = GetEnvironmentStringsA();
+    if (lpEnv) {
+        for (LPCH p = lpEnv; *p; p += strlen(p) + 1)
+            parent_env.push_back(p);
+        FreeEnvironmentStringsA(lpEnv);
+    }
+#else
+    for (char **p = environ; *p; p++)
+        parent_env.push_back(*p);
+#endif
+
+    std::vector<std::string> child_env;
+    for (auto &entry : parent_env) {
+        bool overridden = false;
+        for (auto &override_entry : env) {
+            if (env_name_equal(entry, override_entry)) {
+                overridden = true;
+                break;
+            }
+        }
+        if (!overridden)
+            child_env.push_back(entry);
+    }
+    child_env.insert(child_env.end(), env.begin(), env.end());
+    return child_env;
+}
+
+static const size_t input_buf_size = 64 * 1024;
+static const size_t output_buf_size = 64 * 1024;
+
+/* how often a cancellation flag is polled while waiting on a subprocess */
+static const int cancel_poll_ms = 50;
+
+subprocess_aborted::subprocess_aborted(reason_t reason,
+                                       const std::string &what)
+    : std::runtime_error(what)
+    , m_reason(reason)
+{
+}
+
+subprocess_aborted::reason_t subprocess_aborted::reason() const noexcept
+{
+    return m_reason;
+}
+
+subprocess_limits::subprocess_limits(const std::atomic<bool> *cancel,
+                                     std::chrono::milliseconds timeout)
+    : m_cancel(cancel)
+    , m_timeout(timeout)
+    , m_deadline(std::chrono::steady_clock::now() + timeout)
+{
+}
+
+int subprocess_limits::check() const
+{
+    if (m_cancel && *m_cancel) {
+        throw subprocess_aborted(subprocess_aborted::reason_t::CANCELLED,
+                                 "cancelled");
+    }
+
+    int wait_ms = m_cancel ? cancel_poll_ms : -1;
+    if (m_timeout.count() > 0) {
+        auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+            m_deadline - std::chrono::steady_clock::now()).count();
+        if (remaining <= 0) {
+            throw subprocess_aborted(subprocess_aborted::reason_t::TIMED_OUT,
+                                     "timed out after "
+                                     + std::to_string(m_timeout.count())
+                                     + " ms");
+        }
+        if (wait_ms == -1 || remaining < wait_ms) {
+            wait_ms = static_cast<int>(std::min<long long>(remaining,
+                                                           INT_MAX));
+        }
+    }
+    return wait_ms;
+}
+
+#ifdef Q_OS_WIN
+static void kill_tree(HANDLE hProcess, HANDLE hJob) noexcept
+{
+    if (hJob != INVALID_HANDLE_VALUE)
+        TerminateJobObject(hJob, EXIT_FAILURE);
+    else
+        TerminateProcess(hProcess, EXIT_FAILURE);
+}
+#else
+static void kill_tree(pid_t pid, bool group) noexcept
+{
+    kill(group ? -pid : pid, SIGKILL);
+}
+#endif
+
+#ifndef Q_OS_WIN
+static void ignore_sigpipe()
+{
+    static std::once_flag flag;
+    std::call_once(flag, []() { signal(SIGPIPE, SIG_IGN); });
+}
+
+static void make_pipe(unique_fileno &rd, unique_fileno &wr)
+{
+    int pipefd[2];
+
+#ifdef Q_OS_LINUX
+    TRY_POSIX(pipe2, pipefd, O_CLOEXEC)
+    rd = unique_fileno(pipefd[0]);
+    wr = unique_fileno(pipefd[1]);
+#else
+    TRY_POSIX(pipe, pipefd)
+    rd = unique_fileno(pipefd[0]);
+    wr = unique_fileno(pipefd[1]);
+    TRY_POSIX(fcntl, rd.get(), F_SETFD, FD_CLOEXEC)
+    TRY_POSIX(fcntl, wr.get(), F_SETFD, FD_CLOEXEC)
+#endif
+}
+
+class spawn_file_actions
+{
+public:
+    spawn_file_actions()
+    {
+        int error_code = posix_spawn_file_actions_init(&m_actions);
+        if (error_code != 0) {
+            throw posix_exception(error_code,
+                                  "posix_spawn_file_actions_init");
+        }
+    }
+    spawn_file_actions(const spawn_file_actions &) = delete;
+
+    ~spawn_file_actions()
+    {
+        posix_spawn_file_actions_destroy(&m_actions);
+    }
+
+    spawn_file_actions &operator=(const spawn_file_actions &) = delete;
+
+    void adddup2(int fileno, int new_fileno)
+    {
+        int error_code = posix_spawn_file_actions_adddup2(&m_actions, fileno,
+                                                          new_fileno);
+        if (error_code != 0) {
+            throw posix_exception(error_code,
+                                  "posix_spawn_file_actions_adddup2");
+        }
+    }
+
+    const posix_spawn_file_actions_t *get() const noexcept
+    {
+        return &m_actions;
+    }
+
+private:
+    posix_spawn_file_actions_t m_actions;
+};
+
+class spawn_attr
+{
+public:
+    spawn_attr()
+    {
+        int error_code = posix_spawnattr_init(&m_attr);
+        if (error_code != 0)
+            throw posix_exception(error_code, "posix_spawnattr_init");
+    }
+    spawn_attr(const spawn_attr &) = delete;
+
+    ~spawn_attr()
+    {
+        posix_spawnattr_destroy(&m_attr);
+    }
+
+    spawn_attr &operator=(const spawn_attr &) = delete;
+
+    void set_default_sigpipe()
+    {
+        sigset_t sigdefault;
+        sigemptyset(&sigdefault);
+        sigaddset(&sigdefault, SIGPIPE);
+        posix_spawnattr_setsigdefault(&m_attr, &sigdefault);
+        add_flags(POSIX_SPAWN_SETSIGDEF);
+    }
+
+    void set_new_pgroup()
+    {
+        posix_spawnattr_setpgroup(&m_attr, 0);
+        add_flags(POSIX_SPAWN_SETPGROUP);
+    }
+
+    const posix_spawnattr_t *get() const noexcept
+    {
+        return &m_attr;
+    }
+
+private:
+    posix_spawnattr_t m_attr;
+
+    void add_flags(short flags)
+    {
+        short old_flags = 0;
+        posix_spawnattr_getflags(&m_attr, &old_flags);
+        posix_spawnattr_setflags(&m_attr, old_flags | flags);
+    }
+};
+#endif
+
+#ifdef Q_OS_WIN
+static unique_handle spawn(const std::vector<std::string> &args,
+                           const std::vector<std::string> &env,
+                           unique_handle *hStdInWr, unique_handle *hStdOutRd,
+                           unique_handle *hStdErrRd, unique_handle *hJob)
+{
+    unique_handle hStdInRd;
+    unique_handle hStdOutWr;
+    unique_handle hStdErrWr;
+
+    {
+        SECURITY_ATTRIBUTES sa;
+        sa.nLength = sizeof(sa);
+        sa.bInheritHandle = TRUE;
+        sa.lpSecurityDescriptor = nullptr;
+
+        TRY_WINAPI(CreatePipe, hStdInRd.ptr(), hStdInWr->ptr(), &sa, 0)
+        TRY_WINAPI(SetHandleInformation, hStdInWr->get(),
+                   HANDLE_FLAG_INHERIT, 0)
+
+        TRY_WINAPI(CreatePipe, hStdOutRd->ptr(), hStdOutWr.ptr(), &sa, 0)
+        TRY_WINAPI(SetHandleInformation, hStdOutRd->get(),
+                   HANDLE_FLAG_INHERIT, 0)
+
+        TRY_WINAPI(CreatePipe, hStdErrRd->ptr(), hStdErrWr.ptr(), &sa, 0)
+        TRY_WINAPI(SetHandleInformation, hStdErrRd->get(),
+                   HANDLE_FLAG_INHERIT, 0)
+    }
+
+    unique_handle hChildProcess;
+
+    {
+        std::string cmd = join_args(args);
+
+        std::string env_block;
+        if (!env.empty()) {
+            for (auto &entry : make_env(env)) {
+                env_block += entry;
+                env_block.push_back('\0');
+            }
+            env_block.push_back('\0');
+        }
+
+        STARTUPINFOA si;
+        ZeroMemory(&si, sizeof(si));
+        si.cb = sizeof(si);
+        si.hStdInput = hStdInRd.get();
+        si.hStdOutput = hStdOutWr.get();
+        si.hStdError = hStdErrWr.get();
+        si.dwFlags = STARTF_USESTDHANDLES;
+
+        PROCESS_INFORMATION pi;
+        ZeroMemory(&pi, sizeof(pi));
+
+        /* the process is started suspended so that it can't spawn anything
+           before it's in the job */
+        DWORD dwCreationFlags = CREATE_NO_WINDOW;
+        if (hJob) {
+            HANDLE h = CreateJobObjectA(nullptr, nullptr);
+            if (!h)
+                throw winapi_exception(GetLastError(), "CreateJobObjectA");
+            *hJob = unique_handle(h);
+            dwCreationFlags |= CREATE_SUSPENDED;
+        }
+
+        TRY_WINAPI(CreateProcessA, nullptr, &cmd[0], nullptr, nullptr, TRUE,
+                   dwCreationFlags, env_block.empty() ? nullptr
+                                                      : &env_block[0],
+                   nullptr, &si, &pi)
+        hChildProcess = unique_handle(pi.hProcess);
+        unique_handle hChildThread(pi.hThread);
+        if (hJob) {
+            if (!AssignProcessToJobObject(hJob->get(), pi.hProcess)) {
+                DWORD dwErrorCode = GetLastError();
+                TerminateProcess(pi.hProcess, EXIT_FAILURE);
+                throw winapi_exception(dwErrorCode,
+                                       "AssignProcessToJobObject");
+            }
+            ResumeThread(pi.hThread);
+        }
+
+        hStdInRd.reset();
+        hStdOutWr.reset();
+        hStdErrWr.reset();
+    }
+
+    return hChildProcess;
+}
+#else
+static pid_t spawn(const std::vector<std::string> &args,
+                   const std::vector<std::string> &env,
+                   unique_fileno *stdin_wr, unique_fileno *stdout_rd,
+                   unique_fileno *stderr_rd, bool new_group)
+{
+    unique_fileno stdin_rd;
+    unique_fileno stdout_wr;
+    unique_fileno stderr_wr;
+
+    make_pipe(stdin_rd, *stdin_wr);
+    make_pipe(*stdout_rd, stdout_wr);
+    make_pipe(*stderr_rd, stderr_wr);
+
+    pid_t cpid;
+
+    {
+        spawn_file_actions file_actions;
+        file_actions.adddup2(stdin_rd.get(), STDIN_FILENO);
+        file_actions.adddup2(stdout_wr.get(), STDOUT_FILENO);
+        file_actions.adddup2(stderr_wr.get(), STDERR_FILENO);
+
+        std::vector<char *> argv;
+        for (auto &arg : args)
+            argv.push_back(const_cast<char *>(arg.c_str()));
+        argv.push_back(nullptr);
+
+        std::vector<std::string> child_env = make_env(env);
+        std::vector<char *> envp;
+        for (auto &entry : child_env)
+            envp.push_back(const_cast<char *>(entry.c_str()));
+        envp.push_back(nullptr);
+
+        spawn_attr attr;
+        attr.set_default_sigpipe();
+        if (new_group)
+            attr.set_new_pgroup();
+
+        int error_code = posix_spawn(&cpid, argv[0], file_actions.get(),
+                                     attr.get(), argv.data(), envp.data());
+        if (error_code != 0)
+            throw posix_exception(error_code, "posix_spawn");
+
+        stdin_rd.reset();
+        stdout_wr.reset();
+        stderr_wr.reset();
+    }
+
+    return cpid;
+}
+#endif
+
+int invoke_subprogram(const std::vector<std::string> &args,
+                      const std::vector<std::string> &env,
+                      const std::string &input,
+                      std::function<void(const char *, size_t)> stdout_fn,
+                      std::function<void(const char *, size_t)> stderr_fn,
+                      const subprocess_limits *limits)
+{
+    size_t input_pos = 0;
+    auto input_fn = [&input, &input_pos](char *buf, size_t size)
+    {
+        size_t n = std::min(size, input.size() - input_pos);
+        memcpy(buf, input.data() + input_pos, n);
+        input_pos += n;
+        return n;
+    };
+    return invoke_subprogram(args, env, input_fn, stdout_fn, stderr_fn,
+                             limits);
+}
+
+int invoke_subprogram(const std::vector<std::string> &args,
+                      const std::vector<std::string> &env,
+                      std::function<size_t(char *, size_t)> stdin_fn,
+                      std::function<void(const char *, size_t)> stdout_fn,
+                      std::function<void(const char *, size_t)> stderr_fn,
+                      const subprocess_limits *limits)
+{
+    if (args.empty())
+        throw std::invalid_argument("invoke_subprogram: no program");
+
+    trace_scope trace("subprocess", "subprocess",
+                      trace_enabled() ? trace_arg("cmd", join_args(args))
+                                      : std::string());
+    bool first_output = true;
+    if (trace_enabled()) {
+        auto traced = [&first_output](
+            std::function<void(const char *, size_t)> fn)
+        {
+            return [&first_output, fn](const char *data, size_t size)
+            {
+                if (first_output) {
+                    first_output = false;
+                    trace_instant("first output", "subprocess");
+                }
+                fn(data, size);
+            };
+        };
+        stdout_fn = traced(stdout_fn);
+        stderr_fn = traced(stderr_fn);
+    }
+
+#ifdef Q_OS_WIN
+    unique_handle hStdInWr;
+    unique_handle hStdOutRd;
+    unique_handle hStdErrRd;
+    unique_handle hChildProcess;
+    unique_handle hJob;
+    {
+        trace_scope trace_spawn("spawn", "subprocess");
+        hChildProcess = spawn(args, env, &hStdInWr, &hStdOutRd, &hStdErrRd,
+                              limits ? &hJob : nullptr);
+    }
+
+    std::exception_ptr stdin_eptr;
+    std::thread stdin_thread(
+        [&stdin_fn, &stdin_eptr, &hStdInWr]()
+        {
+            try {
+                std::vector<char> input_buf(input_buf_size);
+                while (true) {
+                    size_t n = stdin_fn(input_buf.data(), input_buf.size());
+                    if (n == 0)
+                        break;
+                    size_t pos = 0;
+                    while (pos < n) {
+                        DWORD dwWritten;
+                        if (!WriteFile(hStdInWr.get(), input_buf.data() + pos,
+                                       static_cast<DWORD>(n - pos),
+                                       &dwWritten, nullptr))
+                        {
+                            DWORD dwErrorCode = GetLastError();
+                            if (dwErrorCode == ERROR_BROKEN_PIPE
+                                || dwErrorCode == ERROR_NO_DATA)
+                            {
+                                hStdInWr.reset();
+                                return;
+                            }
+                            throw winapi_exception(dwErrorCode, "WriteFile");
+                        }
+                        pos += dwWritten;
+                    }
+                }
+            }
+            catch (...) {
+                stdin_eptr = std::current_exception();
+            }
+            hStdInWr.reset();
+        });
+
+    struct stdin_thread_guard
+    {
+        std::thread &thread;
+        HANDLE hProcess;
+        HANDLE hJob;
+
+        ~stdin_thread_guard()
+        {
+            if (thread.joinable()) {
+                kill_tree(hProcess, hJob);
+                thread.join();
+            }
+        }
+    } stdin_guard = {stdin_thread, hChildProcess.get(), hJob.get()};
+
+    std::vector<char> output_buf(output_buf_size);
+    while (true) {
+        bool stdout_hup = false;
+        bool stderr_hup = false;
+        DWORD dwBytes;
+
+        /* on abort, stdin_guard takes down the process tree */
+        if (limits)
+            limits->check();
+
+        if (!PeekNamedPipe(hStdOutRd.get(), nullptr, 0, nullptr,
+                           &dwBytes, nullptr))
+        {
+            DWORD dwErrorCode = GetLastError();
+            if (dwErrorCode == ERROR_BROKEN_PIPE)
+                stdout_hup = true;
+            else
+                throw winapi_exception(dwErrorCode, "PeekNamedPipe");
+        }
+        else if (dwBytes != 0) {
+            TRY_WINAPI(ReadFile, hStdOutRd.get(), output_buf.data(),
+                       static_cast<DWORD>(output_buf.size()), &dwBytes,
+                       nullptr)
+            stdout_fn(output_buf.data(), dwBytes);
+        }
+
+        if (!PeekNamedPipe(hStdErrRd.get(), nullptr, 0, nullptr,
+                           &dwBytes, nullptr))
+        {
+            DWORD dwErrorCode = GetLastError();
+            if (dwErrorCode == ERROR_BROKEN_PIPE)
+                stderr_hup = true;
+            else
+                throw winapi_exception(dwErrorCode, "PeekNamedPipe");
+        }
+        else if (dwBytes != 0) {
+            TRY_WINAPI(ReadFile, hStdErrRd.get(), output_buf.data(),
+                       static_cast<DWORD>(output_buf.size()), &dwBytes,
+                       nullptr)
+            stderr_fn(output_buf.data(), dwBytes);
+        }
+
+        if (stdout_hup && stderr_hup)
+            break;
+    }
+    hStdOutRd.reset();
+    hStdErrRd.reset();
+
+    {
+        trace_scope trace_exit("exit", "subprocess");
+        WaitForSingleObject(hChildProcess.get(), INFINITE);
+    }
+    stdin_thread.join();
+    if (stdin_eptr)
+        std::rethrow_exception(stdin_eptr);
+    DWORD dwStatus;
+    TRY_WINAPI(GetExitCodeProcess, hChildProcess.get(), &dwStatus)
+
+    return static_cast<int>(dwStatus);
+#else
+    unique_fileno stdin_wr;
+    unique_fileno stdout_rd;
+    unique_fileno stderr_rd;
+    pid_t cpid;
+    {
+        trace_scope trace_spawn("spawn", "subprocess");
+        cpid = spawn(args, env, &stdin_wr, &stdout_rd, &stderr_rd,
+                     limits != nullptr);
+    }
+
+    ignore_sigpipe();
+    TRY_POSIX(fcntl, stdin_wr.get(), F_SETFL,
+              fcntl(stdin_wr.get(), F_GETFL) | O_NONBLOCK)
+
+    /* whatever unwinds out of here, don't leave the child running or
+       unreaped */
+    struct child_guard
+    {
+        pid_t pid;
+        bool group;
+        bool armed;
+
+        ~child_guard()
+        {
+            if (armed) {
+                kill_tree(pid, group);
+                waitpid(pid, nullptr, 0);
+            }
+        }
+    } child = {cpid, limits != nullptr, true};
+
+    std::vector<char> input_buf(input_buf_size);
+    std::vector<char> output_buf(output_buf_size);
+    size_t input_pos = 0;
+    size_t input_end = 0;
+
+    struct pollfd pollfds[] =
+    {
+        {stdin_wr.get(), POLLOUT, 0},
+        {stdout_rd.get(), POLLIN, 0},
+        {stderr_rd.get(), POLLIN, 0},
+    };
+    while (pollfds[1].fd != -1 || pollfds[2].fd != -1) {
+        ssize_t n_bytes;
+
+        if (pollfds[0].fd != -1 && input_pos == input_end) {
+            input_pos = 0;
+            input_end = stdin_fn(input_buf.data(), input_buf.size());
+            if (input_end == 0) {
+                stdin_wr.reset();
+                pollfds[0].fd = -1;
+            }
+        }
+
+        /* on abort, child takes down the process group */
+        int timeout_ms = -1;
+        if (limits)
+            timeout_ms = limits->check();
+
+        if (poll(pollfds, 3, timeout_ms) == -1) {
+            if (errno == EINTR)
+                continue;
+            throw posix_exception(errno, "poll");
+        }
+
+        if (pollfds[0].revents) {
+            n_bytes = write(stdin_wr.get(), input_buf.data() + input_pos,
+                            input_end - input_pos);
+            if (n_bytes == -1) {
+                if (errno == EPIPE) {
+                    stdin_wr.reset();
+                    pollfds[0].fd = -1;
+                }
+                else if (errno != EAGAIN && errno != EINTR)
+                    throw posix_exception(errno, "write");
+            }
+            else
+                input_pos += static_cast<size_t>(n_bytes);
+        }
+
+        if (pollfds[1].revents) {
+            n_bytes = read(stdout_rd.get(), output_buf.data(),
+                           output_buf.size());
+            if (n_bytes == -1)
+                throw posix_exception(errno, "read");
+            else if (n_bytes == 0)
+                pollfds[1].fd = -1;
+            else
+                stdout_fn(output_buf.data(), static_cast<size_t>(n_bytes));
+        }
+
+        if (pollfds[2].revents) {
+            n_bytes = read(stderr_rd.get(), output_buf.data(),
+                           output_buf.size());
+            if (n_bytes == -1)
+                throw posix_exception(errno, "read");
+            else if (n_bytes == 0)
+                pollfds[2].fd = -1;
+            else
+                stderr_fn(output_buf.data(), static_cast<size_t>(n_bytes));
+        }
+    }
+    stdin_wr.reset();
+    stdout_rd.reset();
+    stderr_rd.reset();
+
+    int status;
+    child.armed = false;
+    {
+        trace_scope trace_exit("exit", "subprocess");
+        TRY_POSIX(waitpid, cpid, &status, 0)
+    }
+
+    /* there is no shell in between to turn a signal into a status */
+    if (WIFSIGNALED(status))
+        return 128 + WTERMSIG(status);
+    return WEXITSTATUS(status);
+#endif
+}
+
+subprocess::subprocess(const std::vector<std::string> &args,
+                       const std::vector<std::string> &env, bool new_group)
+    : m_exited(false)
+    , m_status(0)
+    , m_output_buf(output_buf_size)
+{
+    if (args.empty())
+        throw std::invalid_argument("subprocess: no program");
+
+    trace_scope trace("spawn", "subprocess",
+                      trace_enabled() ? trace_arg("cmd", join_args(args))
+                                      : std::string());
+#ifdef Q_OS_WIN
+    m_process = spawn(args, env, &m_stdin, &m_stdout, &m_stderr,
+                      new_group ? &m_job : nullptr);
+#else
+    m_group = new_group;
+    m_pid = spawn(args, env, &m_stdin, &m_stdout, &m_stderr, new_group);
+    ignore_sigpipe();
+#endif
+}
+
+subprocess::~subprocess()
+{
+    close_stdin();
+    if (!m_exited) {
+        kill();
+        try {
+            wait();
+        }
+        catch (...) {
+        }
+    }
+}
+
+bool subprocess::write(const std::string &data)
+{
+    size_t pos = 0;
+    while (pos < data.size()) {
+#ifdef Q_OS_WIN
+        DWORD dwWritten;
+        if (!WriteFile(m_stdin.get(), data.data() + pos,
+                       static_cast<DWORD>(data.size() - pos), &dwWritten,
+                       nullptr))
+        {
+            DWORD dwErrorCode = GetLastError();
+            if (dwErrorCode == ERROR_BROKEN_PIPE
+                || dwErrorCode == ERROR_NO_DATA)
+            {
+                return false;
+            }
+            throw winapi_exception(dwErrorCode, "WriteFile");
+        }
+        pos += dwWritten;
+#else
+        ssize_t n_bytes = ::write(m_stdin.get(), data.data() + pos,
+                                  data.size() - pos);
+        if (n_bytes == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EPIPE)
+                return false;
+            throw posix_exception(errno, "write");
+        }
+        pos += static_cast<size_t>(n_bytes);
+#endif
+    }
+    return true;
+}
+
+void subprocess::close_stdin() noexcept
+{
+    m_stdin.reset();
+}
+
+bool subprocess::read(std::function<void(const char *, size_t)> stdout_fn,
+                      std::function<void(const char *, size_t)> stderr_fn,
+                      int timeout_ms)
+{
+#ifdef Q_OS_WIN
+    auto start = std::chrono::steady_clock::now();
+    while (m_stdout || m_stderr) {
+        bool got_data = false;
+        unique_handle *handles[] = {&m_stdout, &m_stderr};
+        for (int i = 0; i < 2; i++) {
+            unique_handle &h = *handles[i];
+            if (!h)
+                continue;
+            DWORD dwBytes;
+            if (!PeekNamedPipe(h.get(), nullptr, 0, nullptr, &dwBytes,
+                               nullptr))
+            {
+                DWORD dwErrorCode = GetLastError();
+                if (dwErrorCode != ERROR_BROKEN_PIPE)
+                    throw winapi_exception(dwErrorCode, "PeekNamedPipe");
+                h.reset();
+            }
+            else if (dwBytes != 0) {
+                TRY_WINAPI(ReadFile, h.get(), m_output_buf.data(),
+                           static_cast<DWORD>(m_output_buf.size()), &dwBytes,
+                           nullptr)
+                auto &fn = i == 0 ? stdout_fn : stderr_fn;
+                fn(m_output_buf.data(), dwBytes);
+                got_data = true;
+            }
+        }
+        if (got_data)
+            return true;
+        if (timeout_ms >= 0 && std::chrono::steady_clock::now() - start
+                               >= std::chrono::milliseconds(timeout_ms))
+        {
+            return true;
+        }
+    }
+    return false;
+#else
+    struct pollfd pollfds[] =
+    {
+        {m_stdout ? m_stdout.get() : -1, POLLIN, 0},
+        {m_stderr ? m_stderr.get() : -1, POLLIN, 0},
+    };
+    while (m_stdout || m_stderr) {
+        int n_ready = poll(pollfds, 2, timeout_ms);
+        if (n_ready == -1) {
+            if (errno == EINTR)
+                continue;
+            throw posix_exception(errno, "poll");
+        }
+        else if (n_ready == 0)
+            return true;
+
+        bool got_data = false;
+        unique_fileno *filenos[] = {&m_stdout, &m_stderr};
+        for (int i = 0; i < 2; i++) {
+            if (!pollfds[i].revents)
+                continue;
+            ssize_t n_bytes = ::read(filenos[i]->get(), m_output_buf.data(),
+                                     m_output_buf.size());
+            if (n_bytes == -1) {
+                if (errno == EINTR)
+                    continue;
+                throw posix_exception(errno, "read");
+            }
+            else if (n_bytes == 0) {
+                filenos[i]->reset();
+                pollfds[i].fd = -1;
+            }
+            else {
+                auto &fn = i == 0 ? stdout_fn : stderr_fn;
+                fn(m_output_buf.data(), static_cast<size_t>(n_bytes));
+                got_data = true;
+            }
+        }
+        if (got_data)
+            return true;
+    }
+    return false;
+#endif
+}
+
+int subprocess::wait()
+{
+    if (m_exited)
+        return m_status;
+
+#ifdef Q_OS_WIN
+    WaitForSingleObject(m_process.get(), INFINITE);
+    DWORD dwStatus;
+    TRY_WINAPI(GetExitCodeProcess, m_process.get(), &dwStatus)
+    m_status = static_cast<int>(dwStatus);
+#else
+    int status;
+    while (waitpid(m_pid, &status, 0) == -1) {
+        if (errno != EINTR)
+            throw posix_exception(errno, "waitpid");
+    }
+    m_status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+#endif
+    m_exited = true;
+    m_stdout.reset();
+    m_stderr.reset();
+    return m_status;
+}
+
+void subprocess::kill() noexcept
+{
+    if (m_exited)
+        return;
+#ifdef Q_OS_WIN
+    kill_tree(m_process.get(), m_job.get());
+#else
+    kill_tree(m_pid, m_group);
+#endif
+}
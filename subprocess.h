@@ -0,0 +1,104 @@
+#ifndef SUBPROCESS_H
+#define SUBPROCESS_H
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "sysutil.h"
+
+class subprocess_aborted : public std::runtime_error
+{
+public:
+    enum reason_t
+    {
+        CANCELLED,
+        TIMED_OUT,
+    };
+
+    subprocess_aborted(reason_t reason, const std::string &what);
+
+    reason_t reason() const noexcept;
+
+private:
+    reason_t m_reason;
+};
+
+/* cancellation flag and timeout for a subprocess. the timeout runs from
+   construction. processes started under limits get a process group (a job
+   object on windows) of their own, which is killed as a whole when a limit
+   is hit */
+class subprocess_limits
+{
+public:
+    subprocess_limits(const std::atomic<bool> *cancel,
+                      std::chrono::milliseconds timeout =
+                          std::chrono::milliseconds(0));
+
+    /* throws subprocess_aborted if a limit has been hit, otherwise returns
+       how many milliseconds to wait before checking again, -1 for
+       indefinitely */
+    int check() const;
+
+private:
+    const std::atomic<bool> *m_cancel;
+    std::chrono::milliseconds m_timeout;
+    std::chrono::steady_clock::time_point m_deadline;
+};
+
+std::string quote(const std::string &str);
+std::string join_args(const std::vector<std::string> &args);
+
+int invoke_subprogram(const std::vector<std::string> &args,
+                      const std::vector<std::string> &env,
+                      const std::string &input,
+                      std::function<void(const char *, size_t)> stdout_fn,
+                      std::function<void(const char *, size_t)> stderr_fn,
+                      const subprocess_limits *limits = nullptr);
+int invoke_subprogram(const std::vector<std::string> &args,
+                      const std::vector<std::string> &env,
+                      std::function<size_t(char *, size_t)> stdin_fn,
+                      std::function<void(const char *, size_t)> stdout_fn,
+                      std::function<void(const char *, size_t)> stderr_fn,
+                      const subprocess_limits *limits = nullptr);
+
+class subprocess
+{
+public:
+    subprocess(const std::vector<std::string> &args,
+               const std::vector<std::string> &env, bool new_group = false);
+    subprocess(const subprocess &) = delete;
+
+    ~subprocess();
+
+    subprocess &operator=(const subprocess &) = delete;
+
+    bool write(const std::string &data);
+    void close_stdin() noexcept;
+    bool read(std::function<void(const char *, size_t)> stdout_fn,
+              std::function<void(const char *, size_t)> stderr_fn,
+              int timeout_ms = -1);
+    int wait();
+    void kill() noexcept;
+
+private:
+#ifdef Q_OS_WIN
+    unique_handle m_process;
+    unique_handle m_job;
+    unique_handle m_stdin;
+    unique_handle m_stdout;
+    unique_handle m_stderr;
+#else
+    pid_t m_pid;
+    bool m_group;
+    unique_fileno m_stdin;
+    unique_fileno m_stdout;
+    unique_fileno m_stderr;
+#endif
+    bool m_exited;
+    int m_status;
+    std::vector<char> m_output_buf;
+};
+
+#endif
@@ -0,0 +1,243 @@
+#ifndef SYSUTIL_H
+#define SYSUTIL_H
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <exception>
+#include <string>
+#include <typeinfo>
+#include <utility>
+#include <QtGlobal>
+
+#ifdef Q_OS_WIN
+# include <windows.h>
+#endif
+
+#ifdef Q_OS_WIN
+class unique_handle
+{
+public:
+    unique_handle() noexcept
+        : m_handle(INVALID_HANDLE_VALUE)
+    {
+    }
+    explicit unique_handle(HANDLE handle) noexcept
+        : m_handle(handle)
+    {
+    }
+    unique_handle(const unique_handle &) = delete;
+    unique_handle(unique_handle &&other) noexcept
+        : m_handle(INVALID_HANDLE_VALUE)
+    {
+        std::swap(m_handle, other.m_handle);
+    }
+
+    ~unique_handle()
+    {
+        if (m_handle != INVALID_HANDLE_VALUE)
+            CloseHandle(m_handle);
+    }
+
+    unique_handle &operator=(const unique_handle &) = delete;
+    unique_handle &operator=(unique_handle &&other) noexcept
+    {
+        std::swap(m_handle, other.m_handle);
+        return *this;
+    }
+
+    operator bool() const noexcept
+    {
+        return m_handle != INVALID_HANDLE_VALUE;
+    }
+
+    HANDLE get() const noexcept
+    {
+        return m_handle;
+    }
+    HANDLE *ptr()
+    {
+        if (m_handle == INVALID_HANDLE_VALUE)
+            return &m_handle;
+        else
+            throw std::bad_cast();
+    }
+    HANDLE release() noexcept
+    {
+        HANDLE handle = m_handle;
+        m_handle = INVALID_HANDLE_VALUE;
+        return handle;
+    }
+    void reset(HANDLE handle = INVALID_HANDLE_VALUE) noexcept
+    {
+        *this = unique_handle(handle);
+    }
+    void reset(unique_handle &&other) noexcept
+    {
+        *this = std::move(other);
+    }
+
+private:
+    HANDLE m_handle;
+};
+
+#define TRY_WINAPI(f,...) \
+{ \
+    if (!(f)(__VA_ARGS__)) \
+        throw winapi_exception(GetLastError(), #f); \
+}
+
+class winapi_exception : public std::exception
+{
+public:
+    winapi_exception(DWORD dwErrorCode, const char *s)
+        : m_dwErrorCode(dwErrorCode)
+    {
+        LPSTR lpMsgBuf;
+
+        TRY_WINAPI(FormatMessageA,
+                   FORMAT_MESSAGE_ALLOCATE_BUFFER
+                   | FORMAT_MESSAGE_FROM_SYSTEM
+                   | FORMAT_MESSAGE_IGNORE_INSERTS,
+                   nullptr, m_dwErrorCode,
+                   MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT),
+                   reinterpret_cast<LPSTR>(&lpMsgBuf), 0, nullptr)
+
+        try {
+            m_error_str = std::string(s) + ": " + lpMsgBuf;
+        }
+        catch (...) {
+            LocalFree(lpMsgBuf);
+            throw;
+        }
+
+        LocalFree(lpMsgBuf);
+    }
+
+    DWORD error_code() const noexcept
+    {
+        return m_dwErrorCode;
+    }
+    const char *what() const noexcept override
+    {
+        return m_error_str.c_str();
+    }
+
+private:
+    DWORD m_dwErrorCode;
+    std::string m_error_str;
+};
+
+/* paths are passed around as utf-8, the W functions need them as utf-16 */
+inline std::wstring wide_path(const std::string &path)
+{
+    int n = MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS, path.c_str(),
+                                -1, nullptr, 0);
+    if (n == 0)
+        throw winapi_exception(GetLastError(), "MultiByteToWideChar");
+    std::wstring wpath(static_cast<size_t>(n), L'\0');
+    if (MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS, path.c_str(), -1,
+                            &wpath[0], n) == 0)
+    {
+        throw winapi_exception(GetLastError(), "MultiByteToWideChar");
+    }
+    wpath.resize(static_cast<size_t>(n - 1));
+    return wpath;
+}
+#endif
+
+class unique_fileno
+{
+public:
+    unique_fileno() noexcept
+        : m_fileno(-1)
+    {
+    }
+    explicit unique_fileno(int fileno) noexcept
+        : m_fileno(fileno)
+    {
+    }
+    unique_fileno(const unique_fileno &) = delete;
+    unique_fileno(unique_fileno &&other) noexcept
+        : m_fileno(-1)
+    {
+        std::swap(m_fileno, other.m_fileno);
+    }
+
+    ~unique_fileno()
+    {
+        if (m_fileno != -1)
+            close(m_fileno);
+    }
+
+    unique_fileno &operator=(const unique_fileno &) = delete;
+    unique_fileno &operator=(unique_fileno &&other) noexcept
+    {
+        std::swap(m_fileno, other.m_fileno);
+        return *this;
+    }
+
+    operator bool() const noexcept
+    {
+        return m_fileno != -1;
+    }
+
+    int get() const noexcept
+    {
+        return m_fileno;
+    }
+    int *ptr()
+    {
+        if (m_fileno == -1)
+            return &m_fileno;
+        else
+            throw std::bad_cast();
+    }
+    int release() noexcept
+    {
+        int fileno = m_fileno;
+        m_fileno = -1;
+        return fileno;
+    }
+    void reset(int fileno = -1) noexcept
+    {
+        *this = unique_fileno(fileno);
+    }
+    void reset(unique_fileno &&other) noexcept
+    {
+        *this = std::move(other);
+    }
+
+private:
+    int m_fileno;
+};
+
+#define TRY_POSIX(f,...) \
+{ \
+    if ((f)(__VA_ARGS__) == -1) \
+        throw posix_exception(errno, #f); \
+}
+
+class posix_exception : public std::exception
+{
+public:
+    posix_exception(int error_code, const char *s)
+        : m_error_code(error_code)
+    {
+        m_error_str = std::string(s) + ": " + strerror(m_error_code);
+    }
+
+    int error_code() const noexcept
+    {
+        return m_error_code;
+    }
+    const char *what() const noexcept override
+    {
+        return m_error_str.c_str();
+    }
+
+private:
+    int m_error_code;
+    std::string m_error_str;
+};
+
+#endif
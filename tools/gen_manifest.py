@@ -0,0 +1,47 @@
+#!/usr/bin/env python3
+# Generate manifest.sha1 for a package directory, listing the SHA-1 of every
+# file under bin/, lua/, ups/ and gzi/. The format is that of sha1sum, so a
+# package can also be checked with `sha1sum -c manifest.sha1`.
+#
+# usage: gen_manifest.py package_dir [manifest.sha1]
+
+import hashlib
+import os
+import sys
+
+ASSET_DIRS = ['bin', 'lua', 'ups', 'gzi']
+
+
+def sha1_file(path):
+    h = hashlib.sha1()
+    with open(path, 'rb') as f:
+        for chunk in iter(lambda: f.read(1 << 20), b''):
+            h.update(chunk)
+    return h.hexdigest()
+
+
+def main():
+    if len(sys.argv) not in (2, 3):
+        sys.exit('usage: gen_manifest.py package_dir [manifest.sha1]')
+    root = sys.argv[1]
+    out_path = sys.argv[2] if len(sys.argv) == 3 else os.path.join(
+        root, 'manifest.sha1')
+
+    paths = []
+    for asset_dir in ASSET_DIRS:
+        for dirpath, dirnames, filenames in os.walk(os.path.join(root,
+                                                                 asset_dir)):
+            dirnames.sort()
+            for name in filenames:
+                path = os.path.join(dirpath, name)
+                paths.append(os.path.relpath(path, root).replace(os.sep, '/'))
+    if not paths:
+        sys.exit('no assets found in ' + root)
+
+    with open(out_path, 'w', newline='\n') as f:
+        for path in sorted(paths):
+            f.write('%s  %s\n' % (sha1_file(os.path.join(root, path)), path))
+
+
+if __name__ == '__main__':
+    main()
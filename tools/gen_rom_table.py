@@ -0,0 +1,240 @@
+#!/usr/bin/env python3
+# Generate a perfect-hash table of ROM digests from lua/rom_table.lua.
+#
+# The table must be a single Lua table constructor, optionally preceded by
+# `return` or `local name =` and followed by `return name`. Each entry is
+#
+#     [<key>] = { game = "...", version = "...", region = "...", ... },
+#
+# where <key> is either a 0x-prefixed 32-bit number (the CRC-32 of the
+# big-endian ROM) or a quoted MD5 or SHA-1 hex digest, the same kind for
+# every entry. Other fields may hold any Lua value and are ignored. Any
+# entry that does not follow this layout is an error, as is an empty table.
+#
+# usage: gen_rom_table.py rom_table.lua rom_table.h
+
+import re
+import sys
+
+TOKEN_RE = re.compile(r'''
+    (?P<space>\s+)
+  | (?P<comment>--\[(?P<level>=*)\[.*?\](?P=level)\]|--[^\n]*)
+  | (?P<string>"(?:[^"\\\n]|\\.)*"|'(?:[^'\\\n]|\\.)*')
+  | (?P<number>0[xX][0-9A-Fa-f]+|\d+(?:\.\d*)?(?:[eE][+-]?\d+)?)
+  | (?P<name>[A-Za-z_]\w*)
+  | (?P<punct>[{}\[\]=,;-])
+''', re.S | re.X)
+
+
+class ParseError(Exception):
+    pass
+
+
+def tokenize(src):
+    tokens = []
+    pos = 0
+    line = 1
+    while pos < len(src):
+        m = TOKEN_RE.match(src, pos)
+        if m is None:
+            raise ParseError('line %d: unexpected %r' % (line, src[pos]))
+        kind = m.lastgroup
+        if kind == 'level':
+            kind = 'comment'
+        if kind not in ('space', 'comment'):
+            tokens.append((kind, m.group(kind), line))
+        line += m.group(0).count('\n')
+        pos = m.end()
+    tokens.append(('eof', '', line))
+    return tokens
+
+
+class Parser:
+    def __init__(self, src):
+        self.tokens = tokenize(src)
+        self.pos = 0
+
+    def peek(self, value=None):
+        kind, text, _ = self.tokens[self.pos]
+        if value is None:
+            return kind
+        return text == value and kind in ('punct', 'name')
+
+    def next(self, kind=None, value=None):
+        tok = self.tokens[self.pos]
+        if (kind is not None and tok[0] != kind) or \
+                (value is not None and tok[1] != value):
+            expected = value if value is not None else kind
+            raise ParseError('line %d: expected %s, found %r'
+                             % (tok[2], expected, tok[1] or 'end of file'))
+        self.pos += 1
+        return tok
+
+    def skip_sep(self):
+        if self.peek(',') or self.peek(';'):
+            self.pos += 1
+            return True
+        return False
+
+    def value(self):
+        kind, text, line = self.tokens[self.pos]
+        if kind == 'punct' and text == '{':
+            self.skip_table()
+        elif kind == 'punct' and text == '-':
+            self.pos += 1
+            self.next('number')
+        elif kind in ('string', 'number') or \
+                (kind == 'name' and text in ('true', 'false', 'nil')):
+            self.pos += 1
+        else:
+            raise ParseError('line %d: expected a value, found %r'
+                             % (line, text or 'end of file'))
+        return kind, text
+
+    def skip_table(self):
+        self.next('punct', '{')
+        while not self.peek('}'):
+            if self.peek('['):
+                self.pos += 1
+                self.value()
+                self.next('punct', ']')
+                self.next('punct', '=')
+            elif self.peek() == 'name' and \
+                    self.tokens[self.pos + 1][1] == '=':
+                self.pos += 2
+            self.value()
+            if not self.skip_sep():
+                break
+        self.next('punct', '}')
+
+    def entry(self):
+        _, _, line = self.next('punct', '[')
+        kind, text, _ = self.next()
+        if kind == 'number' and text[:2] in ('0x', '0X') and len(text) == 10:
+            hex_str = text[2:]
+        elif kind == 'string' and len(text) - 2 in (32, 40) and \
+                re.fullmatch(r'[0-9A-Fa-f]+', text[1:-1]):
+            hex_str = text[1:-1]
+        else:
+            raise ParseError('line %d: bad key %r' % (line, text))
+        self.next('punct', ']')
+        self.next('punct', '=')
+        self.next('punct', '{')
+        fields = {}
+        while not self.peek('}'):
+            _, field, field_line = self.next('name')
+            self.next('punct', '=')
+            if field in fields:
+                raise ParseError('line %d: duplicate field %s'
+                                 % (field_line, field))
+            fields[field] = self.value()
+            if not self.skip_sep():
+                break
+        self.next('punct', '}')
+
+        parts = []
+        for k in ('game', 'version', 'region'):
+            if k in fields:
+                kind, text = fields[k]
+                if kind != 'string':
+                    raise ParseError('line %d: %s is not a string'
+                                     % (line, k))
+                parts.append(text[1:-1])
+        if not parts:
+            raise ParseError('line %d: entry has no game, version or region'
+                             % line)
+        return bytes.fromhex(hex_str), ' '.join(parts), line
+
+    def parse(self):
+        name = None
+        if self.peek('return'):
+            self.pos += 1
+        elif self.peek('local'):
+            self.pos += 1
+            _, name, _ = self.next('name')
+            self.next('punct', '=')
+        self.next('punct', '{')
+        entries = []
+        while not self.peek('}'):
+            entries.append(self.entry())
+            if not self.skip_sep():
+                break
+        self.next('punct', '}')
+        if name is not None:
+            self.next('name', 'return')
+            self.next('name', name)
+        self.next('eof')
+        return entries
+
+
+def parse(src):
+    entries = {}
+    size = None
+    for digest, name, line in Parser(src).parse():
+        if size is None:
+            size = len(digest)
+        elif len(digest) != size:
+            raise ParseError('line %d: %d-byte digest in a table of %d-byte'
+                             ' digests' % (line, len(digest), size))
+        if digest in entries:
+            raise ParseError('line %d: duplicate digest' % line)
+        entries[digest] = name
+    if not entries:
+        raise ParseError('no entries')
+    return size, entries
+
+
+def slot(key, seed, bits):
+    return (((key ^ seed) * 0x9E3779B1) & 0xFFFFFFFF) >> (32 - bits)
+
+
+def perfect_hash(keys):
+    bits = 1
+    while (1 << bits) < 2 * len(keys):
+        bits += 1
+    for extra in range(4):
+        for seed in range(1 << 16):
+            slots = {slot(k, seed, bits + extra) for k in keys}
+            if len(slots) == len(keys):
+                return seed, bits + extra
+    sys.exit('gen_rom_table.py: no perfect hash found')
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.exit('usage: gen_rom_table.py rom_table.lua rom_table.h')
+    with open(sys.argv[1], encoding='utf-8') as f:
+        src = f.read()
+    try:
+        size, entries = parse(src)
+    except ParseError as e:
+        sys.exit('gen_rom_table.py: %s: %s' % (sys.argv[1], e))
+
+    keys = {int.from_bytes(d[:4], 'big'): d for d in entries}
+    if len(keys) != len(entries):
+        sys.exit('gen_rom_table.py: duplicate digest prefix')
+    seed, bits = perfect_hash(list(keys))
+
+    table = [None] * (1 << bits)
+    for key, digest in keys.items():
+        table[slot(key, seed, bits)] = digest
+
+    with open(sys.argv[2], 'w', encoding='utf-8') as f:
+        f.write('/* generated from rom_table.lua by gen_rom_table.py,'
+                ' do not edit */\n')
+        f.write('#define ROM_TABLE_DIGEST_SIZE %d\n' % size)
+        f.write('static constexpr uint32_t rom_table_seed = 0x%08X;\n' % seed)
+        f.write('static constexpr unsigned rom_table_bits = %d;\n' % bits)
+        f.write('static constexpr rom_table_entry rom_table[] =\n{\n')
+        for digest in table:
+            if digest is None:
+                f.write('    {{}, nullptr},\n')
+            else:
+                name = entries[digest].replace('\\', '\\\\').replace('"', '\\"')
+                f.write('    {{%s}, "%s"},\n'
+                        % (', '.join('0x%02X' % b for b in digest), name))
+        f.write('};\n')
+
+
+if __name__ == '__main__':
+    main()
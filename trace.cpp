@@ -0,0 +1,154 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <vector>
+#include <QtGlobal>
+#include "trace.h"
+
+#ifdef Q_OS_WIN
+# include <windows.h>
+#else
+# include <unistd.h>
+#endif
+
+namespace {
+
+class trace_log
+{
+public:
+    std::mutex mutex;
+    std::string path;
+    std::vector<std::string> events;
+
+    ~trace_log()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (path.empty())
+            return;
+        FILE *f = fopen(path.c_str(), "w");
+        if (!f)
+            return;
+        fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", f);
+        for (size_t i = 0; i < events.size(); i++) {
+            fputs(events[i].c_str(), f);
+            fputs(i + 1 < events.size() ? ",\n" : "\n", f);
+        }
+        fputs("]}\n", f);
+        fclose(f);
+    }
+};
+
+}
+
+static std::atomic<bool> enabled(false);
+
+static trace_log &trace_buffer()
+{
+    static trace_log l;
+    return l;
+}
+
+static int64_t now_us()
+{
+    using namespace std::chrono;
+    static const steady_clock::time_point start = steady_clock::now();
+    return duration_cast<microseconds>(steady_clock::now() - start).count();
+}
+
+static int thread_id()
+{
+    static std::atomic<int> next_id(1);
+    thread_local int id = next_id++;
+    return id;
+}
+
+static unsigned long process_id()
+{
+#ifdef Q_OS_WIN
+    return GetCurrentProcessId();
+#else
+    return static_cast<unsigned long>(getpid());
+#endif
+}
+
+static std::string escape(const std::string &str)
+{
+    std::string esc_str;
+    for (unsigned char c : str) {
+        if (c == '"' || c == '\\') {
+            esc_str.push_back('\\');
+            esc_str.push_back(static_cast<char>(c));
+        }
+        else if (c < 0x20) {
+            char buf[7];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            esc_str += buf;
+        }
+        else
+            esc_str.push_back(static_cast<char>(c));
+    }
+    return esc_str;
+}
+
+static void add_event(const char *name, const char *category, char phase,
+                      int64_t ts, int64_t dur, const std::string &args)
+{
+    std::string event = "{\"name\":\"" + escape(name) + "\",\"cat\":\""
+                        + escape(category) + "\",\"ph\":\"" + phase
+                        + "\",\"ts\":" + std::to_string(ts);
+    if (phase == 'X')
+        event += ",\"dur\":" + std::to_string(dur);
+    else if (phase == 'i')
+        event += ",\"s\":\"t\"";
+    event += ",\"pid\":" + std::to_string(process_id()) + ",\"tid\":"
+             + std::to_string(thread_id()) + ",\"args\":{" + args + "}}";
+
+    auto &l = trace_buffer();
+    std::lock_guard<std::mutex> lock(l.mutex);
+    l.events.push_back(std::move(event));
+}
+
+bool trace_enabled()
+{
+    return enabled.load(std::memory_order_relaxed);
+}
+
+void trace_start(const std::string &path)
+{
+    auto &l = trace_buffer();
+    {
+        std::lock_guard<std::mutex> lock(l.mutex);
+        l.path = path;
+    }
+    now_us();
+    enabled = true;
+}
+
+void trace_instant(const char *name, const char *category,
+                   const std::string &args)
+{
+    if (trace_enabled())
+        add_event(name, category, 'i', now_us(), 0, args);
+}
+
+std::string trace_arg(const char *name, const std::string &value)
+{
+    return "\"" + escape(name) + "\":\"" + escape(value) + "\"";
+}
+
+trace_scope::trace_scope(const char *name, const char *category,
+                         const std::string &args)
+    : m_name(name)
+    , m_category(category)
+    , m_args(args)
+    , m_start(trace_enabled() ? now_us() : -1)
+{
+}
+
+trace_scope::~trace_scope()
+{
+    if (m_start >= 0)
+        add_event(m_name, m_category, 'X', m_start, now_us() - m_start,
+                  m_args);
+}
@@ -0,0 +1,30 @@
+#ifndef TRACE_H
+#define TRACE_H
+#include <cstdint>
+#include <string>
+
+bool trace_enabled();
+void trace_start(const std::string &path);
+void trace_instant(const char *name, const char *category,
+                   const std::string &args = std::string());
+std::string trace_arg(const char *name, const std::string &value);
+
+class trace_scope
+{
+public:
+    trace_scope(const char *name, const char *category,
+                const std::string &args = std::string());
+    trace_scope(const trace_scope &) = delete;
+
+    ~trace_scope();
+
+    trace_scope &operator=(const trace_scope &) = delete;
+
+private:
+    const char *m_name;
+    const char *m_category;
+    std::string m_args;
+    int64_t m_start;
+};
+
+#endif
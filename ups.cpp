@@ -0,0 +1,213 @@
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include "crc32.h"
+#include "ups.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define UPS_SIMD
+# include <immintrin.h>
+#endif
+
+static const size_t footer_size = 12;
+
+static uint32_t read_le32(const unsigned char *p)
+{
+    return static_cast<uint32_t>(p[0])
+           | (static_cast<uint32_t>(p[1]) << 8)
+           | (static_cast<uint32_t>(p[2]) << 16)
+           | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+/* each byte holds 7 bits, least significant first, and every byte but the
+   last also adds one to the next group so that encodings are unique */
+static bool read_varint(const unsigned char **p, const unsigned char *end,
+                        size_t *value)
+{
+    uint64_t v = 0;
+    uint64_t shift = 1;
+    while (*p < end) {
+        unsigned char x = *(*p)++;
+        v += (x & 0x7F) * shift;
+        if (x & 0x80) {
+            if (v > std::numeric_limits<size_t>::max())
+                return false;
+            *value = static_cast<size_t>(v);
+            return true;
+        }
+        if (shift > (std::numeric_limits<uint64_t>::max() >> 14))
+            return false;
+        shift <<= 7;
+        v += shift;
+    }
+    return false;
+}
+
+static void xor_scalar(unsigned char *t, const unsigned char *x, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+        t[i] ^= x[i];
+}
+
+#ifdef UPS_SIMD
+__attribute__((target("sse2")))
+static size_t xor_sse2(unsigned char *t, const unsigned char *x, size_t size)
+{
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        auto q = reinterpret_cast<__m128i *>(t + i);
+        __m128i v = _mm_loadu_si128(
+            reinterpret_cast<const __m128i *>(x + i));
+        _mm_storeu_si128(q, _mm_xor_si128(_mm_loadu_si128(q), v));
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+static size_t xor_avx2(unsigned char *t, const unsigned char *x, size_t size)
+{
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        auto q = reinterpret_cast<__m256i *>(t + i);
+        __m256i v = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i *>(x + i));
+        _mm256_storeu_si256(q, _mm256_xor_si256(_mm256_loadu_si256(q), v));
+    }
+    return i;
+}
+#endif
+
+static void xor_run(unsigned char *t, const unsigned char *x, size_t size,
+                    UpsPatch::kernel_t kernel)
+{
+    size_t done = 0;
+#ifdef UPS_SIMD
+    if (kernel == UpsPatch::kernel_t::AVX2)
+        done = xor_avx2(t, x, size);
+    else if (kernel == UpsPatch::kernel_t::SSE2)
+        done = xor_sse2(t, x, size);
+#else
+    (void)kernel;
+#endif
+    xor_scalar(t + done, x + done, size - done);
+}
+
+UpsPatch::UpsPatch(const void *data, size_t size)
+    : data(static_cast<const unsigned char *>(data))
+    , size(size)
+{
+    if (size < 4 + 2 + footer_size || memcmp(data, "UPS1", 4) != 0)
+        throw std::runtime_error("ups: not a UPS patch");
+
+    const unsigned char *p = this->data + 4;
+    const unsigned char *end = this->data + size - footer_size;
+    if (!read_varint(&p, end, &source_size)
+        || !read_varint(&p, end, &target_size))
+    {
+        throw std::runtime_error("ups: malformed header");
+    }
+    hunks_offset = static_cast<size_t>(p - this->data);
+
+    /* the patch's own checksum is left to apply, so that picking a patch
+       by its source only reads the header and footer */
+    source_crc = read_le32(end);
+    target_crc = read_le32(end + 4);
+}
+
+bool UpsPatch::kernelSupported(kernel_t kernel)
+{
+    switch (kernel) {
+        case kernel_t::AUTO:
+        case kernel_t::SCALAR:
+            return true;
+#ifdef UPS_SIMD
+        case kernel_t::SSE2:
+            return __builtin_cpu_supports("sse2");
+        case kernel_t::AVX2:
+            return __builtin_cpu_supports("avx2");
+#endif
+        default:
+            return false;
+    }
+}
+
+size_t UpsPatch::sourceSize() const
+{
+    return source_size;
+}
+
+size_t UpsPatch::targetSize() const
+{
+    return target_size;
+}
+
+uint32_t UpsPatch::sourceCrc() const
+{
+    return source_crc;
+}
+
+uint32_t UpsPatch::targetCrc() const
+{
+    return target_crc;
+}
+
+void UpsPatch::apply(const void *source, size_t source_size, void *target,
+                     size_t target_size, kernel_t kernel) const
+{
+    auto src = static_cast<const unsigned char *>(source);
+    auto dst = static_cast<unsigned char *>(target);
+
+    if (source_size != this->source_size
+        || crc32(0, src, source_size) != source_crc)
+    {
+        throw std::runtime_error("ups: patch doesn't apply to this file");
+    }
+    if (target_size != this->target_size)
+        throw std::runtime_error("ups: wrong target size");
+    if (crc32(0, data, size - 4) != read_le32(data + size - 4))
+        throw std::runtime_error("ups: patch checksum mismatch");
+
+    if (kernel == kernel_t::AUTO) {
+        static const kernel_t best = kernelSupported(kernel_t::AVX2)
+                                     ? kernel_t::AVX2
+                                     : kernelSupported(kernel_t::SSE2)
+                                       ? kernel_t::SSE2
+                                       : kernel_t::SCALAR;
+        kernel = best;
+    }
+
+    /* the target starts out as the source, zero-extended, and each hunk
+       skips ahead over unchanged bytes and then xors in a run of changes
+       up to a zero byte. bytes that land past the end of the target are
+       dropped, as in the reference implementation */
+    size_t n = std::min(source_size, target_size);
+    if (dst != src)
+        memmove(dst, src, n);
+    memset(dst + n, 0, target_size - n);
+
+    const unsigned char *p = data + hunks_offset;
+    const unsigned char *end = data + size - footer_size;
+    size_t pos = 0;
+    while (p < end) {
+        size_t skip;
+        if (!read_varint(&p, end, &skip) || skip > SIZE_MAX - pos)
+            throw std::runtime_error("ups: malformed hunk");
+        pos += skip;
+
+        auto z = static_cast<const unsigned char *>(
+            memchr(p, 0, static_cast<size_t>(end - p)));
+        if (!z)
+            throw std::runtime_error("ups: unterminated hunk");
+        size_t run = static_cast<size_t>(z - p);
+        if (pos < target_size)
+            xor_run(dst + pos, p, std::min(run, target_size - pos), kernel);
+        if (run >= SIZE_MAX - pos)
+            throw std::runtime_error("ups: malformed hunk");
+        pos += run + 1;
+        p = z + 1;
+    }
+
+    if (crc32(0, dst, target_size) != target_crc)
+        throw std::runtime_error("ups: target checksum mismatch");
+}
@@ -0,0 +1,43 @@
+#ifndef UPS_H
+#define UPS_H
+#include <cstddef>
+#include <cstdint>
+
+/* a UPS patch in memory. the data isn't copied and has to outlive the
+   object. construction only reads the header and footer, the rest of the
+   patch is checked by apply */
+class UpsPatch
+{
+public:
+    enum kernel_t
+    {
+        AUTO,
+        SCALAR,
+        SSE2,
+        AVX2,
+    };
+
+    UpsPatch(const void *data, size_t size);
+
+    static bool kernelSupported(kernel_t kernel);
+
+    size_t sourceSize() const;
+    size_t targetSize() const;
+    uint32_t sourceCrc() const;
+    uint32_t targetCrc() const;
+
+    /* source and target may be the same buffer */
+    void apply(const void *source, size_t source_size, void *target,
+               size_t target_size, kernel_t kernel = kernel_t::AUTO) const;
+
+private:
+    const unsigned char *data;
+    size_t size;
+    size_t hunks_offset;
+    size_t source_size;
+    size_t target_size;
+    uint32_t source_crc;
+    uint32_t target_crc;
+};
+
+#endif
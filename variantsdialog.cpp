@@ -0,0 +1,57 @@
+#include <QCheckBox>
+#include <QPushButton>
+#include "variantsdialog.h"
+#include "ui_variantsdialog.h"
+
+VariantsDialog::VariantsDialog(QWidget *parent)
+    : QDialog(parent)
+    , ui(new Ui::VariantsDialog)
+{
+    ui->setupUi(this);
+
+    /* in the order of PatcherSettings::wad_region_t and wad_remap_t */
+    region_boxes = {ui->checkbox_jap, ui->checkbox_usa, ui->checkbox_eur,
+                    ui->checkbox_free};
+    remap_boxes = {ui->checkbox_default, ui->checkbox_raphnet,
+                   ui->checkbox_none};
+
+    for (auto box : region_boxes)
+        connect(box, &QCheckBox::toggled, this, &VariantsDialog::update_state);
+    for (auto box : remap_boxes)
+        connect(box, &QCheckBox::toggled, this, &VariantsDialog::update_state);
+    connect(ui->buttonbox, &QDialogButtonBox::accepted,
+            this, &QDialog::accept);
+    connect(ui->buttonbox, &QDialogButtonBox::rejected,
+            this, &QDialog::reject);
+}
+
+VariantsDialog::~VariantsDialog()
+{
+    delete ui;
+}
+
+std::vector<PatcherSettings::wad_region_t> VariantsDialog::regions()
+{
+    std::vector<PatcherSettings::wad_region_t> regions;
+    for (size_t i = 0; i < region_boxes.size(); i++) {
+        if (region_boxes[i]->isChecked())
+            regions.push_back(static_cast<PatcherSettings::wad_region_t>(i));
+    }
+    return regions;
+}
+
+std::vector<PatcherSettings::wad_remap_t> VariantsDialog::remaps()
+{
+    std::vector<PatcherSettings::wad_remap_t> remaps;
+    for (size_t i = 0; i < remap_boxes.size(); i++) {
+        if (remap_boxes[i]->isChecked())
+            remaps.push_back(static_cast<PatcherSettings::wad_remap_t>(i));
+    }
+    return remaps;
+}
+
+void VariantsDialog::update_state()
+{
+    ui->buttonbox->button(QDialogButtonBox::Ok)
+        ->setEnabled(!regions().empty() && !remaps().empty());
+}
@@ -0,0 +1,31 @@
+#ifndef VARIANTSDIALOG_H
+#define VARIANTSDIALOG_H
+#include <vector>
+#include <QDialog>
+#include "patcher.h"
+
+QT_BEGIN_NAMESPACE
+class QCheckBox;
+namespace Ui { class VariantsDialog; }
+QT_END_NAMESPACE
+
+class VariantsDialog : public QDialog
+{
+    Q_OBJECT
+
+public:
+    explicit VariantsDialog(QWidget *parent = nullptr);
+    ~VariantsDialog() override;
+
+    std::vector<PatcherSettings::wad_region_t> regions();
+    std::vector<PatcherSettings::wad_remap_t> remaps();
+
+private:
+    Ui::VariantsDialog *ui;
+    std::vector<QCheckBox *> region_boxes;
+    std::vector<QCheckBox *> remap_boxes;
+
+    void update_state();
+};
+
+#endif
@@ -0,0 +1,637 @@
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFileInfo>
+#include "aes.h"
+#include "mappedfile.h"
+#include "wad.h"
+
+static const uint16_t wad_type = 0x4973;
+static const size_t wad_header_size = 0x20;
+static const size_t wad_align = 0x40;
+
+/* an rsa-2048 signature block, which the signed data follows */
+static const size_t sig_size = 0x140;
+
+static const size_t ticket_size = 0x2A4;
+static const size_t ticket_title_key = 0x1BF;
+static const size_t ticket_title_id = 0x1DC;
+static const size_t ticket_key_index = 0x1F1;
+static const size_t ticket_fill = 0x21E;
+
+static const size_t tmd_title_id = 0x18C;
+static const size_t tmd_region = 0x19C;
+static const size_t tmd_fill = 0x1D4;
+static const size_t tmd_content_count = 0x1DE;
+static const size_t tmd_contents = 0x1E4;
+static const size_t tmd_record_size = 0x24;
+
+/* cbc decryption only depends on the ciphertext, so large contents are
+   decrypted in pieces of this size */
+static const uint64_t decrypt_chunk_size = 1 << 20;
+
+/* gzinject unpacks the u8 archive holding the rom into a directory */
+static const uint32_t u8_content_index = 5;
+static const uint32_t u8_magic = 0x55AA382D;
+static const size_t u8_node_size = 12;
+static const size_t u8_align = 0x20;
+
+static uint64_t align(uint64_t n, uint64_t a)
+{
+    return (n + a - 1) / a * a;
+}
+
+static uint16_t read_be16(const unsigned char *p)
+{
+    return static_cast<uint16_t>((p[0] << 8) | p[1]);
+}
+
+static uint32_t read_be32(const unsigned char *p)
+{
+    return (static_cast<uint32_t>(p[0]) << 24)
+           | (static_cast<uint32_t>(p[1]) << 16)
+           | (static_cast<uint32_t>(p[2]) << 8)
+           | static_cast<uint32_t>(p[3]);
+}
+
+static uint64_t read_be64(const unsigned char *p)
+{
+    return (static_cast<uint64_t>(read_be32(p)) << 32) | read_be32(p + 4);
+}
+
+static void write_be16(unsigned char *p, uint16_t v)
+{
+    p[0] = static_cast<unsigned char>(v >> 8);
+    p[1] = static_cast<unsigned char>(v);
+}
+
+static void write_be32(unsigned char *p, uint32_t v)
+{
+    write_be16(p, static_cast<uint16_t>(v >> 16));
+    write_be16(p + 2, static_cast<uint16_t>(v));
+}
+
+static void write_be64(unsigned char *p, uint64_t v)
+{
+    write_be32(p, static_cast<uint32_t>(v >> 32));
+    write_be32(p + 4, static_cast<uint32_t>(v));
+}
+
+static void sha1(const unsigned char *data, size_t size, unsigned char *out)
+{
+    const size_t chunk_size = 1 << 30;
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    for (size_t pos = 0; pos < size; pos += chunk_size) {
+        hash.addData(reinterpret_cast<const char *>(data + pos),
+                     static_cast<int>(std::min(chunk_size, size - pos)));
+    }
+    QByteArray result = hash.result();
+    memcpy(out, result.constData(), 20);
+}
+
+static std::vector<unsigned char> read_file(const QString &path)
+{
+    mapped_file file(path.toStdString(), mapped_file::mode_t::READ);
+    return std::vector<unsigned char>(file.data(),
+                                      file.data() + file.size());
+}
+
+static void write_file(const QString &path, const unsigned char *data,
+                       size_t size)
+{
+    mapped_file file = mapped_file::create(path.toStdString(), size);
+    if (size != 0)
+        memcpy(file.data(), data, size);
+}
+
+static void write_file(const QString &path,
+                       const std::vector<unsigned char> &data)
+{
+    write_file(path, data.data(), data.size());
+}
+
+/* the signature checks of old ios versions compare the hashes with
+   strncmp, so a zeroed signature passes for any data whose hash starts
+   with a zero byte. vary some unused bytes until it does */
+static void fakesign(std::vector<unsigned char> &blob, size_t fill)
+{
+    memset(blob.data() + 4, 0, 0x100);
+    for (uint32_t n = 0; ; n++) {
+        write_be32(blob.data() + fill, n);
+        unsigned char hash[20];
+        sha1(blob.data() + sig_size, blob.size() - sig_size, hash);
+        if (hash[0] == 0)
+            return;
+    }
+}
+
+struct wad_job
+{
+    uint64_t cost;
+    std::function<void()> run;
+};
+
+/* run the jobs on up to n_threads threads, this one included. idle threads
+   take the next job off a shared counter, largest first, so that a long
+   job doesn't start last and hold the others up */
+static void run_jobs(std::vector<wad_job> &jobs, unsigned n_threads)
+{
+    std::stable_sort(jobs.begin(), jobs.end(),
+                     [](const wad_job &a, const wad_job &b)
+                     {
+                         return a.cost > b.cost;
+                     });
+
+    std::atomic<size_t> next(0);
+    std::mutex eptr_mutex;
+    std::exception_ptr eptr;
+    auto worker = [&jobs, &next, &eptr_mutex, &eptr]()
+    {
+        size_t i;
+        while ((i = next++) < jobs.size()) {
+            try {
+                jobs[i].run();
+            }
+            catch (...) {
+                std::lock_guard<std::mutex> guard(eptr_mutex);
+                if (!eptr)
+                    eptr = std::current_exception();
+            }
+        }
+    };
+
+    if (n_threads == 0)
+        n_threads = std::max(std::thread::hardware_concurrency(), 1u);
+    n_threads = static_cast<unsigned>(std::min<size_t>(n_threads,
+                                                       jobs.size()));
+    std::vector<std::thread> threads;
+    for (unsigned i = 1; i < n_threads; i++) {
+        try {
+            threads.emplace_back(worker);
+        }
+        catch (const std::system_error &) {
+            break;
+        }
+    }
+    worker();
+    for (auto &thread : threads)
+        thread.join();
+
+    if (eptr)
+        std::rethrow_exception(eptr);
+}
+
+static QString content_path(const QString &dir, uint32_t index)
+{
+    return dir + "/content" + QString::number(index);
+}
+
+static void u8_extract(const unsigned char *data, size_t size,
+                       const QString &dir)
+{
+    if (size < 0x20 || read_be32(data) != u8_magic)
+        throw std::runtime_error("u8: not an archive");
+    uint64_t root = read_be32(data + 4);
+    uint64_t header_size = read_be32(data + 8);
+    if (root + u8_node_size > size || root + header_size > size)
+        throw std::runtime_error("u8: truncated archive");
+    const unsigned char *nodes = data + root;
+    uint64_t n_nodes = read_be32(nodes + 8);
+    if (n_nodes == 0 || n_nodes * u8_node_size > header_size)
+        throw std::runtime_error("u8: corrupt archive");
+    const char *names = reinterpret_cast<const char *>(nodes)
+                        + n_nodes * u8_node_size;
+    size_t names_size = header_size - n_nodes * u8_node_size;
+
+    struct level
+    {
+        uint64_t end;
+        QString path;
+    };
+    std::vector<level> stack = {{n_nodes, dir}};
+    if (!QDir().mkpath(dir))
+        throw std::runtime_error("u8: could not create " + dir.toStdString());
+
+    for (uint64_t i = 1; i < n_nodes; i++) {
+        while (stack.back().end <= i)
+            stack.pop_back();
+        const unsigned char *node = nodes + i * u8_node_size;
+        size_t name_offset = read_be32(node) & 0xFFFFFF;
+        const char *name_end = name_offset < names_size
+                               ? static_cast<const char *>(memchr(
+                                     names + name_offset, 0,
+                                     names_size - name_offset))
+                               : nullptr;
+        if (!name_end)
+            throw std::runtime_error("u8: corrupt archive");
+        QString name = QString::fromUtf8(names + name_offset,
+                                         static_cast<int>(name_end - names
+                                                          - name_offset));
+        if (name.isEmpty() || name == "." || name == ".."
+            || name.contains('/') || name.contains('\\'))
+        {
+            throw std::runtime_error("u8: bad file name");
+        }
+
+        QString path = stack.back().path + "/" + name;
+        uint64_t offset = read_be32(node + 4);
+        uint64_t length = read_be32(node + 8);
+        if (node[0] == 1) {
+            if (length <= i || length > stack.back().end)
+                throw std::runtime_error("u8: corrupt archive");
+            if (!QDir().mkpath(path)) {
+                throw std::runtime_error("u8: could not create "
+                                         + path.toStdString());
+            }
+            stack.push_back({length, path});
+        }
+        else {
+            if (offset + length > size)
+                throw std::runtime_error("u8: truncated archive");
+            write_file(path, data + offset, length);
+        }
+    }
+}
+
+static std::vector<unsigned char> u8_create(const QString &dir)
+{
+    struct node
+    {
+        QString path;
+        uint32_t name_offset;
+        uint32_t parent;
+        uint32_t end;
+        bool is_dir;
+    };
+    std::vector<node> nodes = {{dir, 0, 0, 0, true}};
+    std::string names(1, '\0');
+
+    std::function<void(const QString &, uint32_t)> add_dir;
+    add_dir = [&](const QString &path, uint32_t parent)
+    {
+        QFileInfoList entries = QDir(path).entryInfoList(
+            QDir::Dirs | QDir::Files | QDir::NoDotAndDotDot, QDir::Name);
+        for (const QFileInfo &entry : entries) {
+            uint32_t index = static_cast<uint32_t>(nodes.size());
+            nodes.push_back({entry.filePath(),
+                             static_cast<uint32_t>(names.size()), parent, 0,
+                             entry.isDir()});
+            names += entry.fileName().toStdString();
+            names.push_back('\0');
+            if (entry.isDir()) {
+                add_dir(entry.filePath(), index);
+                nodes[index].end = static_cast<uint32_t>(nodes.size());
+            }
+        }
+    };
+    add_dir(dir, 0);
+    nodes[0].end = static_cast<uint32_t>(nodes.size());
+
+    size_t header_size = nodes.size() * u8_node_size + names.size();
+    size_t data_offset = align(0x20 + header_size, u8_align);
+    std::vector<unsigned char> out(data_offset);
+    write_be32(out.data(), u8_magic);
+    write_be32(out.data() + 4, 0x20);
+    write_be32(out.data() + 8, static_cast<uint32_t>(header_size));
+    write_be32(out.data() + 12, static_cast<uint32_t>(data_offset));
+    memcpy(out.data() + 0x20 + nodes.size() * u8_node_size, names.data(),
+           names.size());
+
+    for (size_t i = 0; i < nodes.size(); i++) {
+        unsigned char *p = out.data() + 0x20 + i * u8_node_size;
+        write_be32(p, nodes[i].name_offset);
+        if (nodes[i].is_dir) {
+            p[0] = 1;
+            write_be32(p + 4, nodes[i].parent);
+            write_be32(p + 8, nodes[i].end);
+            continue;
+        }
+        std::vector<unsigned char> data = read_file(nodes[i].path);
+        size_t offset = align(out.size(), u8_align);
+        if (offset + data.size() > UINT32_MAX)
+            throw std::runtime_error("u8: archive too large");
+        out.resize(offset);
+        out.insert(out.end(), data.begin(), data.end());
+        /* the pointer may have moved */
+        p = out.data() + 0x20 + i * u8_node_size;
+        write_be32(p + 4, static_cast<uint32_t>(offset));
+        write_be32(p + 8, static_cast<uint32_t>(data.size()));
+    }
+    return out;
+}
+
+Wad::Wad(const unsigned char *common_key)
+{
+    memcpy(this->common_key, common_key, 16);
+}
+
+Wad::Wad(const std::string &path, const unsigned char *common_key,
+         unsigned n_threads)
+    : Wad(common_key)
+{
+    mapped_file file(path, mapped_file::mode_t::READ);
+    const unsigned char *p = file.data();
+    uint64_t size = file.size();
+    if (size < wad_header_size || read_be32(p) != wad_header_size
+        || read_be16(p + 4) != wad_type)
+    {
+        throw std::runtime_error("wad: not an installable wad");
+    }
+
+    /* the certificate chain is followed by a revocation list, which is
+       usually empty */
+    uint64_t cert_offset = align(wad_header_size, wad_align);
+    uint64_t crl_offset = cert_offset + align(read_be32(p + 8), wad_align);
+    uint64_t ticket_offset = crl_offset + align(read_be32(p + 12), wad_align);
+    uint64_t tmd_offset = ticket_offset + align(read_be32(p + 16), wad_align);
+    uint64_t data_offset = tmd_offset + align(read_be32(p + 20), wad_align);
+    uint64_t data_size = read_be32(p + 24);
+    uint64_t footer_offset = data_offset + align(data_size, wad_align);
+    uint64_t footer_size = read_be32(p + 28);
+    if (footer_offset + footer_size > size)
+        throw std::runtime_error("wad: truncated file");
+
+    cert.assign(p + cert_offset, p + cert_offset + read_be32(p + 8));
+    crl.assign(p + crl_offset, p + crl_offset + read_be32(p + 12));
+    ticket.assign(p + ticket_offset, p + ticket_offset + read_be32(p + 16));
+    tmd.assign(p + tmd_offset, p + tmd_offset + read_be32(p + 20));
+    footer.assign(p + footer_offset, p + footer_offset + footer_size);
+    check_tmd();
+    decrypt_title_key();
+
+    Aes128 aes(title_key);
+    std::vector<wad_job> jobs;
+    contents.resize(contentCount());
+    uint64_t pos = data_offset;
+    for (size_t i = 0; i < contents.size(); i++) {
+        const unsigned char *record = tmd.data() + tmd_contents
+                                      + i * tmd_record_size;
+        uint64_t enc_size = align(read_be64(record + 8), 16);
+        if (pos + enc_size > data_offset + data_size)
+            throw std::runtime_error("wad: truncated file");
+
+        const unsigned char *src = p + pos;
+        std::vector<unsigned char> &dst = contents[i];
+        dst.resize(enc_size);
+        for (uint64_t off = 0; off < enc_size; off += decrypt_chunk_size) {
+            size_t n = std::min(decrypt_chunk_size, enc_size - off);
+            jobs.push_back({n, [&aes, record, src, &dst, off, n]()
+                            {
+                                /* the iv of a piece is the last block of
+                                   ciphertext before it */
+                                unsigned char iv[16] = {record[4],
+                                                        record[5]};
+                                if (off != 0)
+                                    memcpy(iv, src + off - 16, 16);
+                                aes.decryptCbc(iv, src + off,
+                                               dst.data() + off, n);
+                            }});
+        }
+        pos += align(enc_size, wad_align);
+    }
+    run_jobs(jobs, n_threads);
+
+    jobs.clear();
+    for (size_t i = 0; i < contents.size(); i++) {
+        const unsigned char *record = tmd.data() + tmd_contents
+                                      + i * tmd_record_size;
+        std::vector<unsigned char> &data = contents[i];
+        jobs.push_back({data.size(), [record, &data]()
+                        {
+                            data.resize(read_be64(record + 8));
+                            unsigned char hash[20];
+                            sha1(data.data(), data.size(), hash);
+                            if (memcmp(hash, record + 16, 20) != 0) {
+                                throw std::runtime_error(
+                                    "wad: content "
+                                    + std::to_string(read_be16(record + 4))
+                                    + " doesn't match its hash");
+                            }
+                        }});
+    }
+    run_jobs(jobs, n_threads);
+
+    signed_ticket = ticket;
+    signed_tmd = tmd;
+}
+
+Wad Wad::fromDirectory(const std::string &dir,
+                       const unsigned char *common_key)
+{
+    QString d = QString::fromStdString(dir);
+    Wad wad(common_key);
+    wad.cert = read_file(d + "/cert.cert");
+    wad.ticket = read_file(d + "/ticket.tik");
+    wad.tmd = read_file(d + "/metadata.tmd");
+    if (QFileInfo::exists(d + "/crl.bin"))
+        wad.crl = read_file(d + "/crl.bin");
+    if (QFileInfo::exists(d + "/footer.bin"))
+        wad.footer = read_file(d + "/footer.bin");
+    wad.check_tmd();
+    wad.decrypt_title_key();
+
+    for (size_t i = 0; i < wad.contentCount(); i++) {
+        uint32_t index = read_be16(wad.tmd.data() + tmd_contents
+                                   + i * tmd_record_size + 4);
+        QString path = content_path(d, index);
+        if (QFileInfo(path).isDir())
+            wad.contents.push_back(u8_create(path));
+        else
+            wad.contents.push_back(read_file(path + ".app"));
+    }
+
+    wad.signed_ticket = wad.ticket;
+    wad.signed_tmd = wad.tmd;
+    return wad;
+}
+
+void Wad::extract(const std::string &dir) const
+{
+    QString d = QString::fromStdString(dir);
+    if (!QDir().mkpath(d))
+        throw std::runtime_error("wad: could not create " + dir);
+    write_file(d + "/cert.cert", cert);
+    if (!crl.empty())
+        write_file(d + "/crl.bin", crl);
+    write_file(d + "/ticket.tik", ticket);
+    write_file(d + "/metadata.tmd", tmd);
+    write_file(d + "/footer.bin", footer);
+
+    for (size_t i = 0; i < contentCount(); i++) {
+        uint32_t index = read_be16(tmd.data() + tmd_contents
+                                   + i * tmd_record_size + 4);
+        const std::vector<unsigned char> &data = contents[i];
+        if (index == u8_content_index && data.size() >= 4
+            && read_be32(data.data()) == u8_magic)
+        {
+            u8_extract(data.data(), data.size(), content_path(d, index));
+        }
+        else
+            write_file(content_path(d, index) + ".app", data);
+    }
+}
+
+void Wad::save(const std::string &path, unsigned n_threads) const
+{
+    std::vector<unsigned char> out_ticket = build_ticket();
+
+    uint64_t cert_offset = align(wad_header_size, wad_align);
+    uint64_t crl_offset = cert_offset + align(cert.size(), wad_align);
+    uint64_t ticket_offset = crl_offset + align(crl.size(), wad_align);
+    uint64_t tmd_offset = ticket_offset + align(out_ticket.size(), wad_align);
+    uint64_t data_offset = tmd_offset + align(tmd.size(), wad_align);
+    std::vector<uint64_t> offsets;
+    uint64_t data_size = 0;
+    for (const auto &data : contents) {
+        data_size = align(data_size, wad_align);
+        offsets.push_back(data_offset + data_size);
+        data_size += align(data.size(), 16);
+    }
+    uint64_t footer_offset = data_offset + align(data_size, wad_align);
+    if (data_size > UINT32_MAX)
+        throw std::runtime_error("wad: contents too large");
+
+    mapped_file file = mapped_file::create(path,
+                                           footer_offset + footer.size());
+    unsigned char *p = file.data();
+
+    /* neither sha-1 nor cbc encryption can be split up, but the two are
+       independent of each other, so every content makes two jobs. each
+       writes to its own part of the output */
+    Aes128 aes(title_key);
+    std::vector<unsigned char> hashes(20 * contents.size());
+    std::vector<wad_job> jobs;
+    for (size_t i = 0; i < contents.size(); i++) {
+        const std::vector<unsigned char> &data = contents[i];
+        const unsigned char *record = tmd.data() + tmd_contents
+                                      + i * tmd_record_size;
+        unsigned char *hash = hashes.data() + 20 * i;
+        unsigned char *q = p + offsets[i];
+        jobs.push_back({data.size(), [&data, hash]()
+                        {
+                            sha1(data.data(), data.size(), hash);
+                        }});
+        jobs.push_back({data.size(), [&aes, &data, record, q]()
+                        {
+                            unsigned char iv[16] = {record[4], record[5]};
+                            size_t whole = data.size() / 16 * 16;
+                            aes.encryptCbc(iv, data.data(), q, whole);
+                            if (whole != data.size()) {
+                                unsigned char block[16] = {};
+                                std::copy(data.begin() + whole, data.end(),
+                                          block);
+                                aes.encryptCbc(iv, block, q + whole, 16);
+                            }
+                        }});
+    }
+    run_jobs(jobs, n_threads);
+
+    std::vector<unsigned char> out_tmd = build_tmd(hashes.data());
+    write_be32(p, wad_header_size);
+    write_be16(p + 4, wad_type);
+    write_be32(p + 8, static_cast<uint32_t>(cert.size()));
+    write_be32(p + 12, static_cast<uint32_t>(crl.size()));
+    write_be32(p + 16, static_cast<uint32_t>(out_ticket.size()));
+    write_be32(p + 20, static_cast<uint32_t>(out_tmd.size()));
+    write_be32(p + 24, static_cast<uint32_t>(data_size));
+    write_be32(p + 28, static_cast<uint32_t>(footer.size()));
+    std::copy(cert.begin(), cert.end(), p + cert_offset);
+    std::copy(crl.begin(), crl.end(), p + crl_offset);
+    std::copy(out_ticket.begin(), out_ticket.end(), p + ticket_offset);
+    std::copy(out_tmd.begin(), out_tmd.end(), p + tmd_offset);
+    std::copy(footer.begin(), footer.end(), p + footer_offset);
+}
+
+uint64_t Wad::titleId() const
+{
+    return read_be64(tmd.data() + tmd_title_id);
+}
+
+void Wad::setChannelId(const std::string &id)
+{
+    if (id.size() != 4)
+        throw std::runtime_error("wad: channel id must be 4 characters");
+    memcpy(tmd.data() + tmd_title_id + 4, id.data(), 4);
+    memcpy(ticket.data() + ticket_title_id + 4, id.data(), 4);
+}
+
+void Wad::setRegion(unsigned region)
+{
+    if (region > 3)
+        throw std::runtime_error("wad: bad region");
+    write_be16(tmd.data() + tmd_region, static_cast<uint16_t>(region));
+}
+
+size_t Wad::contentCount() const
+{
+    return read_be16(tmd.data() + tmd_content_count);
+}
+
+std::vector<unsigned char> &Wad::content(uint32_t index)
+{
+    for (size_t i = 0; i < contents.size(); i++) {
+        if (read_be16(tmd.data() + tmd_contents + i * tmd_record_size + 4)
+            == index)
+        {
+            return contents[i];
+        }
+    }
+    throw std::runtime_error("wad: no content " + std::to_string(index));
+}
+
+void Wad::check_tmd() const
+{
+    if (ticket.size() < ticket_size)
+        throw std::runtime_error("wad: truncated ticket");
+    if (ticket[ticket_key_index] != 0)
+        throw std::runtime_error("wad: unsupported common key");
+    if (tmd.size() < tmd_contents
+        || tmd.size() < tmd_contents + contentCount() * tmd_record_size)
+    {
+        throw std::runtime_error("wad: truncated tmd");
+    }
+}
+
+void Wad::decrypt_title_key()
+{
+    unsigned char iv[16] = {};
+    memcpy(iv, ticket.data() + ticket_title_id, 8);
+    Aes128(common_key).decryptCbc(iv, ticket.data() + ticket_title_key,
+                                  title_key, 16);
+}
+
+std::vector<unsigned char> Wad::build_ticket() const
+{
+    /* the title key is encrypted with the title id as its iv, so it has
+       to be redone if the channel id changed */
+    std::vector<unsigned char> out = ticket;
+    unsigned char iv[16] = {};
+    memcpy(iv, out.data() + ticket_title_id, 8);
+    Aes128(common_key).encryptCbc(iv, title_key,
+                                  out.data() + ticket_title_key, 16);
+    if (out != signed_ticket)
+        fakesign(out, ticket_fill);
+    return out;
+}
+
+std::vector<unsigned char> Wad::build_tmd(const unsigned char *hashes) const
+{
+    std::vector<unsigned char> out = tmd;
+    for (size_t i = 0; i < contents.size(); i++) {
+        unsigned char *record = out.data() + tmd_contents
+                                + i * tmd_record_size;
+        write_be64(record + 8, contents[i].size());
+        memcpy(record + 16, hashes + 20 * i, 20);
+    }
+    if (out != signed_tmd)
+        fakesign(out, tmd_fill);
+    return out;
+}
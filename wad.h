@@ -0,0 +1,54 @@
+#ifndef WAD_H
+#define WAD_H
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/* an installable wii wad with its contents decrypted in memory. the
+   extracted layout is the one gzinject uses, so that either can pack what
+   the other extracted */
+class Wad
+{
+public:
+    /* read and decrypt a wad. the contents are checked against the hashes
+       in the tmd, which also catches a wrong common key. n_threads is the
+       most threads to use here and in save(), 0 for one per core */
+    Wad(const std::string &path, const unsigned char *common_key,
+        unsigned n_threads = 0);
+
+    static Wad fromDirectory(const std::string &dir,
+                             const unsigned char *common_key);
+
+    void extract(const std::string &dir) const;
+    /* encrypt and write the wad, updating the content records of the tmd
+       and fakesigning whatever was changed */
+    void save(const std::string &path, unsigned n_threads = 0) const;
+
+    uint64_t titleId() const;
+    void setChannelId(const std::string &id);
+    void setRegion(unsigned region);
+
+    size_t contentCount() const;
+    std::vector<unsigned char> &content(uint32_t index);
+
+private:
+    Wad(const unsigned char *common_key);
+
+    unsigned char common_key[16];
+    unsigned char title_key[16];
+    std::vector<unsigned char> cert;
+    std::vector<unsigned char> crl;
+    std::vector<unsigned char> ticket;
+    std::vector<unsigned char> tmd;
+    std::vector<unsigned char> footer;
+    std::vector<std::vector<unsigned char>> contents;
+    std::vector<unsigned char> signed_ticket;
+    std::vector<unsigned char> signed_tmd;
+
+    void check_tmd() const;
+    void decrypt_title_key();
+    std::vector<unsigned char> build_ticket() const;
+    std::vector<unsigned char> build_tmd(const unsigned char *hashes) const;
+};
+
+#endif
@@ -0,0 +1,162 @@
+#include <exception>
+#include <stdexcept>
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QLockFile>
+#include <QStandardPaths>
+#include "publish.h"
+#include "wadcache.h"
+
+static void hash_file(QCryptographicHash &hash, const QString &path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly) || !hash.addData(&file)) {
+        throw std::runtime_error(path.toStdString() + ": "
+                                 + file.errorString().toStdString());
+    }
+}
+
+/* copy_file clones where the filesystem can (FICLONE, clonefile, block
+   cloning through CopyFile on ReFS), so extractions share their blocks
+   with the cache. hard links would be cheaper still, but the patch scripts
+   and gzinject rewrite extracted files in place, which would write through
+   to the cache */
+static bool clone_tree(const QString &src_dir, const QString &dest_dir)
+{
+    if (!QDir().mkpath(dest_dir))
+        return false;
+
+    QDir src(src_dir);
+    QDirIterator it(src_dir, QDir::AllEntries | QDir::Hidden
+                             | QDir::NoDotAndDotDot,
+                    QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        QString src_path = it.next();
+        QString dest_path = dest_dir + "/" + src.relativeFilePath(src_path);
+        if (it.fileInfo().isDir()) {
+            if (!QDir().mkpath(dest_path))
+                return false;
+            continue;
+        }
+        try {
+            copy_file(src_path.toStdString(), dest_path.toStdString());
+        }
+        catch (const std::exception &) {
+            return false;
+        }
+    }
+    return true;
+}
+
+WadCache::WadCache(const QString &path, int max_entries)
+    : path(path)
+    , max_entries(max_entries)
+{
+    if (this->path.isEmpty())
+        this->path = defaultPath();
+}
+
+QString WadCache::defaultPath()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation)
+           + "/wadextract";
+}
+
+QByteArray WadCache::key(const QString &wad_path, const QString &key_path)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash_file(hash, wad_path);
+    hash_file(hash, key_path);
+    return hash.result();
+}
+
+/* fetch replaces the destination wholesale, so the shim only uses the cache
+   for directories that sit in a temporary directory of a patch. Patcher
+   marks those with this file */
+static const char tmpdir_marker[] = ".gz-gui-tmpdir";
+
+bool WadCache::markTmpdir(const QString &dir)
+{
+    QFile marker(dir + "/" + tmpdir_marker);
+    return marker.open(QIODevice::WriteOnly);
+}
+
+bool WadCache::inTmpdir(const QString &dir)
+{
+    QFileInfo info(dir);
+    QString parent = QFileInfo(info.absolutePath()).canonicalFilePath();
+    return !parent.isEmpty() && info.fileName() != ".."
+           && info.fileName() != "."
+           && QFileInfo(parent + "/" + tmpdir_marker).isFile();
+}
+
+bool WadCache::fetch(const QByteArray &key, const QString &dest_dir)
+{
+    if (!QDir().mkpath(path))
+        return false;
+    QLockFile lock(path + "/lock");
+    if (!lock.lock())
+        return false;
+
+    QString dir = entry_path(key, "");
+    if (!QFileInfo(dir).isDir())
+        return false;
+
+    QDir(dest_dir).removeRecursively();
+    if (!clone_tree(dir, dest_dir)) {
+        QDir(dest_dir).removeRecursively();
+        return false;
+    }
+
+    QFile stamp_file(entry_path(key, ".stamp"));
+    if (stamp_file.open(QIODevice::Append)) {
+        stamp_file.setFileTime(QDateTime::currentDateTimeUtc(),
+                               QFileDevice::FileModificationTime);
+    }
+    return true;
+}
+
+void WadCache::insert(const QByteArray &key, const QString &src_dir)
+{
+    if (!QDir().mkpath(path))
+        return;
+    QLockFile lock(path + "/lock");
+    if (!lock.lock())
+        return;
+
+    QString dir = entry_path(key, "");
+    QString tmp_dir = entry_path(key, ".tmp");
+    if (QFileInfo(dir).isDir())
+        return;
+
+    QDir(tmp_dir).removeRecursively();
+    if (!clone_tree(src_dir, tmp_dir) || !QDir().rename(tmp_dir, dir)) {
+        QDir(tmp_dir).removeRecursively();
+        return;
+    }
+    QFile stamp_file(entry_path(key, ".stamp"));
+    stamp_file.open(QIODevice::WriteOnly);
+
+    evict();
+}
+
+QString WadCache::entry_path(const QByteArray &key, const char *suffix)
+{
+    return path + "/" + QString::fromLatin1(key.toHex()) + suffix;
+}
+
+void WadCache::evict()
+{
+    QFileInfoList entries = QDir(path).entryInfoList({"*.stamp"}, QDir::Files,
+                                                     QDir::Time);
+    for (int i = max_entries; i < entries.size(); i++) {
+        QString base = entries[i].absoluteFilePath();
+        base.chop(6);
+        QDir(base).removeRecursively();
+        QFile::remove(base + ".stamp");
+    }
+}
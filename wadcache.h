@@ -0,0 +1,27 @@
+#ifndef WADCACHE_H
+#define WADCACHE_H
+#include <QByteArray>
+#include <QString>
+
+class WadCache
+{
+public:
+    explicit WadCache(const QString &path = QString(), int max_entries = 4);
+
+    static QString defaultPath();
+    static QByteArray key(const QString &wad_path, const QString &key_path);
+    static bool markTmpdir(const QString &dir);
+    static bool inTmpdir(const QString &dir);
+
+    bool fetch(const QByteArray &key, const QString &dest_dir);
+    void insert(const QByteArray &key, const QString &src_dir);
+
+private:
+    QString path;
+    int max_entries;
+
+    QString entry_path(const QByteArray &key, const char *suffix);
+    void evict();
+};
+
+#endif